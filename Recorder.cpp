@@ -1,8 +1,10 @@
 // Recorder.cpp  (Full Integration: macro recorder + playback + OpenCV hunt + QuestMarker walk)
 //
 // Features:
-// 1) High-precision REL recording via WM_INPUT (reused buffer, large file buffer, no per-event fflush)
-// 2) ABS mode: ALT key OR Cursor.png template match triggers high-rate GetCursorPos poll + EV_MOUSE_POS log
+// 1) High-precision REL recording via WM_INPUT (reused buffer, large file buffer, no per-event fflush),
+//    drained in GetRawInputBuffer batches on a high-priority input thread
+// 2) ABS mode: ALT key OR Cursor.png template match logs EV_MOUSE_POS at each WM_INPUT
+//    (--abs=poll keeps the high-rate GetCursorPos poll thread)
 // 3) QuestMarker navigation with Tesseract OCR distance reading:
 //    - Finds ALL marker matches, ignores quest log rect (45,282)-(72,311)
 //    - Captures ROI below marker, OCRs the distance number (e.g. "76m")
@@ -14,9 +16,13 @@
 // 4) Hunt + BattleStart: stops hunt AND questwalk on BattleStart; SHIFT restarts hunt
 // 5) Hardcoded default paths: templates\Enemies, templates\BattleStart.png,
 //    templates\Cursor.png, templates\QuestMarker.png
-// 6) Threads: hunt, cursor-detect, abs-poll, quest-walk (all independent, safe shutdown)
+// 6) Threads: hunt, cursor-detect, abs-poll (--abs=poll), quest-walk (all independent, safe shutdown)
+//    plus one shared capture thread (DXGI Desktop Duplication, GDI fallback) that
+//    follows the game window's monitor (--capture) and publishes frames into a
+//    triple-buffered ring read in place by the others
 // 7) Clean shutdown: stop all threads, release keys, join safely
-// 8) Preserves .rmac file format
+// 8) .rmac v1 (raw 24-byte events) and v2 (delta/varint blocks + block index);
+//    every reader accepts both, writers use --format (default 2)
 //
 // Commands:
 //   Recorder.exe record       [file.rmac] [cursor.png] [cursor_th] [cursor_scan_ms] [abs_poll_ms]
@@ -29,6 +35,51 @@
 //                             [ignoreL] [ignoreT] [ignoreR] [ignoreB]
 //   Recorder.exe hunt        [enemy_path] [battle_start.png] [enemy_th] [battle_th] [scan_ms] [cooldown_ms]
 //   Recorder.exe full        [file.rmac]   (record + hunt + questwalk, all hardcoded paths)
+//   Recorder.exe convert     <in.rmac> <out.rmac> [version=2]
+//   Recorder.exe cut         <in.rmac> <out.rmac> <from_s> <to_s>
+//   Recorder.exe splice      <a.rmac> <b.rmac> <out.rmac> [at_s=end] [gap_ms=0]
+//   Recorder.exe retime      <in.rmac> <out.rmac> <factor> [from_s=0] [to_s=end]
+//   Recorder.exe filter-type <in.rmac> <out.rmac> <TYPE[,TYPE...]>
+//                             (edit the mapped file; untouched v2 blocks are copied as raw bytes)
+//   Recorder.exe verify      [file.rmac]   (play once, capture the injected input back through
+//                             raw input into file.rmac.verify.rmac and diff the timelines)
+//   Recorder.exe bench capture [dir=bench_frames] [frames=200] [interval_ms=200]
+//   Recorder.exe bench calibrate <template.png> <gray|hue|sat|bgr> [dir=bench_frames] [bgr_th=0.80]
+//                             (writes template.png.match: match space + calibrated threshold;
+//                             hue is refused for red templates, whose hue wraps at 0/179)
+//   Recorder.exe bench       [dir] [enemy_path] [battle_start.png] [enemy_th] [battle_th]
+//                             [quest_marker.png] [marker_th] [passes=1]
+//                             (p50/p95/p99 per vision stage over the dumped frames)
+//
+// Options (anywhere on the command line, stripped before positional parsing):
+//   --pyramid=N        enemy matching on a 1/N downscaled frame, refined at full res (1=off, 2, 4)
+//   --roi=L,T,R,B      restrict enemy search to this screen rect
+//   --exclude=L,T,R,B  drop enemy matches centred in this rect (repeatable)
+//   --battle-roi=L,T,R,B  BattleStart matched only in this rect, on every captured frame
+//   --gate=tiles|off   rematch only 64px screen tiles whose checksum changed since the last scan (default tiles)
+//   --capture=monitor|window|virtual  grab the game window's monitor (default), its client rect,
+//                      or every monitor; rects above and the quest ignore rect are relative to it
+//   --threads=N        enemy match worker pool size, one template/band per task (0=auto)
+//   --gpu=opencl|off   template matching on an OpenCL device (UMat); CPU when none works
+//   --format=N         .rmac version written by record/full/import (1 or 2, default 2)
+//   --quantum=US       playback batch window: events due within US share one SendInput (1000)
+//   --coalesce=PX      playback: sum consecutive REL moves while each axis stays <= PX (0=off)
+//   --ui-hz=N          overlay render rate; playback cursor refresh / message pump rate (60)
+//   --speed=X          playback speed multiplier, 0.5 - 4.0
+//   --loop[=N]         repeat playback N times (bare/0 = until ESC)
+//   --seek=S           start playback S seconds into the recording (block index lookup)
+//   --ocr=digits|tesseract  quest distance reader; digits = templates\Digits glyph NN,
+//                      Tesseract on low confidence (agreeing reads saved as Digits\candidates)
+//   --track=0|1        quest marker tracking window around the predicted position (default 1)
+//   --cursor=shape|scan  ABS cursor detection: shape = match only when the OS cursor
+//                      image changes (hashed); scan = match the screen ROI every scan_ms
+//   --abs=input|poll   ABS positions read at each WM_INPUT (default) or by the
+//                      abs_poll_ms GetCursorPos thread
+//   --trace=FILE.json  per-thread stage/queue trace rings, written as Chrome trace JSON at exit
+//   --log=N            hot-path console lines ([QUEST] pos, [DEBUG], [SCAN]) at most N/s each (0=off)
+//   --affinity=MASK    CPU mask for the capture, hunt, quest, OCR and cursor threads (e.g. 0xF0)
+//   --raw=buffer|message  recording input: GetRawInputBuffer batches on a dedicated
+//                      input thread (default) or one WM_INPUT at a time on the sink window
 //
 // Defaults:
 //   macro.rmac | templates\Enemies | templates\BattleStart.png
@@ -39,12 +90,14 @@
 //   arrival_m=3    resume_m=5
 //
 // Build (MSVC x64 Native Tools Prompt):
-//   cl /EHsc /O2 /std:c++20 /MD Recorder.cpp user32.lib winmm.lib gdi32.lib ^
+//   cl /EHsc /O2 /std:c++20 /MD Recorder.cpp user32.lib winmm.lib gdi32.lib d3d11.lib dxgi.lib ^
 //      /I"opencv\build\include" ^
 //      /I"tesseract\include" ^
 //      /link /MACHINE:X64 ^
 //      /LIBPATH:"opencv\build\x64\vc16\lib" opencv_world4120.lib ^
 //      /LIBPATH:"tesseract\lib" tesseract53.lib leptonica-1.82.0.lib
+//   Add /DRECORDER_COUNT_ALLOCS to include operator new in bench allocs/call
+//   (replaces global operator new; cv::Mat buffers are always counted).
 //
 // Runtime files needed next to Recorder.exe:
 //   tesseract53.dll, leptonica-1.82.0.dll, tessdata\eng.traineddata
@@ -52,9 +105,12 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <mmsystem.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
 #include <cstdio>
 #include <cstdint>
 #include <vector>
+#include <array>
 #include <string>
 #include <thread>
 #include <chrono>
@@ -63,11 +119,20 @@
 #include <cmath>
 #include <cstring>
 #include <mutex>
+#include <condition_variable>
 #include <algorithm>
 #include <cctype>
+#include <functional>
+#include <memory>
+#include <map>
+#include <deque>
+#include <charconv>
+#include <new>
+#include <cstdlib>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/core/ocl.hpp>
 
 #include <tesseract/baseapi.h>
 #include <leptonica/allheaders.h>
@@ -77,6 +142,7 @@ using namespace cv;
 // ========================= Constants =========================
 
 static const char *kSinkClassName = "RawIO_Sink_Window";
+static const char *kRawInputClassName = "RawIO_Input_Window";
 static const char *kOverlayClassName = "RawIO_Overlay_Window";
 
 static const char *kDefaultMacroFile = "macro.rmac";
@@ -84,8 +150,10 @@ static const char *kDefaultEnemyPath = "templates\\Enemies";
 static const char *kDefaultBattlePath = "templates\\BattleStart.png";
 static const char *kDefaultCursorPath = "templates\\Cursor.png";
 static const char *kDefaultQuestPath = "templates\\QuestMarker.png";
+static const char *kDefaultBenchDir = "bench_frames";
+static const char *kDefaultDigitsPath = "templates\\Digits";
 
-// Quest log icon ignore rectangle (screen pixels)
+// Quest log icon ignore rectangle (frame pixels: relative to the captured monitor/window)
 static RECT gQuestLogIgnore = {45, 282, 72, 311};
 
 // Distance thresholds (meters)
@@ -108,7 +176,7 @@ enum EventType : uint32_t
 struct FileHeader
 {
     uint32_t magic;   // 'RMAC' = 0x524D4143
-    uint32_t version; // 1
+    uint32_t version; // 1 = raw Events, 2 = packed blocks (see Macro Format)
     uint64_t start_utc;
 };
 struct Event
@@ -117,6 +185,24 @@ struct Event
     uint64_t t_us;
     int32_t a, b, c;
 };
+struct BlockHeader // v2
+{
+    uint32_t count;
+    uint32_t bytes; // payload size following this header
+    uint64_t first_t;
+};
+struct BlockIndexEntry // v2
+{
+    uint64_t first_t;
+    uint64_t offset; // of the BlockHeader, from file start
+    uint32_t count;
+};
+struct V2Trailer // v2, last bytes of the file
+{
+    uint64_t index_offset;
+    uint32_t block_count;
+    uint32_t magic; // 'RIDX'
+};
 #pragma pack(pop)
 
 // ========================= Globals =========================
@@ -124,9 +210,18 @@ struct Event
 static LARGE_INTEGER gFreq{};
 static LARGE_INTEGER gT0{};
 
-static FILE *gOut = nullptr;
-static bool gRecording = false;
-static bool gPlaying = false;
+class MacroWriter;
+static MacroWriter *gOut = nullptr; // open while recording
+static std::atomic<bool> gRecording{false};
+static std::atomic<bool> gPlaying{false};
+
+// Playback batching
+static int gPlayQuantumUs = 1000; // events due within this of a batch start share one SendInput
+static int gCoalescePx = 0;       // merge consecutive REL moves up to this many counts per axis (0=off)
+static int gUiHz = 60;            // overlay render rate, and playback cursor refresh rate
+static double gPlaySpeed = 1.0;   // 0.5x - 4x
+static int gPlayLoops = 1;        // 0 = until ESC
+static uint64_t gPlaySeekUs = 0;  // start playback at this recorded timestamp
 
 static HWND gSinkHwnd = nullptr;
 static HWND gOverlayHwnd = nullptr;
@@ -138,6 +233,7 @@ static bool gKeyDown[256] = {};
 static POINT gCursorPt{};
 
 static std::vector<BYTE> gRawBuf;
+static bool gRawBuffered = true; // --raw=buffer|message
 
 // ========================= ABS mode =========================
 
@@ -152,8 +248,13 @@ static std::string gAbsCursorTemplatePath = kDefaultCursorPath;
 static double gCursorTh = 0.88;
 static int gCursorScanMs = 33;
 static int gAbsPollMs = 2;
-static cv::Mat gAbsCursorTempl;
+static bool gAbsFromInput = true; // --abs=input|poll: EV_MOUSE_POS at WM_INPUT time or from the poll thread
+static POINT gAbsLastPos{};
+static bool gAbsLastValid = false;
+struct BankTemplate;
+static std::shared_ptr<const BankTemplate> gAbsCursorTempl; // from gBank, with the multiscale variants
 static bool gCursorMultiScale = true;
+static bool gCursorShapeMode = true; // --cursor=shape|scan
 
 // ========================= Hunt state =========================
 
@@ -167,6 +268,13 @@ static double gEnemyTh = 0.75;
 static double gBattleTh = 0.88;
 static int gScanMs = 200;
 static int gCooldownMs = 900;
+static int gEnemyPyramid = 1;              // --pyramid=2|4 enables coarse-to-fine matching
+static cv::Rect gEnemyRoi;                 // --roi=L,T,R,B  (frame coords, empty = whole frame)
+static std::vector<cv::Rect> gEnemyExclude; // --exclude=L,T,R,B (repeatable)
+static int gMatchThreads = 0;              // --threads=N enemy match workers (0 = auto)
+static std::atomic<bool> gGpuMatch{false}; // --gpu=opencl; cleared when no device works
+static cv::Rect gBattleRoi;                // --battle-roi=L,T,R,B: banner checked only here, every frame
+static bool gFrameGate = true;             // --gate=tiles|off: skip matching on unchanged screen tiles
 
 struct HuntInfo
 {
@@ -176,6 +284,7 @@ struct HuntInfo
     std::atomic<int> lastY{-1};
     std::atomic<double> lastConf{0.0};
     std::atomic<bool> lastWasBattle{false};
+    std::atomic<double> lastScanMs{0.0};
 
     mutable std::mutex nameMu;
     char lastName[256]{};
@@ -201,12 +310,32 @@ static std::string gQuestMarkerPath = kDefaultQuestPath;
 static double gMarkerTh = 0.85;
 static int gDeadzonePx = 40;
 static int gQuestTickMs = 50;
+static bool gQuestDigits = false; // --ocr=digits: glyph recognizer first, Tesseract on low confidence
+static bool gQuestTrack = true;   // --track=0: full-screen marker search every tick
+
+// ========================= Capture service state =========================
+
+static int gCaptureMs = 33; // shared capture period; matches the cursor-detect default
+
+// What the capture thread grabs. Detection works in frame coordinates: --roi,
+// --exclude, --battle-roi and the quest-log ignore rect are relative to the
+// captured area, and frame origin is added back for cursor moves.
+enum CaptureScope
+{
+    CAPTURE_MONITOR, // the game window's monitor (default)
+    CAPTURE_WINDOW,  // the game window's client rect
+    CAPTURE_VIRTUAL, // every monitor, as one virtual-screen frame
+};
+static CaptureScope gCaptureScope = CAPTURE_MONITOR; // --capture=monitor|window|virtual
 
 // Overlay feedback
 static std::atomic<int> gQuestMarkerX{-1};
 static std::atomic<int> gQuestMarkerY{-1};
 static std::atomic<double> gQuestMarkerConf{0.0};
 static std::atomic<int> gQuestDistanceM{-1};
+static std::atomic<double> gQuestOcrMs{0.0};     // last readDistance call
+static std::atomic<int> gQuestOcrSource{0};      // ...answered by: 0 Tesseract, 1 its label cache, 2 digit glyphs
+static std::atomic<double> gQuestOcrHitRate{0.0};
 
 // ========================= Tesseract OCR =========================
 
@@ -240,58 +369,330 @@ public:
         }
     }
 
-    // Returns distance in meters, -1 on failure
+    // Returns distance in meters, -1 on failure. A label whose thresholded
+    // pixels, trimmed to their bounding box, equal a recent one's reuses
+    // that reading.
     int readDistance(const cv::Mat &roiBGR)
     {
         if (!api_ || roiBGR.empty())
             return -1;
+        auto t0 = std::chrono::steady_clock::now();
+
+        // Preprocess: grayscale -> threshold white-on-dark
+        cv::cvtColor(roiBGR, gray_, cv::COLOR_BGR2GRAY);
+        cv::threshold(gray_, thresh_, 160, 255, cv::THRESH_BINARY);
+
+        // Trimming absorbs the crop's position jitter; the bitmap itself must
+        // match exactly, since one stroke separates 5m/6m or 1m/7m
+        cv::Rect bb = cv::boundingRect(thresh_);
+        const cv::Mat ink = thresh_(bb.area() > 0 ? bb : cv::Rect(0, 0, thresh_.cols, thresh_.rows));
+        uint64_t h = label_hash(ink);
+        ++calls_;
+        ++clock_;
+        for (auto &c : cache_)
+            if (c.hash == h && same_pixels(c.ink, ink))
+            {
+                c.used = clock_;
+                ++hits_;
+                lastCached_ = true;
+                lastMs_ = ms_since(t0);
+                return c.dist;
+            }
 
-        // Preprocess: grayscale -> threshold white-on-dark -> upscale 3x for accuracy
-        cv::Mat gray, thresh, scaled;
-        cv::cvtColor(roiBGR, gray, cv::COLOR_BGR2GRAY);
-        cv::threshold(gray, thresh, 160, 255, cv::THRESH_BINARY);
-        cv::resize(thresh, scaled, cv::Size(), 3.0, 3.0, cv::INTER_LINEAR);
-
-        // Convert cv::Mat to Leptonica Pix
-        Pix *pix = pixCreate(scaled.cols, scaled.rows, 8);
-        for (int y = 0; y < scaled.rows; ++y)
-            for (int x = 0; x < scaled.cols; ++x)
-                pixSetPixel(pix, x, y, scaled.at<uchar>(y, x));
-
-        api_->SetImage(pix);
+        // Upscale 3x for accuracy and hand the buffer straight to Tesseract
+        cv::resize(thresh_, scaled_, cv::Size(), 3.0, 3.0, cv::INTER_LINEAR);
+        api_->SetImage(scaled_.data, scaled_.cols, scaled_.rows, 1, (int)scaled_.step);
         char *raw = api_->GetUTF8Text();
-        pixDestroy(&pix);
 
         int dist = -1;
         if (raw)
         {
-            std::string s(raw);
+            // Strip whitespace into a stack buffer, then a trailing 'm'
+            char s[16];
+            size_t n = 0;
+            for (const char *c = raw; *c && n < sizeof(s); ++c)
+                if (!std::isspace((unsigned char)*c))
+                    s[n++] = *c;
             delete[] raw;
-            // Strip whitespace
-            s.erase(std::remove_if(s.begin(), s.end(),
-                                   [](unsigned char c)
-                                   { return std::isspace(c); }),
-                    s.end());
-            // Strip trailing 'm'
-            if (!s.empty() && (s.back() == 'm' || s.back() == 'M'))
-                s.pop_back();
-            if (!s.empty())
-            {
-                try
+            if (n > 0 && (s[n - 1] == 'm' || s[n - 1] == 'M'))
+                --n;
+            int v = 0;
+            if (n > 0 && n < sizeof(s))
+            {
+                auto [end, ec] = std::from_chars(s, s + n, v);
+                if (ec == std::errc() && end == s + n)
+                    dist = v;
+            }
+        }
+
+        remember(h, ink, dist);
+        lastCached_ = false;
+        lastMs_ = ms_since(t0);
+        return dist;
+    }
+
+    double lastMs() const { return lastMs_; }
+    bool lastCached() const { return lastCached_; }
+    double hitRate() const { return calls_ ? (double)hits_ / calls_ : 0.0; }
+
+private:
+    static constexpr size_t kCacheSize = 64;
+
+    struct CacheEntry
+    {
+        uint64_t hash; // prefilter; ink is compared before a hit is trusted
+        cv::Mat ink;   // trimmed thresholded label
+        int dist;
+        uint64_t used;
+    };
+
+    // FNV-1a over the trimmed bitmap and its size
+    static uint64_t label_hash(const cv::Mat &ink)
+    {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&](uint8_t b)
+        { h = (h ^ b) * 1099511628211ull; };
+        for (int v : {ink.cols, ink.rows})
+            for (int i = 0; i < 4; ++i)
+                mix((uint8_t)(v >> (8 * i)));
+        for (int y = 0; y < ink.rows; ++y)
+        {
+            const uchar *row = ink.ptr<uchar>(y);
+            for (int x = 0; x < ink.cols; ++x)
+                mix(row[x]);
+        }
+        return h;
+    }
+
+    static bool same_pixels(const cv::Mat &a, const cv::Mat &b)
+    {
+        if (a.rows != b.rows || a.cols != b.cols)
+            return false;
+        for (int y = 0; y < a.rows; ++y)
+            if (std::memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), (size_t)a.cols) != 0)
+                return false;
+        return true;
+    }
+
+    void remember(uint64_t h, const cv::Mat &ink, int dist)
+    {
+        CacheEntry *slot = nullptr;
+        if (cache_.size() < kCacheSize)
+            slot = &cache_.emplace_back();
+        else
+            slot = &*std::min_element(cache_.begin(), cache_.end(),
+                                      [](const CacheEntry &a, const CacheEntry &b)
+                                      { return a.used < b.used; });
+        slot->hash = h;
+        ink.copyTo(slot->ink); // reuses the evicted entry's buffer when sizes match
+        slot->dist = dist;
+        slot->used = clock_;
+    }
+
+    static double ms_since(std::chrono::steady_clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    tesseract::TessBaseAPI *api_ = nullptr;
+    cv::Mat gray_, thresh_, scaled_;
+    std::vector<CacheEntry> cache_;
+    uint64_t clock_ = 0, calls_ = 0, hits_ = 0;
+    double lastMs_ = 0.0;
+    bool lastCached_ = false;
+};
+
+// ========================= Digit recognizer =========================
+
+// Nearest-neighbour classifier over the connected components of the
+// thresholded distance label. Glyph samples ("0".."9", "m") come from
+// templates\Digits\<c>.png and from corroborated Tesseract reads at run time;
+// learned glyphs are saved to templates\Digits\candidates for review.
+class DigitRecognizer
+{
+public:
+    void load(const char *dir)
+    {
+        dir_ = dir;
+        for (int c = 0; c < kClasses; ++c)
+        {
+            std::string path = dir_ + "\\" + kClassChars[c] + ".png";
+            cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+            if (img.empty())
+                continue;
+            cv::threshold(img, img, 127, 255, cv::THRESH_BINARY);
+            cv::Rect bb = cv::boundingRect(img);
+            if (bb.area() > 0)
+                add_sample(c, img(bb), false);
+        }
+        int n = 0;
+        for (const auto &s : samples_)
+            n += !s.empty();
+        std::printf("[OCR] Digit glyphs: %d/%d classes from %s\n", n, kClasses, dir);
+    }
+
+    bool ready() const
+    {
+        for (int c = 0; c < 10; ++c)
+            if (samples_[c].empty())
+                return false;
+        return true;
+    }
+
+    // Distance in meters, or -1 when the label can't be read confidently
+    // (unknown glyph, ambiguous match, malformed string).
+    int read(const cv::Mat &roiBGR)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        int dist = -1;
+        if (segment(roiBGR) && !glyphs_.empty())
+        {
+            char s[8];
+            size_t n = 0;
+            bool ok = true;
+            for (const auto &g : glyphs_)
+            {
+                normalize(g, norm_);
+                float best = 1e9f, second = 1e9f;
+                int cls = -1;
+                for (int c = 0; c < kClasses; ++c)
                 {
-                    dist = std::stoi(s);
+                    float d = 1e9f;
+                    for (const auto &sample : samples_[c])
+                        d = std::min(d, (float)cv::norm(norm_, sample, cv::NORM_L1) / (kGlyphW * kGlyphH));
+                    if (d < best)
+                    {
+                        second = best;
+                        best = d;
+                        cls = c;
+                    }
+                    else if (d < second)
+                        second = d;
                 }
-                catch (...)
+                if (cls < 0 || best > kMaxDist || second - best < kMinMargin)
                 {
-                    dist = -1;
+                    ok = false;
+                    break;
                 }
+                s[n++] = kClassChars[cls][0]; // segment() caps glyphs at 8
             }
+            if (ok && n > 0 && s[n - 1] == 'm')
+                --n;
+            if (ok && n > 0 && n <= 5 && std::find(s, s + n, 'm') == s + n)
+                std::from_chars(s, s + n, dist);
         }
+        lastMs_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
         return dist;
     }
 
+    // Teach the glyphs of a label another engine read as `dist`. Only used
+    // when the components line up one-to-one with the digits (+ 'm'), and only
+    // once kLearnAgree consecutive reads agreed on the value: a single
+    // Tesseract misread (3/8, 1/7) must not become a glyph.
+    void learn(const cv::Mat &roiBGR, int dist)
+    {
+        if (dist < 0)
+        {
+            agree_ = 0;
+            return;
+        }
+        agree_ = (dist == agreeDist_) ? agree_ + 1 : 1;
+        agreeDist_ = dist;
+        if (agree_ < kLearnAgree || !segment(roiBGR))
+            return;
+        std::string s = std::to_string(dist);
+        if (glyphs_.size() == s.size() + 1)
+            s += 'm';
+        if (glyphs_.size() != s.size())
+            return;
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            int c = (s[i] == 'm') ? 10 : s[i] - '0';
+            add_sample(c, glyphs_[i], true);
+        }
+    }
+
+    double lastMs() const { return lastMs_; }
+
 private:
-    tesseract::TessBaseAPI *api_ = nullptr;
+    static constexpr int kClasses = 11; // 0-9, m
+    static constexpr int kGlyphW = 10, kGlyphH = 16;
+    static constexpr size_t kMaxSamples = 6;
+    static constexpr int kLearnAgree = 3; // consecutive equal reads before learning
+    static constexpr float kMaxDist = 0.20f;   // mean abs pixel difference
+    static constexpr float kMinMargin = 0.04f; // vs. the runner-up class
+    static constexpr const char *kClassChars[kClasses] = {"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "m"};
+
+    // Threshold as TesseractOCR does and split into left-to-right glyph
+    // crops, dropping specks well below the tallest component.
+    bool segment(const cv::Mat &roiBGR)
+    {
+        glyphs_.clear();
+        if (roiBGR.empty())
+            return false;
+        cv::cvtColor(roiBGR, gray_, cv::COLOR_BGR2GRAY);
+        cv::threshold(gray_, bin_, 160, 255, cv::THRESH_BINARY);
+        int n = cv::connectedComponentsWithStats(bin_, labels_, stats_, centroids_, 8, CV_32S);
+        int maxH = 0;
+        for (int i = 1; i < n; ++i)
+            maxH = std::max(maxH, stats_.at<int>(i, cv::CC_STAT_HEIGHT));
+        if (maxH < 5)
+            return false;
+
+        boxes_.clear();
+        for (int i = 1; i < n; ++i)
+        {
+            int h = stats_.at<int>(i, cv::CC_STAT_HEIGHT);
+            if (h * 2 < maxH || stats_.at<int>(i, cv::CC_STAT_AREA) < 4)
+                continue;
+            boxes_.push_back(cv::Rect(stats_.at<int>(i, cv::CC_STAT_LEFT), stats_.at<int>(i, cv::CC_STAT_TOP),
+                                      stats_.at<int>(i, cv::CC_STAT_WIDTH), h));
+        }
+        std::sort(boxes_.begin(), boxes_.end(), [](const cv::Rect &a, const cv::Rect &b)
+                  { return a.x < b.x; });
+        for (const auto &r : boxes_)
+            glyphs_.push_back(bin_(r));
+        return glyphs_.size() <= 8;
+    }
+
+    void normalize(const cv::Mat &glyph, cv::Mat &out)
+    {
+        cv::resize(glyph, resized_, cv::Size(kGlyphW, kGlyphH), 0, 0, cv::INTER_AREA);
+        resized_.convertTo(out, CV_32F, 1.0 / 255.0);
+    }
+
+    void add_sample(int c, const cv::Mat &glyph, bool persist)
+    {
+        auto &v = samples_[c];
+        if (v.size() >= kMaxSamples)
+            return;
+        cv::Mat n;
+        normalize(glyph, n);
+        for (const auto &s : v)
+            if (cv::norm(n, s, cv::NORM_L1) / (kGlyphW * kGlyphH) < kMaxDist / 4)
+                return; // already have one like it
+        // Learned glyphs are saved as candidates next to the glyph set,
+        // never into it; load() only reads the reviewed set
+        if (persist && v.empty() && !dir_.empty())
+        {
+            std::string cand = dir_ + "\\candidates";
+            CreateDirectoryA(dir_.c_str(), nullptr);
+            CreateDirectoryA(cand.c_str(), nullptr);
+            std::string path = cand + "\\" + kClassChars[c] + ".png";
+            if (GetFileAttributesA(path.c_str()) == INVALID_FILE_ATTRIBUTES && cv::imwrite(path, glyph))
+                std::printf("[OCR] Candidate glyph '%s' -> %s (copy into %s to use it)\n",
+                            kClassChars[c], path.c_str(), dir_.c_str());
+        }
+        v.push_back(n);
+    }
+
+    std::string dir_;
+    std::vector<cv::Mat> samples_[kClasses];
+    std::vector<cv::Mat> glyphs_;
+    std::vector<cv::Rect> boxes_;
+    cv::Mat gray_, bin_, labels_, stats_, centroids_, norm_, resized_;
+    double lastMs_ = 0.0;
+    int agreeDist_ = -1, agree_ = 0;
 };
 
 // ========================= DPI Awareness =========================
@@ -324,6 +725,15 @@ static uint64_t now_us_since_start()
     return (uint64_t)(dt * 1000000.0L);
 }
 
+// Monotonic, valid before QueryPerformanceFrequency is set up (capture,
+// quest walk stage timing).
+static uint64_t steady_us()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 static void countdown_3s(const char *msg)
 {
     std::cout << msg << " in 3 seconds...\n";
@@ -334,507 +744,4133 @@ static void countdown_3s(const char *msg)
     }
 }
 
-static void write_event(uint32_t type, int32_t a = 0, int32_t b = 0, int32_t c = 0)
-{
-    if (!gOut)
-        return;
-    Event ev{};
-    ev.type = type;
-    ev.t_us = now_us_since_start();
-    ev.a = a;
-    ev.b = b;
-    ev.c = c;
-    fwrite(&ev, sizeof(ev), 1, gOut); // no fflush - precision
-}
+// ========================= Trace =========================
 
-static void flush_events()
+// Per-stage timing. Every TraceScope bumps a per-stage count and last
+// duration (for the overlay); with --trace=file.json each thread also keeps
+// its last kTraceRing events in a private ring, written out as Chrome trace
+// JSON (chrome://tracing, Perfetto) when the program exits.
+enum TraceStage
 {
-    if (gOut)
-        fflush(gOut);
-}
-static uint64_t read_exact(FILE *f, void *buf, uint64_t sz)
+    TS_CAPTURE = 0,
+    TS_MATCH,
+    TS_OCR,
+    TS_SENDINPUT,
+    TS_WRITE,
+    kNumTraceStages
+};
+static const char *kTraceStageName[kNumTraceStages] = {"capture", "match", "ocr", "sendinput", "write"};
+
+struct StageStats
 {
-    return (uint64_t)fread(buf, 1, (size_t)sz, f);
-}
+    std::atomic<uint64_t> count{0};
+    std::atomic<double> lastMs{0.0};
+};
+static StageStats gStageStats[kNumTraceStages];
 
-// ========================= Overlay =========================
+static std::string gTracePath; // --trace=file.json
+static bool gTraceOn = false;
+static constexpr size_t kTraceRing = 1 << 15;
 
-static void overlay_invalidate()
+struct TraceEvent
 {
-    if (gOverlayHwnd)
-        InvalidateRect(gOverlayHwnd, nullptr, FALSE);
-}
+    const char *name;
+    uint64_t t_us;
+    uint32_t dur_us; // complete events
+    int32_t value;   // counters
+    char phase;      // 'X' complete, 'C' counter
+};
 
-static void overlay_show(bool on)
+struct TraceRing
 {
-    if (!gOverlayHwnd)
-        return;
-    if (on)
+    DWORD tid = 0;
+    const char *threadName = nullptr;
+    std::atomic<uint64_t> head{0};
+    std::vector<TraceEvent> ev = std::vector<TraceEvent>(kTraceRing);
+
+    void push(const TraceEvent &e)
     {
-        ShowWindow(gOverlayHwnd, SW_SHOWNOACTIVATE);
-        SetWindowPos(gOverlayHwnd, HWND_TOPMOST, 0, 0, 0, 0,
-                     SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE | SWP_SHOWWINDOW);
-        UpdateWindow(gOverlayHwnd);
-        overlay_invalidate();
+        uint64_t h = head.load(std::memory_order_relaxed);
+        ev[h & (kTraceRing - 1)] = e;
+        head.store(h + 1, std::memory_order_release);
     }
-    else
-        ShowWindow(gOverlayHwnd, SW_HIDE);
-}
+};
 
-static LRESULT CALLBACK OverlayProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+// Rings are never freed, so a thread may exit before the export
+static std::mutex gTraceMutex;
+static std::vector<std::unique_ptr<TraceRing>> gTraceRings;
+
+static TraceRing *trace_ring()
 {
-    switch (msg)
-    {
-    case WM_MOUSEACTIVATE:
-        return MA_NOACTIVATE;
-    case WM_PAINT:
+    thread_local TraceRing *ring = nullptr;
+    if (!ring)
     {
-        PAINTSTRUCT ps{};
-        HDC hdc = BeginPaint(hwnd, &ps);
-        RECT rc{};
-        GetClientRect(hwnd, &rc);
-        HBRUSH bg = CreateSolidBrush(RGB(10, 10, 10));
-        FillRect(hdc, &rc, bg);
-        DeleteObject(bg);
-        SetBkMode(hdc, TRANSPARENT);
-        SetTextColor(hdc, RGB(230, 230, 230));
-        HFONT font = (HFONT)GetStockObject(DEFAULT_GUI_FONT);
-        HFONT old = (HFONT)SelectObject(hdc, font);
-
-        char line[512];
-        int y = 8;
-        auto put = [&](const char *s)
-        { TextOutA(hdc, 8, y, s, (int)strlen(s)); y += 18; };
-
-        bool absMode = gAbsByAlt.load() || gAbsByCursor.load();
-        put(gRecording ? "RawIO [Recording]" : (gPlaying ? "RawIO [Playing]" : "RawIO Overlay"));
-
-        snprintf(line, sizeof(line), "Mode: %s  ALT=%d CursorMatch=%d",
-                 absMode ? "ABS" : "REL", (int)gAbsByAlt.load(), (int)gAbsByCursor.load());
-        put(line);
-
-        snprintf(line, sizeof(line), "Cursor: %ld, %ld", (long)gCursorPt.x, (long)gCursorPt.y);
-        put(line);
-
-        snprintf(line, sizeof(line), "dx/dy: %ld / %ld  Wheel: %d", gLastDx, gLastDy, gLastWheel);
-        put(line);
-
-        snprintf(line, sizeof(line), "Btns: L=%d R=%d M=%d X1=%d X2=%d",
-                 gMouseBtn[1], gMouseBtn[2], gMouseBtn[3], gMouseBtn[4], gMouseBtn[5]);
-        put(line);
+        auto r = std::make_unique<TraceRing>();
+        r->tid = GetCurrentThreadId();
+        std::lock_guard<std::mutex> lk(gTraceMutex);
+        ring = r.get();
+        gTraceRings.push_back(std::move(r));
+    }
+    return ring;
+}
 
-        snprintf(line, sizeof(line), "Keys: W=%d A=%d S=%d D=%d Shift=%d Ctrl=%d Alt=%d",
-                 gKeyDown['W'], gKeyDown['A'], gKeyDown['S'], gKeyDown['D'],
-                 gKeyDown[VK_SHIFT], gKeyDown[VK_CONTROL], gKeyDown[VK_MENU]);
-        put(line);
+static void trace_thread_name(const char *name)
+{
+    if (gTraceOn)
+        trace_ring()->threadName = name;
+}
 
-        snprintf(line, sizeof(line), "Hunt=%d  Battle=%d  QuestWalk=%d",
-                 (int)gAutoHuntRun.load(), (int)gBattleStarted.load(), (int)gRunQuestWalk.load());
-        put(line);
+static void trace_counter(const char *name, int32_t value)
+{
+    if (gTraceOn)
+        trace_ring()->push(TraceEvent{name, steady_us(), 0, value, 'C'});
+}
 
-        char nm[256];
-        gHuntInfo.getLastName(nm, sizeof(nm));
-        snprintf(line, sizeof(line), "HuntDet=%d Atk=%d  Last=%s conf=%.2f",
-                 gHuntInfo.detections.load(), gHuntInfo.attacks.load(),
-                 nm, gHuntInfo.lastConf.load());
-        put(line);
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceStage stage) : stage_(stage), t0_(steady_us()) {}
+    ~TraceScope()
+    {
+        uint64_t dur = steady_us() - t0_;
+        StageStats &st = gStageStats[stage_];
+        st.count.fetch_add(1, std::memory_order_relaxed);
+        st.lastMs.store(dur / 1000.0, std::memory_order_relaxed);
+        if (gTraceOn)
+            trace_ring()->push(TraceEvent{kTraceStageName[stage_], t0_, (uint32_t)std::min<uint64_t>(dur, UINT32_MAX), 0, 'X'});
+    }
 
-        int qx = gQuestMarkerX.load(), qy = gQuestMarkerY.load(), qd = gQuestDistanceM.load();
-        if (qx >= 0)
-            snprintf(line, sizeof(line), "Quest: (%d,%d) conf=%.2f  dist=%dm",
-                     qx, qy, gQuestMarkerConf.load(), qd);
-        else
-            snprintf(line, sizeof(line), "Quest: marker not found");
-        put(line);
+private:
+    TraceStage stage_;
+    uint64_t t0_;
+};
 
-        SelectObject(hdc, old);
-        EndPaint(hwnd, &ps);
-        return 0;
+static void export_trace()
+{
+    if (!gTraceOn)
+        return;
+    FILE *f = std::fopen(gTracePath.c_str(), "wb");
+    if (!f)
+    {
+        std::fprintf(stderr, "[TRACE] Cannot write: %s\n", gTracePath.c_str());
+        return;
     }
-    case WM_DESTROY:
-        return 0;
+    std::lock_guard<std::mutex> lk(gTraceMutex);
+    const DWORD pid = GetCurrentProcessId();
+    uint64_t total = 0, lost = 0;
+    std::fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    auto sep = [&]() { std::fputs(first ? "" : ",\n", f); first = false; };
+    for (const auto &r : gTraceRings)
+    {
+        if (r->threadName)
+        {
+            sep();
+            std::fprintf(f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                         pid, r->tid, r->threadName);
+        }
+        uint64_t h = r->head.load(std::memory_order_acquire);
+        uint64_t from = h > kTraceRing ? h - kTraceRing : 0;
+        lost += from;
+        for (uint64_t i = from; i < h; ++i)
+        {
+            const TraceEvent &e = r->ev[i & (kTraceRing - 1)];
+            sep();
+            if (e.phase == 'X')
+                std::fprintf(f, "{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%lu,\"tid\":%lu,\"ts\":%llu,\"dur\":%u}",
+                             e.name, pid, r->tid, (unsigned long long)e.t_us, e.dur_us);
+            else
+                std::fprintf(f, "{\"ph\":\"C\",\"name\":\"%s\",\"pid\":%lu,\"tid\":%lu,\"ts\":%llu,\"args\":{\"value\":%d}}",
+                             e.name, pid, r->tid, (unsigned long long)e.t_us, e.value);
+        }
+        total += h - from;
     }
-    return DefWindowProc(hwnd, msg, wParam, lParam);
+    std::fprintf(f, "\n]}\n");
+    std::fclose(f);
+    std::printf("[TRACE] %llu events from %zu threads -> %s (%llu overwritten)\n",
+                (unsigned long long)total, gTraceRings.size(), gTracePath.c_str(), (unsigned long long)lost);
 }
 
-static bool create_overlay_window()
+// Console lines on hot paths (per tick/scan) stay off unless --log=N, and
+// then print at most N lines per second per call site.
+static int gLogPerSec = 0;
+
+class LogLimiter
 {
-    WNDCLASSA wc{};
-    wc.lpfnWndProc = OverlayProc;
-    wc.hInstance = GetModuleHandle(nullptr);
-    wc.lpszClassName = kOverlayClassName;
-    if (!RegisterClassA(&wc))
+public:
+    bool allow()
     {
-        DWORD e = GetLastError();
-        if (e != ERROR_CLASS_ALREADY_EXISTS)
+        if (gLogPerSec <= 0)
+            return false;
+        uint64_t now = steady_us();
+        if (now - last_ < 1000000ull / (uint64_t)gLogPerSec)
         {
-            std::fprintf(stderr, "RegisterClassA overlay failed (%lu)\n", e);
+            ++suppressed_;
             return false;
         }
+        last_ = now;
+        return true;
     }
-    DWORD ex = WS_EX_TOPMOST | WS_EX_TOOLWINDOW | WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_NOACTIVATE;
-    gOverlayHwnd = CreateWindowExA(ex, kOverlayClassName, "RawIO Overlay",
-                                   WS_POPUP, 10, 10, 500, 340,
-                                   nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
-    if (!gOverlayHwnd)
+    uint64_t suppressed() const { return suppressed_; }
+
+private:
+    uint64_t last_ = 0, suppressed_ = 0;
+};
+
+// ========================= Scheduler =========================
+
+// Background loops (capture, hunt, quest, cursor detect, abs poll) wait on
+// one condition variable instead of Sleep(). Every flag they wait on is
+// changed through set_and_wake, so session start/stop, battle start, SHIFT
+// resume, ESC and thread stops wake them at once: idle threads cost nothing
+// and stop_*() joins return without waiting out a tick.
+class WakeHub
+{
+public:
+    void notify()
     {
-        std::fprintf(stderr, "CreateWindowExA overlay failed (%lu)\n", GetLastError());
-        return false;
+        { std::lock_guard<std::mutex> lk(m_); } // a waiter is either past its check or blocked
+        cv_.notify_all();
     }
-    SetLayeredWindowAttributes(gOverlayHwnd, 0, 210, LWA_ALPHA);
-    ShowWindow(gOverlayHwnd, SW_HIDE);
-    return true;
-}
 
-static void destroy_overlay_window()
-{
-    if (gOverlayHwnd)
+    // Sleeps one period (ms) unless done() turns true first; returns done()
+    template <class Pred>
+    bool sleepFor(int ms, Pred done)
     {
-        DestroyWindow(gOverlayHwnd);
-        gOverlayHwnd = nullptr;
+        std::unique_lock<std::mutex> lk(m_);
+        return cv_.wait_for(lk, std::chrono::milliseconds(std::max(0, ms)), done);
     }
-}
 
-static void pump_messages_nonblocking()
-{
-    MSG msg;
-    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+    template <class Pred>
+    void waitUntil(Pred ready)
     {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, ready);
     }
+
+private:
+    std::mutex m_;
+    std::condition_variable cv_;
+};
+
+static WakeHub gWake;
+
+static void set_and_wake(std::atomic<bool> &flag, bool v)
+{
+    flag = v;
+    gWake.notify();
 }
 
-// ========================= SendInput helpers =========================
+// Priority per worker role; --affinity pins all of them to one CPU mask so
+// capture and matching can be kept off the cores the game uses.
+enum ThreadRole
+{
+    ROLE_CAPTURE = 0,
+    ROLE_HUNT,
+    ROLE_QUEST,
+    ROLE_OCR,
+    ROLE_CURSOR,
+    kNumThreadRoles
+};
 
-static void send_mouse_move_rel(int dx, int dy)
+static const int kRolePriority[kNumThreadRoles] = {
+    THREAD_PRIORITY_ABOVE_NORMAL, // capture: every detector waits on its frames
+    THREAD_PRIORITY_NORMAL,       // hunt
+    THREAD_PRIORITY_NORMAL,       // quest steering
+    THREAD_PRIORITY_BELOW_NORMAL, // OCR: latest-value mailbox, a late read is superseded anyway
+    THREAD_PRIORITY_BELOW_NORMAL, // cursor detect
+};
+static ULONG_PTR gWorkerAffinity = 0; // --affinity=MASK, 0 = any core
+
+static void apply_thread_role(ThreadRole role)
 {
-    INPUT in{};
-    in.type = INPUT_MOUSE;
-    in.mi.dx = dx;
-    in.mi.dy = dy;
-    in.mi.dwFlags = MOUSEEVENTF_MOVE;
-    SendInput(1, &in, sizeof(INPUT));
+    static const char *kRoleName[kNumThreadRoles] = {"capture", "hunt", "quest", "ocr", "cursor"};
+    trace_thread_name(kRoleName[role]);
+    SetThreadPriority(GetCurrentThread(), kRolePriority[role]);
+    if (gWorkerAffinity && !SetThreadAffinityMask(GetCurrentThread(), gWorkerAffinity))
+        std::fprintf(stderr, "[SCHED] Affinity mask 0x%llx rejected (%lu)\n",
+                     (unsigned long long)gWorkerAffinity, GetLastError());
 }
 
-static void send_mouse_move_abs(int x, int y)
+// ========================= Macro Format =========================
+
+// v1: FileHeader followed by raw 24-byte Events.
+// v2: FileHeader, then blocks of up to kBlockEvents events, each a
+//     BlockHeader plus a packed payload, then the block index and a trailer.
+//     Per event: tag byte (type in the low nibble, 0x0F = type follows as a
+//     varint, 0x80 = generic a/b/c payload), zigzag varint t_us delta from
+//     the previous event in the block, then the per-type payload:
+//       MOUSE_MOVE / MOUSE_POS  zz(a) zz(b)
+//       MOUSE_WHEEL             zz(a)
+//       MOUSE_BUTTON            varint(a*2 + b)
+//       KEY_DOWN / KEY_UP       varint(a)
+//     Any field the per-type form can't hold switches the event to generic.
+static const uint32_t kRmacMagic = 0x524D4143;
+static const uint32_t kRmacIndexMagic = 0x58444952; // 'RIDX'
+static const uint32_t kBlockEvents = 4096;
+static const size_t kMaxEncodedEvent = 32;
+static uint32_t gMacroVersion = 2; // format written by record/full/import/convert
+
+static inline uint32_t zigzag32(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t unzigzag32(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+static inline uint64_t zigzag64(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t unzigzag64(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
 {
-    int vsx = GetSystemMetrics(SM_XVIRTUALSCREEN), vsy = GetSystemMetrics(SM_YVIRTUALSCREEN);
-    int vsw = GetSystemMetrics(SM_CXVIRTUALSCREEN), vsh = GetSystemMetrics(SM_CYVIRTUALSCREEN);
-    if (vsw <= 0 || vsh <= 0)
-        return;
-    double relx = std::clamp((double)(x - vsx) / vsw, 0.0, 1.0);
-    double rely = std::clamp((double)(y - vsy) / vsh, 0.0, 1.0);
-    INPUT in{};
-    in.type = INPUT_MOUSE;
-    in.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_VIRTUALDESK;
-    in.mi.dx = (LONG)(relx * 65535.0 + 0.5);
-    in.mi.dy = (LONG)(rely * 65535.0 + 0.5);
-    SendInput(1, &in, sizeof(INPUT));
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
 }
 
-static void send_mouse_wheel(int delta)
+static inline bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
 {
-    INPUT in{};
-    in.type = INPUT_MOUSE;
-    in.mi.mouseData = (DWORD)delta;
-    in.mi.dwFlags = MOUSEEVENTF_WHEEL;
-    SendInput(1, &in, sizeof(INPUT));
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
 }
 
-static void send_mouse_button(int button, bool down)
+static uint8_t *encode_event(uint8_t *p, const Event &e, uint64_t prevT)
 {
-    INPUT in{};
-    in.type = INPUT_MOUSE;
-    switch (button)
+    bool generic = e.c != 0;
+    switch (e.type)
     {
-    case 1:
-        in.mi.dwFlags = down ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP;
+    case EV_MOUSE_WHEEL:
+        generic |= e.b != 0;
         break;
-    case 2:
-        in.mi.dwFlags = down ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP;
+    case EV_MOUSE_BUTTON:
+        generic |= e.a < 0 || e.a > 0x3FFFFFFF || (e.b != 0 && e.b != 1);
         break;
-    case 3:
-        in.mi.dwFlags = down ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP;
+    case EV_KEY_DOWN:
+    case EV_KEY_UP:
+        generic |= e.a < 0 || e.b != 0;
         break;
-    case 4:
-        in.mi.dwFlags = down ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
-        in.mi.mouseData = XBUTTON1;
-        break;
-    case 5:
-        in.mi.dwFlags = down ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
-        in.mi.mouseData = XBUTTON2;
+    case EV_MOUSE_MOVE:
+    case EV_MOUSE_POS:
         break;
     default:
+        generic = true;
+        break;
+    }
+
+    uint8_t tag = (uint8_t)(e.type < 0x0F ? e.type : 0x0F);
+    *p++ = (uint8_t)(tag | (generic ? 0x80 : 0));
+    if (tag == 0x0F)
+        p = put_varint(p, e.type);
+    p = put_varint(p, zigzag64((int64_t)(e.t_us - prevT)));
+
+    if (generic)
+    {
+        p = put_varint(p, zigzag32(e.a));
+        p = put_varint(p, zigzag32(e.b));
+        return put_varint(p, zigzag32(e.c));
+    }
+    switch (e.type)
+    {
+    case EV_MOUSE_MOVE:
+    case EV_MOUSE_POS:
+        p = put_varint(p, zigzag32(e.a));
+        return put_varint(p, zigzag32(e.b));
+    case EV_MOUSE_WHEEL:
+        return put_varint(p, zigzag32(e.a));
+    case EV_MOUSE_BUTTON:
+        return put_varint(p, (uint64_t)e.a * 2 + (uint64_t)e.b);
+    default: // keys
+        return put_varint(p, (uint64_t)e.a);
+    }
+}
+
+static bool decode_event(const uint8_t *&p, const uint8_t *end, uint64_t &prevT, Event &e)
+{
+    if (p >= end)
+        return false;
+    uint8_t tag = *p++;
+    uint64_t v = 0, dt = 0;
+    e = Event{};
+    e.type = tag & 0x0F;
+    if (e.type == 0x0F)
+    {
+        if (!get_varint(p, end, v))
+            return false;
+        e.type = (uint32_t)v;
+    }
+    if (!get_varint(p, end, dt))
+        return false;
+    prevT += (uint64_t)unzigzag64(dt);
+    e.t_us = prevT;
+
+    int fields = (tag & 0x80) ? 3 : (e.type == EV_MOUSE_MOVE || e.type == EV_MOUSE_POS) ? 2
+                                                                                       : 1;
+    uint64_t f[3] = {};
+    for (int i = 0; i < fields; ++i)
+        if (!get_varint(p, end, f[i]))
+            return false;
+
+    if (tag & 0x80)
+    {
+        e.a = unzigzag32((uint32_t)f[0]);
+        e.b = unzigzag32((uint32_t)f[1]);
+        e.c = unzigzag32((uint32_t)f[2]);
+    }
+    else if (e.type == EV_MOUSE_MOVE || e.type == EV_MOUSE_POS)
+    {
+        e.a = unzigzag32((uint32_t)f[0]);
+        e.b = unzigzag32((uint32_t)f[1]);
+    }
+    else if (e.type == EV_MOUSE_WHEEL)
+        e.a = unzigzag32((uint32_t)f[0]);
+    else if (e.type == EV_MOUSE_BUTTON)
+    {
+        e.a = (int32_t)(f[0] >> 1);
+        e.b = (int32_t)(f[0] & 1);
+    }
+    else
+        e.a = (int32_t)f[0];
+    return true;
+}
+
+static bool decode_block(const BlockHeader &bh, const uint8_t *payload, Event *out)
+{
+    const uint8_t *p = payload, *end = payload + bh.bytes;
+    uint64_t t = bh.first_t;
+    for (uint32_t i = 0; i < bh.count; ++i)
+        if (!decode_event(p, end, t, out[i]))
+            return false;
+    return true;
+}
+
+static FileHeader make_file_header(uint32_t version)
+{
+    FileHeader hdr{};
+    hdr.magic = kRmacMagic;
+    hdr.version = version;
+    FILETIME ft{};
+    GetSystemTimeAsFileTime(&ft);
+    hdr.start_utc = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return hdr;
+}
+
+// Byte sink a MacroWriter lays its file out on
+class MacroOut
+{
+public:
+    virtual ~MacroOut() = default;
+    virtual void write(const void *p, uint64_t n) = 0;
+    virtual void flush() {}
+    virtual bool close() = 0;
+};
+
+// Buffered FILE output (recording, convert)
+class FileOut : public MacroOut
+{
+public:
+    ~FileOut() override { close(); }
+
+    bool open(const char *path)
+    {
+        close();
+        f_ = std::fopen(path, "wb");
+        if (f_)
+            setvbuf(f_, fileBuf_, _IOFBF, sizeof(fileBuf_));
+        return f_ != nullptr;
+    }
+
+    void write(const void *p, uint64_t n) override
+    {
+        if (f_ && n)
+            fwrite(p, 1, (size_t)n, f_);
+    }
+    void flush() override
+    {
+        if (f_)
+            fflush(f_);
+    }
+    bool close() override
+    {
+        if (!f_)
+            return false;
+        bool ok = fflush(f_) == 0;
+        std::fclose(f_);
+        f_ = nullptr;
+        return ok;
+    }
+
+private:
+    FILE *f_ = nullptr;
+    char fileBuf_[1 << 20];
+};
+
+// Memory-mapped output (macro editing): the file is grown in large steps,
+// so a copied range is one memcpy out of the source view.
+class MappedOut : public MacroOut
+{
+public:
+    ~MappedOut() override { close(); }
+
+    bool open(const char *path, uint64_t sizeHint)
+    {
+        close();
+        file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+        size_ = 0;
+        failed_ = !remap(std::max<uint64_t>(sizeHint, kMinMap));
+        return !failed_;
+    }
+
+    void write(const void *p, uint64_t n) override
+    {
+        if (failed_ || n == 0)
+            return;
+        if (size_ + n > cap_ && !remap(std::max(size_ + n, cap_ * 2)))
+        {
+            failed_ = true;
+            return;
+        }
+        std::memcpy(view_ + size_, p, (size_t)n);
+        size_ += n;
+    }
+
+    // Unmaps and truncates the file to what was written.
+    bool close() override
+    {
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+        unmap();
+        LARGE_INTEGER li{};
+        li.QuadPart = (LONGLONG)size_;
+        bool ok = !failed_ && SetFilePointerEx(file_, li, nullptr, FILE_BEGIN) && SetEndOfFile(file_);
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+        return ok;
+    }
+
+    uint64_t size() const { return size_; }
+
+private:
+    static constexpr uint64_t kMinMap = 64ull << 20;
+
+    bool remap(uint64_t cap)
+    {
+        unmap();
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, (DWORD)(cap >> 32), (DWORD)cap, nullptr);
+        if (mapping_)
+            view_ = (uint8_t *)MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0);
+        if (!view_)
+            return false;
+        cap_ = cap;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (view_)
+            UnmapViewOfFile(view_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        view_ = nullptr;
+        mapping_ = nullptr;
+        cap_ = 0;
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    uint8_t *view_ = nullptr;
+    uint64_t cap_ = 0, size_ = 0;
+    bool failed_ = false;
+};
+
+// Writes v1 or v2 files, optionally copying already-encoded v2 blocks or v1
+// records verbatim. Events and copied blocks must arrive in time order. Not
+// thread-safe: during recording only the event writer thread appends.
+class MacroWriter
+{
+public:
+    ~MacroWriter() { close(); }
+
+    bool open(const char *path, uint32_t version)
+    {
+        close();
+        auto f = std::make_unique<FileOut>();
+        if (!f->open(path))
+            return false;
+        return open(std::move(f), make_file_header(version));
+    }
+
+    // Writes hdr (its version picks the layout) to an opened sink
+    bool open(std::unique_ptr<MacroOut> out, const FileHeader &hdr)
+    {
+        close();
+        out_ = std::move(out);
+        version_ = hdr.version;
+        out_->write(&hdr, sizeof(hdr));
+        out_->flush();
+        offset_ = sizeof(hdr);
+        index_.clear();
+        blockCount_ = 0;
+        written_ = encoded_ = copiedBlocks_ = 0;
+        return true;
+    }
+
+    void append(const Event *ev, size_t n)
+    {
+        if (!out_)
+            return;
+        written_ += n;
+        encoded_ += n;
+        if (version_ < 2)
+        {
+            out_->write(ev, n * sizeof(Event));
+            offset_ += n * sizeof(Event);
+            return;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (blockCount_ == 0)
+            {
+                blockFirstT_ = prevT_ = ev[i].t_us;
+                blockEnd_ = block_;
+            }
+            blockEnd_ = encode_event(blockEnd_, ev[i], prevT_);
+            prevT_ = ev[i].t_us;
+            if (++blockCount_ == kBlockEvents)
+                flush_block();
+        }
+    }
+
+    void append(const Event &ev) { append(&ev, 1); }
+
+    // v2: an unchanged payload moved by shift microseconds
+    void copy_block(const BlockHeader &src, const uint8_t *payload, int64_t shift)
+    {
+        if (!out_)
+            return;
+        flush_block();
+        BlockHeader bh = src;
+        bh.first_t = (uint64_t)((int64_t)src.first_t + shift);
+        write_block(bh, payload);
+        written_ += bh.count;
+        ++copiedBlocks_;
+    }
+
+    // v1: records that keep their timestamps
+    void copy_records(const Event *ev, size_t n)
+    {
+        if (!out_)
+            return;
+        out_->write(ev, n * sizeof(Event));
+        offset_ += n * sizeof(Event);
+        written_ += n;
+    }
+
+    bool close()
+    {
+        if (!out_)
+            return false;
+        if (version_ >= 2)
+        {
+            flush_block();
+            V2Trailer tr{};
+            tr.index_offset = offset_;
+            tr.block_count = (uint32_t)index_.size();
+            tr.magic = kRmacIndexMagic;
+            out_->write(index_.data(), index_.size() * sizeof(BlockIndexEntry));
+            out_->write(&tr, sizeof(tr));
+            offset_ += index_.size() * sizeof(BlockIndexEntry) + sizeof(tr);
+        }
+        bool ok = out_->close();
+        out_.reset();
+        return ok;
+    }
+
+    bool isOpen() const { return out_ != nullptr; }
+    uint32_t version() const { return version_; }
+    uint64_t written() const { return written_; }
+    uint64_t encoded() const { return encoded_; } // appended events, not verbatim copies
+    uint64_t copiedBlocks() const { return copiedBlocks_; }
+    uint64_t bytes() const { return offset_; }
+
+private:
+    void flush_block()
+    {
+        if (blockCount_ == 0)
+            return;
+        BlockHeader bh{};
+        bh.count = blockCount_;
+        bh.bytes = (uint32_t)(blockEnd_ - block_);
+        bh.first_t = blockFirstT_;
+        write_block(bh, block_);
+        blockCount_ = 0;
+    }
+
+    void write_block(const BlockHeader &bh, const uint8_t *payload)
+    {
+        index_.push_back(BlockIndexEntry{bh.first_t, offset_, bh.count});
+        out_->write(&bh, sizeof(bh));
+        out_->write(payload, bh.bytes);
+        offset_ += sizeof(bh) + bh.bytes;
+    }
+
+    std::unique_ptr<MacroOut> out_;
+    uint32_t version_ = 1;
+    uint64_t offset_ = 0;
+    uint64_t written_ = 0, encoded_ = 0, copiedBlocks_ = 0;
+    std::vector<BlockIndexEntry> index_;
+    uint8_t block_[kBlockEvents * kMaxEncodedEvent];
+    uint8_t *blockEnd_ = block_;
+    uint32_t blockCount_ = 0;
+    uint64_t blockFirstT_ = 0, prevT_ = 0;
+};
+
+// ========================= Event Rings =========================
+
+// Every thread that records events owns one SPSC ring; only the writer
+// thread touches gOut. Add a source here for each new producer thread.
+enum EventSource
+{
+    SRC_SINK = 0, // raw input window procedure
+    SRC_ABS_POLL, // ABS cursor poll thread (--abs=poll only)
+    kNumEventSources
+};
+
+template <size_t N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+    bool push(const Event &ev)
+    {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        if (h - tail_.load(std::memory_order_acquire) >= N)
+            return false;
+        buf_[h & (N - 1)] = ev;
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    const Event *peek() const
+    {
+        uint64_t t = tail_.load(std::memory_order_relaxed);
+        if (t == head_.load(std::memory_order_acquire))
+            return nullptr;
+        return &buf_[t & (N - 1)];
+    }
+    void pop() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    void clear() { tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release); }
+    size_t size() const { return (size_t)(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire)); }
+
+private:
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    Event buf_[N];
+};
+
+struct EventProducer
+{
+    SpscRing<1 << 16> ring;      // 1.5 MB, ~minutes of 1 kHz mouse input
+    std::atomic<bool> busy{false}; // set while stamping + pushing
+    std::atomic<uint64_t> dropped{0};
+};
+
+static EventProducer gProducers[kNumEventSources];
+static std::thread gEventWriterThread;
+static std::atomic<bool> gRunEventWriter{false};
+static std::atomic<uint64_t> gEventsWritten{0};
+
+static void write_event(EventSource src, uint32_t type, int32_t a = 0, int32_t b = 0, int32_t c = 0)
+{
+    if (!gOut)
         return;
+    EventProducer &p = gProducers[src];
+    p.busy.store(true);
+    Event ev{};
+    ev.type = type;
+    ev.t_us = now_us_since_start();
+    ev.a = a;
+    ev.b = b;
+    ev.c = c;
+    if (!p.ring.push(ev))
+        p.dropped.fetch_add(1, std::memory_order_relaxed);
+    p.busy.store(false);
+}
+
+// Merge every ring by t_us into `batch`, up to `watermark`. A producer that
+// was idle when the watermark was read stamps its next event after it,
+// so nothing older than an emitted event can still arrive.
+static void drain_event_rings(uint64_t watermark, std::vector<Event> &batch)
+{
+    for (;;)
+    {
+        int best = -1;
+        uint64_t bestT = 0;
+        for (int i = 0; i < kNumEventSources; ++i)
+        {
+            const Event *e = gProducers[i].ring.peek();
+            if (e && e->t_us <= watermark && (best < 0 || e->t_us < bestT))
+            {
+                best = i;
+                bestT = e->t_us;
+            }
+        }
+        if (best < 0)
+            return;
+        batch.push_back(*gProducers[best].ring.peek());
+        gProducers[best].ring.pop();
     }
-    SendInput(1, &in, sizeof(INPUT));
 }
 
-static void send_key(bool down, UINT vk)
+static void start_event_writer()
+{
+    for (auto &p : gProducers)
+    {
+        p.ring.clear();
+        p.dropped = 0;
+    }
+    gEventsWritten = 0;
+    gRunEventWriter = true;
+    gEventWriterThread = std::thread([]()
+                                     {
+        trace_thread_name("event-writer");
+        std::vector<Event> batch;
+        batch.reserve(1 << 14);
+        bool last = false;
+        while (!last)
+        {
+            last = !gRunEventWriter.load();
+            uint64_t wm = last ? UINT64_MAX : now_us_since_start();
+            bool anyBusy = false;
+            size_t depth = 0;
+            for (auto &p : gProducers)
+            {
+                anyBusy |= p.busy.load();
+                depth += p.ring.size();
+            }
+            if (depth)
+                trace_counter("event_ring_depth", (int32_t)depth);
+            if (!anyBusy || last)
+                drain_event_rings(wm, batch);
+            if (!batch.empty())
+            {
+                trace_counter("write_batch", (int32_t)batch.size());
+                TraceScope ts(TS_WRITE);
+                gOut->append(batch.data(), batch.size());
+                gEventsWritten += batch.size();
+                batch.clear();
+            }
+            if (!last)
+                Sleep(1);
+        } });
+}
+
+// Producers must be stopped first; the writer drains whatever is left.
+static void stop_event_writer()
+{
+    gRunEventWriter = false;
+    if (gEventWriterThread.joinable())
+        gEventWriterThread.join();
+    uint64_t dropped = 0;
+    for (auto &p : gProducers)
+        dropped += p.dropped.load();
+    std::printf("Wrote %llu events", (unsigned long long)gEventsWritten.load());
+    if (dropped)
+        std::printf(" (%llu dropped: ring full)", (unsigned long long)dropped);
+    std::printf("\n");
+}
+
+// ========================= Macro Reader =========================
+
+// Reads .rmac events without loading the file. Local files are mapped and
+// iterated in place; files on network shares (or files that cannot be
+// mapped) are streamed through two buffers, one being consumed while a
+// background thread fills the other.
+enum MacroOpen
+{
+    MACRO_OK = 0,
+    MACRO_CANT_OPEN,
+    MACRO_BAD_FORMAT
+};
+
+static bool path_is_remote(const char *path)
+{
+    char full[MAX_PATH];
+    DWORD n = GetFullPathNameA(path, MAX_PATH, full, nullptr);
+    if (n == 0 || n >= MAX_PATH)
+        return false;
+    if (full[0] == '\\' && full[1] == '\\')
+        return true; // UNC path
+    char root[4] = {full[0], ':', '\\', 0};
+    return GetDriveTypeA(root) == DRIVE_REMOTE;
+}
+
+class MacroReader
+{
+public:
+    ~MacroReader() { close(); }
+
+    MacroOpen open(const char *path)
+    {
+        close();
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return MACRO_CANT_OPEN;
+
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file_, &size) || (uint64_t)size.QuadPart < sizeof(FileHeader))
+        {
+            close();
+            return MACRO_BAD_FORMAT;
+        }
+        fileSize_ = (uint64_t)size.QuadPart;
+
+        if (!path_is_remote(path))
+        {
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_)
+                view_ = (const uint8_t *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            if (!view_ && mapping_)
+            {
+                CloseHandle(mapping_);
+                mapping_ = nullptr;
+            }
+        }
+
+        if (!read_bytes(0, &hdr_, sizeof(hdr_)) || hdr_.magic != kRmacMagic ||
+            (hdr_.version != 1 && hdr_.version != 2))
+        {
+            close();
+            return MACRO_BAD_FORMAT;
+        }
+
+        if (hdr_.version == 1)
+        {
+            count_ = (fileSize_ - sizeof(FileHeader)) / sizeof(Event);
+            dataEnd_ = sizeof(FileHeader) + count_ * sizeof(Event);
+            if (count_ && !read_bytes(dataEnd_ - sizeof(Event), &last_, sizeof(last_)))
+            {
+                close();
+                return MACRO_BAD_FORMAT;
+            }
+        }
+        else if (!load_index())
+        {
+            close();
+            return MACRO_BAD_FORMAT;
+        }
+
+        rewind();
+        return MACRO_OK;
+    }
+
+    void close()
+    {
+        stop_stream();
+        if (view_)
+            UnmapViewOfFile(view_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        view_ = nullptr;
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+        index_.clear();
+        hdr_ = FileHeader{};
+        last_ = Event{};
+        fileSize_ = dataEnd_ = count_ = 0;
+        span_ = nullptr;
+        spanN_ = pos_ = 0;
+        nextBlock_ = 0;
+    }
+
+    // Next event, or nullptr at end. The pointer stays valid until the
+    // following call.
+    const Event *next()
+    {
+        if (pos_ >= spanN_ && !refill())
+            return nullptr;
+        return &span_[pos_++];
+    }
+
+    void rewind() { seek(0); }
+
+    // Position so next() returns the first event with t_us >= t. Events are
+    // in time order (recording merges, import sorts), so this is a binary
+    // search over v1 records or the v2 block index.
+    void seek(uint64_t t)
+    {
+        if (file_ == INVALID_HANDLE_VALUE)
+            return;
+        stop_stream();
+        span_ = nullptr;
+        spanN_ = pos_ = 0;
+
+        if (hdr_.version == 1)
+        {
+            uint64_t lo = 0, hi = count_;
+            const Event *all = view_ ? (const Event *)(view_ + sizeof(FileHeader)) : nullptr;
+            while (lo < hi)
+            {
+                uint64_t mid = (lo + hi) / 2;
+                Event e{};
+                if (all)
+                    e = all[mid];
+                else
+                    read_bytes(sizeof(FileHeader) + mid * sizeof(Event), &e, sizeof(e));
+                if (e.t_us < t)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (all)
+            {
+                span_ = all;
+                spanN_ = count_;
+                pos_ = lo;
+            }
+            else
+                start_stream(sizeof(FileHeader) + lo * sizeof(Event));
+            return;
+        }
+
+        // Start at the last block that begins before t: with equal
+        // timestamps across a boundary, events at t may end the block before
+        // the first one whose first_t is t.
+        auto it = std::lower_bound(index_.begin(), index_.end(), t,
+                                   [](const BlockIndexEntry &b, uint64_t v)
+                                   { return b.first_t < v; });
+        size_t blk = it == index_.begin() ? 0 : (size_t)(it - index_.begin()) - 1;
+        nextBlock_ = blk;
+        if (!view_)
+            start_stream(blk < index_.size() ? index_[blk].offset : dataEnd_);
+        while (const Event *e = next())
+            if (e->t_us >= t)
+            {
+                --pos_;
+                break;
+            }
+    }
+
+    const FileHeader &header() const { return hdr_; }
+    uint32_t version() const { return hdr_.version; }
+    uint64_t size() const { return count_; }
+    uint64_t durationUs() const { return last_.t_us; }
+    uint64_t bytes() const { return fileSize_; }
+    bool mapped() const { return view_ != nullptr; }
+    const uint8_t *data() const { return view_; } // whole file when mapped()
+    const std::vector<BlockIndexEntry> &blocks() const { return index_; }
+
+private:
+    static constexpr size_t kStreamEvents = 1 << 16; // v1: 1.5 MB per buffer; v2: one block
+
+    struct StreamBuf
+    {
+        std::vector<Event> ev;
+        size_t n = 0;
+        bool eof = false;
+        bool ready = false;
+    };
+
+    bool read_at(uint64_t offset, void *dst, DWORD bytes)
+    {
+        LARGE_INTEGER li{};
+        li.QuadPart = (LONGLONG)offset;
+        DWORD got = 0;
+        return SetFilePointerEx(file_, li, nullptr, FILE_BEGIN) &&
+               ReadFile(file_, dst, bytes, &got, nullptr) && got == bytes;
+    }
+
+    bool read_bytes(uint64_t offset, void *dst, size_t bytes)
+    {
+        if (offset + bytes > fileSize_)
+            return false;
+        if (view_)
+        {
+            std::memcpy(dst, view_ + offset, bytes);
+            return true;
+        }
+        return read_at(offset, dst, (DWORD)bytes);
+    }
+
+    // Synchronous ReadFile on a share may return short; keep going until
+    // `bytes` arrive or the file ends.
+    DWORD read_some(void *dst, DWORD bytes)
+    {
+        DWORD have = 0;
+        while (have < bytes)
+        {
+            DWORD got = 0;
+            if (!ReadFile(file_, (uint8_t *)dst + have, bytes - have, &got, nullptr) || got == 0)
+                break;
+            have += got;
+        }
+        return have;
+    }
+
+    bool load_index()
+    {
+        V2Trailer tr{};
+        if (fileSize_ >= sizeof(FileHeader) + sizeof(tr) &&
+            read_bytes(fileSize_ - sizeof(tr), &tr, sizeof(tr)) && tr.magic == kRmacIndexMagic &&
+            tr.index_offset + (uint64_t)tr.block_count * sizeof(BlockIndexEntry) + sizeof(tr) == fileSize_)
+        {
+            index_.resize(tr.block_count);
+            if (tr.block_count &&
+                !read_bytes(tr.index_offset, index_.data(), index_.size() * sizeof(BlockIndexEntry)))
+                return false;
+            dataEnd_ = tr.index_offset;
+        }
+        else
+        {
+            // No trailer (recording was cut short): walk the block headers.
+            uint64_t off = sizeof(FileHeader);
+            BlockHeader bh{};
+            while (read_bytes(off, &bh, sizeof(bh)) && bh.count && bh.count <= kBlockEvents &&
+                   off + sizeof(bh) + bh.bytes <= fileSize_)
+            {
+                index_.push_back(BlockIndexEntry{bh.first_t, off, bh.count});
+                off += sizeof(bh) + bh.bytes;
+            }
+            dataEnd_ = off;
+            std::fprintf(stderr, "[RMAC] Block index missing, rebuilt from %zu blocks\n", index_.size());
+        }
+
+        count_ = 0;
+        for (const auto &b : index_)
+            count_ += b.count;
+        if (!index_.empty())
+        {
+            std::vector<Event> tail;
+            if (!load_block(index_.back().offset, tail) || tail.empty())
+                return false;
+            last_ = tail.back();
+        }
+        return true;
+    }
+
+    bool load_block(uint64_t offset, std::vector<Event> &out)
+    {
+        BlockHeader bh{};
+        if (!read_bytes(offset, &bh, sizeof(bh)) || bh.count > kBlockEvents)
+            return false;
+        const uint8_t *payload = nullptr;
+        if (view_)
+        {
+            if (offset + sizeof(bh) + bh.bytes > fileSize_)
+                return false;
+            payload = view_ + offset + sizeof(bh);
+        }
+        else
+        {
+            blockBytes_.resize(bh.bytes);
+            if (!read_bytes(offset + sizeof(bh), blockBytes_.data(), bh.bytes))
+                return false;
+            payload = blockBytes_.data();
+        }
+        out.resize(bh.count);
+        return decode_block(bh, payload, out.data());
+    }
+
+    bool refill()
+    {
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+        if (view_)
+        {
+            if (hdr_.version == 1 || nextBlock_ >= index_.size())
+                return false;
+            if (!load_block(index_[nextBlock_].offset, blockBuf_))
+            {
+                std::fprintf(stderr, "[RMAC] Corrupt block %zu, stopping.\n", nextBlock_);
+                nextBlock_ = index_.size();
+                return false;
+            }
+            ++nextBlock_;
+            span_ = blockBuf_.data();
+            spanN_ = blockBuf_.size();
+            pos_ = 0;
+            return spanN_ > 0 || refill();
+        }
+
+        if (!filler_.joinable() && !bufs_[cur_].ready)
+            return false;
+        StreamBuf *b = &bufs_[cur_];
+        if (span_ == b->ev.data())
+        {
+            if (b->eof)
+                return false;
+            std::unique_lock<std::mutex> lk(mu_);
+            b->ready = false;
+            cur_ ^= 1;
+            b = &bufs_[cur_];
+            cv_.notify_all();
+            cv_.wait(lk, [&]
+                     { return b->ready; });
+        }
+        span_ = b->ev.data();
+        spanN_ = b->n;
+        pos_ = 0;
+        if (spanN_ == 0)
+            return b->eof ? false : refill();
+        return true;
+    }
+
+    void start_stream(uint64_t offset)
+    {
+        LARGE_INTEGER li{};
+        li.QuadPart = (LONGLONG)offset;
+        SetFilePointerEx(file_, li, nullptr, FILE_BEGIN);
+        streamOff_ = offset;
+        for (auto &b : bufs_)
+        {
+            b.ev.resize(hdr_.version == 1 ? kStreamEvents : kBlockEvents);
+            b.n = 0;
+            b.eof = false;
+            b.ready = false;
+        }
+        cur_ = 0;
+        stopStream_ = false;
+        filler_ = std::thread([this]
+                              { fill_loop(); });
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&]
+                 { return bufs_[0].ready; });
+    }
+
+    void stop_stream()
+    {
+        if (filler_.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                stopStream_ = true;
+            }
+            cv_.notify_all();
+            filler_.join();
+        }
+        for (auto &b : bufs_)
+            b.ready = false;
+    }
+
+    // Fills one buffer from the current file position: raw records for v1,
+    // one decoded block for v2. Returns bytes consumed (0 = end or error).
+    uint64_t fill(StreamBuf &b)
+    {
+        b.n = 0;
+        if (streamOff_ >= dataEnd_)
+            return 0;
+        if (hdr_.version == 1)
+        {
+            uint64_t left = dataEnd_ - streamOff_;
+            DWORD want = (DWORD)std::min<uint64_t>(left, kStreamEvents * sizeof(Event));
+            DWORD have = read_some(b.ev.data(), want);
+            b.n = have / sizeof(Event);
+            return have;
+        }
+        BlockHeader bh{};
+        if (read_some(&bh, sizeof(bh)) != sizeof(bh) || bh.count > kBlockEvents)
+            return 0;
+        blockBytes_.resize(bh.bytes);
+        if (read_some(blockBytes_.data(), bh.bytes) != bh.bytes ||
+            !decode_block(bh, blockBytes_.data(), b.ev.data()))
+        {
+            std::fprintf(stderr, "[RMAC] Corrupt block at offset %llu, stopping.\n",
+                         (unsigned long long)streamOff_);
+            return 0;
+        }
+        b.n = bh.count;
+        return sizeof(bh) + bh.bytes;
+    }
+
+    void fill_loop()
+    {
+        for (int k = 0;; k ^= 1)
+        {
+            StreamBuf &b = bufs_[k];
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&]
+                         { return stopStream_ || !b.ready; });
+                if (stopStream_)
+                    return;
+            }
+
+            uint64_t used = fill(b);
+            streamOff_ += used;
+
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                b.eof = used == 0 || streamOff_ >= dataEnd_;
+                b.ready = true;
+            }
+            cv_.notify_all();
+            if (b.eof)
+                return;
+        }
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    const uint8_t *view_ = nullptr;
+    FileHeader hdr_{};
+    Event last_{};
+    uint64_t fileSize_ = 0;
+    uint64_t dataEnd_ = 0; // end of event data (v2: start of the block index)
+    uint64_t count_ = 0;
+
+    // Events next() is walking: the whole v1 view, a decoded v2 block or a
+    // stream buffer.
+    const Event *span_ = nullptr;
+    size_t spanN_ = 0;
+    size_t pos_ = 0;
+
+    std::vector<BlockIndexEntry> index_; // v2
+    size_t nextBlock_ = 0;               // v2 mapped
+    std::vector<Event> blockBuf_;        // v2 mapped
+    std::vector<uint8_t> blockBytes_;    // v2 payload staging (filler thread / open)
+
+    StreamBuf bufs_[2];
+    int cur_ = 0;
+    uint64_t streamOff_ = 0;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread filler_;
+    bool stopStream_ = false;
+};
+
+// ========================= Playback Scheduler =========================
+
+// Waits for absolute deadlines measured from start(), so per-event error
+// never accumulates. Long gaps sleep on a high-resolution waitable timer;
+// the last spinUs_ are spun on QPC, sized from the timer's measured
+// overshoot.
+class DeadlineScheduler
+{
+public:
+    ~DeadlineScheduler()
+    {
+        if (timer_)
+            CloseHandle(timer_);
+    }
+
+    void start()
+    {
+        QueryPerformanceFrequency(&freq_);
+        if (!timer_)
+        {
+            timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            highRes_ = timer_ != nullptr;
+            if (!timer_) // before Windows 10 1803
+                timer_ = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+        }
+        calibrate();
+        std::memset(hist_, 0, sizeof(hist_));
+        events_ = 0;
+        sumLateUs_ = 0;
+        maxLateUs_ = 0;
+        QueryPerformanceCounter(&t0_);
+    }
+
+    uint64_t nowUs() const
+    {
+        LARGE_INTEGER t;
+        QueryPerformanceCounter(&t);
+        return (uint64_t)((t.QuadPart - t0_.QuadPart) * 1000000LL / freq_.QuadPart);
+    }
+
+    // Block until t_us after start() and record how late we woke.
+    void waitUntil(uint64_t t_us)
+    {
+        uint64_t now = nowUs();
+        if (t_us > now + spinUs_)
+            sleep_us(t_us - now - spinUs_);
+        while ((now = nowUs()) < t_us)
+            YieldProcessor();
+        record(now - t_us);
+    }
+
+    void printReport(const char *tag) const
+    {
+        if (!events_)
+            return;
+        std::printf("%s Lateness over %llu events: mean=%.1fus max=%lluus (timer=%s spin=%lluus)\n",
+                    tag, (unsigned long long)events_, (double)sumLateUs_ / events_,
+                    (unsigned long long)maxLateUs_, highRes_ ? "high-res" : "standard",
+                    (unsigned long long)spinUs_);
+        uint64_t lo = 0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            if (hist_[i])
+            {
+                if (i + 1 < kBuckets)
+                    std::printf("%s   %5llu-%5lluus %8llu (%5.1f%%)\n", tag, (unsigned long long)lo,
+                                (unsigned long long)kBucketUs[i], (unsigned long long)hist_[i],
+                                100.0 * hist_[i] / events_);
+                else
+                    std::printf("%s   >=%5lluus     %8llu (%5.1f%%)\n", tag, (unsigned long long)lo,
+                                (unsigned long long)hist_[i], 100.0 * hist_[i] / events_);
+            }
+            if (i + 1 < kBuckets)
+                lo = kBucketUs[i];
+        }
+    }
+
+private:
+    static constexpr int kBuckets = 9;
+    static constexpr uint64_t kBucketUs[kBuckets - 1] = {10, 50, 100, 250, 500, 1000, 2000, 5000};
+
+    void sleep_us(uint64_t us)
+    {
+        if (!timer_)
+        {
+            Sleep((DWORD)(us / 1000));
+            return;
+        }
+        LARGE_INTEGER due{};
+        due.QuadPart = -(LONGLONG)(us * 10); // relative, 100 ns units
+        if (SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE))
+            WaitForSingleObject(timer_, INFINITE);
+    }
+
+    // Worst overshoot of a handful of 1 ms timer waits, plus margin.
+    void calibrate()
+    {
+        QueryPerformanceCounter(&t0_);
+        uint64_t worst = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t a = nowUs();
+            sleep_us(1000);
+            uint64_t over = nowUs() - a;
+            over = over > 1000 ? over - 1000 : 0;
+            worst = std::max(worst, over);
+        }
+        spinUs_ = std::clamp<uint64_t>(worst + 200, 200, 3000);
+    }
+
+    void record(uint64_t lateUs)
+    {
+        int b = 0;
+        while (b < kBuckets - 1 && lateUs >= kBucketUs[b])
+            ++b;
+        ++hist_[b];
+        ++events_;
+        sumLateUs_ += lateUs;
+        maxLateUs_ = std::max(maxLateUs_, lateUs);
+    }
+
+    HANDLE timer_ = nullptr;
+    bool highRes_ = false;
+    LARGE_INTEGER freq_{};
+    LARGE_INTEGER t0_{};
+    uint64_t spinUs_ = 1000;
+    uint64_t hist_[kBuckets] = {};
+    uint64_t events_ = 0;
+    uint64_t sumLateUs_ = 0;
+    uint64_t maxLateUs_ = 0;
+};
+
+// ========================= Overlay =========================
+
+// Producers (sink, playback, hunt, quest, cursor threads) only raise
+// gOverlayDirty. A renderer thread owns the layered window and, at most
+// gUiHz times a second, redraws a persistent DIB and pushes it with
+// UpdateLayeredWindow, so input rate never turns into repaint rate.
+static std::atomic<bool> gOverlayDirty{false};
+static std::atomic<bool> gOverlayVisible{false};
+
+static void overlay_invalidate()
+{
+    gOverlayDirty.store(true, std::memory_order_relaxed);
+}
+
+static void overlay_show(bool on)
+{
+    gOverlayVisible = on;
+    overlay_invalidate();
+}
+
+static void draw_overlay_text(HDC hdc)
+{
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(230, 230, 230));
+
+    char line[512];
+    int y = 8;
+    auto put = [&](const char *s)
+    { TextOutA(hdc, 8, y, s, (int)strlen(s)); y += 18; };
+
+    bool absMode = gAbsByAlt.load() || gAbsByCursor.load();
+    put(gRecording ? "RawIO [Recording]" : (gPlaying ? "RawIO [Playing]" : "RawIO Overlay"));
+
+    snprintf(line, sizeof(line), "Mode: %s  ALT=%d CursorMatch=%d",
+             absMode ? "ABS" : "REL", (int)gAbsByAlt.load(), (int)gAbsByCursor.load());
+    put(line);
+
+    snprintf(line, sizeof(line), "Cursor: %ld, %ld", (long)gCursorPt.x, (long)gCursorPt.y);
+    put(line);
+
+    snprintf(line, sizeof(line), "dx/dy: %ld / %ld  Wheel: %d", gLastDx, gLastDy, gLastWheel);
+    put(line);
+
+    snprintf(line, sizeof(line), "Btns: L=%d R=%d M=%d X1=%d X2=%d",
+             gMouseBtn[1], gMouseBtn[2], gMouseBtn[3], gMouseBtn[4], gMouseBtn[5]);
+    put(line);
+
+    snprintf(line, sizeof(line), "Keys: W=%d A=%d S=%d D=%d Shift=%d Ctrl=%d Alt=%d",
+             gKeyDown['W'], gKeyDown['A'], gKeyDown['S'], gKeyDown['D'],
+             gKeyDown[VK_SHIFT], gKeyDown[VK_CONTROL], gKeyDown[VK_MENU]);
+    put(line);
+
+    snprintf(line, sizeof(line), "Hunt=%d  Battle=%d  QuestWalk=%d",
+             (int)gAutoHuntRun.load(), (int)gBattleStarted.load(), (int)gRunQuestWalk.load());
+    put(line);
+
+    char nm[256];
+    gHuntInfo.getLastName(nm, sizeof(nm));
+    snprintf(line, sizeof(line), "HuntDet=%d Atk=%d  Last=%s conf=%.2f  scan=%.1fms",
+             gHuntInfo.detections.load(), gHuntInfo.attacks.load(),
+             nm, gHuntInfo.lastConf.load(), gHuntInfo.lastScanMs.load());
+    put(line);
+
+    int qx = gQuestMarkerX.load(), qy = gQuestMarkerY.load(), qd = gQuestDistanceM.load();
+    if (qx >= 0)
+        snprintf(line, sizeof(line), "Quest: (%d,%d) conf=%.2f  dist=%dm",
+                 qx, qy, gQuestMarkerConf.load(), qd);
+    else
+        snprintf(line, sizeof(line), "Quest: marker not found");
+    put(line);
+
+    // Stage calls per second over the last full second, and the latest duration
+    static uint64_t rateT0 = 0, rateBase[kNumTraceStages] = {};
+    static double rate[kNumTraceStages] = {};
+    uint64_t now = steady_us();
+    if (now - rateT0 >= 1000000)
+    {
+        for (int i = 0; i < kNumTraceStages; ++i)
+        {
+            uint64_t c = gStageStats[i].count.load(std::memory_order_relaxed);
+            rate[i] = rateT0 ? (c - rateBase[i]) * 1e6 / (double)(now - rateT0) : 0.0;
+            rateBase[i] = c;
+        }
+        rateT0 = now;
+    }
+    snprintf(line, sizeof(line), "Stages/s: cap=%.0f match=%.0f ocr=%.0f inject=%.0f write=%.0f",
+             rate[TS_CAPTURE], rate[TS_MATCH], rate[TS_OCR], rate[TS_SENDINPUT], rate[TS_WRITE]);
+    put(line);
+    snprintf(line, sizeof(line), "Last ms:  cap=%.1f match=%.1f ocr=%.1f inject=%.2f write=%.2f",
+             gStageStats[TS_CAPTURE].lastMs.load(), gStageStats[TS_MATCH].lastMs.load(),
+             gStageStats[TS_OCR].lastMs.load(), gStageStats[TS_SENDINPUT].lastMs.load(),
+             gStageStats[TS_WRITE].lastMs.load());
+    put(line);
+
+    if (gRunQuestWalk.load())
+    {
+        static const char *kOcrSource[] = {"tesseract", "cached", "digits"};
+        snprintf(line, sizeof(line), "OCR: %.2fms %s  cache hit=%.0f%%",
+                 gQuestOcrMs.load(), kOcrSource[gQuestOcrSource.load() % 3],
+                 gQuestOcrHitRate.load() * 100.0);
+        put(line);
+    }
+}
+
+static LRESULT CALLBACK OverlayProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch (msg)
+    {
+    case WM_MOUSEACTIVATE:
+        return MA_NOACTIVATE;
+    case WM_DESTROY:
+        return 0;
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+class OverlayRenderer
+{
+public:
+    bool start()
+    {
+        state_ = 0;
+        run_ = true;
+        thread_ = std::thread([this]() { loop(); });
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [&] { return state_ != 0; });
+        if (state_ < 0)
+        {
+            thread_.join();
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        run_ = false;
+        if (gOverlayHwnd)
+            PostMessage(gOverlayHwnd, WM_NULL, 0, 0);
+        thread_.join();
+    }
+
+private:
+    static constexpr int kW = 500, kH = 340;
+
+    void signal(int state)
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        state_ = state;
+        cv_.notify_all();
+    }
+
+    bool create()
+    {
+        WNDCLASSA wc{};
+        wc.lpfnWndProc = OverlayProc;
+        wc.hInstance = GetModuleHandle(nullptr);
+        wc.lpszClassName = kOverlayClassName;
+        if (!RegisterClassA(&wc))
+        {
+            DWORD e = GetLastError();
+            if (e != ERROR_CLASS_ALREADY_EXISTS)
+            {
+                std::fprintf(stderr, "RegisterClassA overlay failed (%lu)\n", e);
+                return false;
+            }
+        }
+        DWORD ex = WS_EX_TOPMOST | WS_EX_TOOLWINDOW | WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_NOACTIVATE;
+        gOverlayHwnd = CreateWindowExA(ex, kOverlayClassName, "RawIO Overlay",
+                                       WS_POPUP, 10, 10, kW, kH,
+                                       nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
+        if (!gOverlayHwnd)
+        {
+            std::fprintf(stderr, "CreateWindowExA overlay failed (%lu)\n", GetLastError());
+            return false;
+        }
+        HDC hScreen = GetDC(NULL);
+        memDC_ = CreateCompatibleDC(hScreen);
+        BITMAPINFO bi{};
+        bi.bmiHeader.biSize = sizeof(bi.bmiHeader);
+        bi.bmiHeader.biWidth = kW;
+        bi.bmiHeader.biHeight = -kH;
+        bi.bmiHeader.biPlanes = 1;
+        bi.bmiHeader.biBitCount = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+        bmp_ = CreateDIBSection(hScreen, &bi, DIB_RGB_COLORS, &bits_, nullptr, 0);
+        ReleaseDC(NULL, hScreen);
+        if (!memDC_ || !bmp_ || !bits_)
+        {
+            std::fprintf(stderr, "Overlay back buffer failed (%lu)\n", GetLastError());
+            return false;
+        }
+        oldBmp_ = SelectObject(memDC_, bmp_);
+        oldFont_ = SelectObject(memDC_, GetStockObject(DEFAULT_GUI_FONT));
+        return true;
+    }
+
+    void release()
+    {
+        if (memDC_)
+        {
+            SelectObject(memDC_, oldFont_);
+            SelectObject(memDC_, oldBmp_);
+            DeleteDC(memDC_);
+            memDC_ = nullptr;
+        }
+        if (bmp_)
+        {
+            DeleteObject(bmp_);
+            bmp_ = nullptr;
+        }
+        bits_ = nullptr;
+        if (gOverlayHwnd)
+        {
+            DestroyWindow(gOverlayHwnd);
+            gOverlayHwnd = nullptr;
+        }
+    }
+
+    void render()
+    {
+        // Background RGB(10,10,10); constant alpha below, as SetLayeredWindowAttributes(210) did
+        uint32_t *px = (uint32_t *)bits_;
+        std::fill(px, px + kW * kH, 0x000A0A0Au);
+        draw_overlay_text(memDC_);
+        GdiFlush();
+        POINT src{0, 0};
+        SIZE size{kW, kH};
+        BLENDFUNCTION blend{AC_SRC_OVER, 0, 210, 0};
+        UpdateLayeredWindow(gOverlayHwnd, nullptr, nullptr, &size, memDC_, &src, 0, &blend, ULW_ALPHA);
+    }
+
+    void loop()
+    {
+        if (!create())
+        {
+            release();
+            signal(-1);
+            return;
+        }
+        signal(1);
+        bool shown = false;
+        uint64_t lastUs = 0;
+        while (run_)
+        {
+            uint64_t periodUs = 1000000ull / (uint64_t)std::max(1, gUiHz);
+            uint64_t now = steady_us();
+            uint64_t due = lastUs + periodUs;
+            if (now < due)
+                MsgWaitForMultipleObjects(0, nullptr, FALSE, (DWORD)((due - now + 999) / 1000), QS_ALLINPUT);
+            MSG msg;
+            while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+            now = steady_us();
+            if (now < lastUs + periodUs)
+                continue;
+            lastUs = now;
+
+            bool vis = gOverlayVisible.load();
+            if (vis && !shown)
+            {
+                render(); // content first, so the window never shows a stale frame
+                gOverlayDirty = false;
+                SetWindowPos(gOverlayHwnd, HWND_TOPMOST, 0, 0, 0, 0,
+                             SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE | SWP_SHOWWINDOW);
+            }
+            else if (!vis && shown)
+                ShowWindow(gOverlayHwnd, SW_HIDE);
+            else if (vis && gOverlayDirty.exchange(false, std::memory_order_relaxed))
+                render();
+            shown = vis;
+        }
+        release();
+    }
+
+    std::thread thread_;
+    std::atomic<bool> run_{false};
+    std::mutex m_;
+    std::condition_variable cv_;
+    int state_ = 0; // 0 starting, 1 running, -1 failed
+    HDC memDC_ = nullptr;
+    HBITMAP bmp_ = nullptr;
+    HGDIOBJ oldBmp_ = nullptr, oldFont_ = nullptr;
+    void *bits_ = nullptr;
+};
+
+static OverlayRenderer gOverlayRenderer;
+
+static bool create_overlay_window()
+{
+    gOverlayVisible = false;
+    return gOverlayRenderer.start();
+}
+
+static void destroy_overlay_window()
+{
+    gOverlayVisible = false;
+    gOverlayRenderer.stop();
+}
+
+static void pump_messages_nonblocking()
+{
+    MSG msg;
+    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+}
+
+// ========================= SendInput helpers =========================
+
+static INPUT make_mouse_move_rel(int dx, int dy)
+{
+    INPUT in{};
+    in.type = INPUT_MOUSE;
+    in.mi.dx = dx;
+    in.mi.dy = dy;
+    in.mi.dwFlags = MOUSEEVENTF_MOVE;
+    return in;
+}
+
+static bool make_mouse_move_abs(int x, int y, INPUT &in)
+{
+    int vsx = GetSystemMetrics(SM_XVIRTUALSCREEN), vsy = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    int vsw = GetSystemMetrics(SM_CXVIRTUALSCREEN), vsh = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+    if (vsw <= 0 || vsh <= 0)
+        return false;
+    // 0..65535 spans the first to the last pixel of the virtual desktop, so
+    // desktop coords on any monitor (negative ones included) land exactly
+    double relx = std::clamp((double)(x - vsx) / std::max(1, vsw - 1), 0.0, 1.0);
+    double rely = std::clamp((double)(y - vsy) / std::max(1, vsh - 1), 0.0, 1.0);
+    in = INPUT{};
+    in.type = INPUT_MOUSE;
+    in.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_VIRTUALDESK;
+    in.mi.dx = (LONG)(relx * 65535.0 + 0.5);
+    in.mi.dy = (LONG)(rely * 65535.0 + 0.5);
+    return true;
+}
+
+static INPUT make_mouse_wheel(int delta)
+{
+    INPUT in{};
+    in.type = INPUT_MOUSE;
+    in.mi.mouseData = (DWORD)delta;
+    in.mi.dwFlags = MOUSEEVENTF_WHEEL;
+    return in;
+}
+
+static bool make_mouse_button(int button, bool down, INPUT &in)
+{
+    in = INPUT{};
+    in.type = INPUT_MOUSE;
+    switch (button)
+    {
+    case 1:
+        in.mi.dwFlags = down ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP;
+        break;
+    case 2:
+        in.mi.dwFlags = down ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP;
+        break;
+    case 3:
+        in.mi.dwFlags = down ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP;
+        break;
+    case 4:
+        in.mi.dwFlags = down ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
+        in.mi.mouseData = XBUTTON1;
+        break;
+    case 5:
+        in.mi.dwFlags = down ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
+        in.mi.mouseData = XBUTTON2;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+static INPUT make_key(bool down, UINT vk)
+{
+    INPUT in{};
+    in.type = INPUT_KEYBOARD;
+    in.ki.wVk = (WORD)vk;
+    in.ki.dwFlags = down ? 0 : KEYEVENTF_KEYUP;
+    return in;
+}
+
+static void send_mouse_move_rel(int dx, int dy)
+{
+    INPUT in = make_mouse_move_rel(dx, dy);
+    SendInput(1, &in, sizeof(INPUT));
+}
+
+static void send_mouse_move_abs(int x, int y)
+{
+    INPUT in{};
+    if (make_mouse_move_abs(x, y, in))
+        SendInput(1, &in, sizeof(INPUT));
+}
+
+static void send_mouse_wheel(int delta)
+{
+    INPUT in = make_mouse_wheel(delta);
+    SendInput(1, &in, sizeof(INPUT));
+}
+
+static void send_mouse_button(int button, bool down)
+{
+    INPUT in{};
+    if (make_mouse_button(button, down, in))
+        SendInput(1, &in, sizeof(INPUT));
+}
+
+static void send_key(bool down, UINT vk)
+{
+    INPUT in = make_key(down, vk);
+    SendInput(1, &in, sizeof(INPUT));
+}
+
+// Collects the INPUTs due in one scheduler quantum and injects them with a
+// single SendInput. With a coalesce tolerance, back-to-back relative moves
+// are summed while each axis stays within it (0 = never merge; merging
+// changes what pointer acceleration sees, so keep it off unless needed).
+class InputBatch
+{
+public:
+    explicit InputBatch(int coalescePx = 0) : coalescePx_(coalescePx) {}
+    ~InputBatch() { flush(); }
+
+    void add(const INPUT &in)
+    {
+        if (n_ == kMax)
+            flush();
+        buf_[n_++] = in;
+        ++events_;
+    }
+
+    void addMoveRel(int dx, int dy)
+    {
+        if (coalescePx_ > 0 && n_ > 0)
+        {
+            INPUT &last = buf_[n_ - 1];
+            if (last.type == INPUT_MOUSE && last.mi.dwFlags == MOUSEEVENTF_MOVE &&
+                std::abs(last.mi.dx + dx) <= coalescePx_ && std::abs(last.mi.dy + dy) <= coalescePx_)
+            {
+                last.mi.dx += dx;
+                last.mi.dy += dy;
+                ++events_;
+                ++coalesced_;
+                return;
+            }
+        }
+        add(make_mouse_move_rel(dx, dy));
+    }
+
+    void flush()
+    {
+        if (!n_)
+            return;
+        trace_counter("inject_batch", (int32_t)n_);
+        TraceScope ts(TS_SENDINPUT);
+        SendInput(n_, buf_, sizeof(INPUT));
+        ++calls_;
+        n_ = 0;
+    }
+
+    void printReport(const char *tag) const
+    {
+        if (!events_)
+            return;
+        std::printf("%s %llu events in %llu SendInput calls (%.1f/call, %llu moves coalesced)\n",
+                    tag, (unsigned long long)events_, (unsigned long long)calls_,
+                    calls_ ? (double)events_ / calls_ : 0.0, (unsigned long long)coalesced_);
+    }
+
+private:
+    static constexpr UINT kMax = 256;
+    INPUT buf_[kMax];
+    UINT n_ = 0;
+    int coalescePx_;
+    uint64_t events_ = 0, calls_ = 0, coalesced_ = 0;
+};
+
+static void release_move_keys()
+{
+    send_key(false, 'W');
+    send_key(false, 'A');
+    send_key(false, 'S');
+    send_key(false, 'D');
+    send_key(false, VK_SHIFT);
+}
+
+// ========================= Input State =========================
+
+// One WH_KEYBOARD_LL hook on its own thread publishes ESC/Alt/Shift as
+// atomics, so the playback, quest and hunt loops read a flag instead of a
+// GetAsyncKeyState syscall per event or tick. Injected keys count too, same
+// as GetAsyncKeyState did (a replayed SHIFT still restarts the hunt). Until
+// the hook is installed, or if it fails, the queries use GetAsyncKeyState.
+class InputStateService
+{
+public:
+    ~InputStateService() { stop(); }
+
+    bool start()
+    {
+        if (thread_.joinable())
+            return running_;
+        thread_ = std::thread([this]() { loop(); });
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [&] { return state_ != 0; });
+        return running_;
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        PostThreadMessage(threadId_, WM_QUIT, 0, 0);
+        thread_.join();
+        running_ = false;
+    }
+
+    bool escDown() const
+    {
+        return running_ ? esc_.load(std::memory_order_relaxed) : (GetAsyncKeyState(VK_ESCAPE) & 0x8000) != 0;
+    }
+    bool altDown() const
+    {
+        return running_ ? alt_.load(std::memory_order_relaxed) != 0 : (GetAsyncKeyState(VK_MENU) & 0x8000) != 0;
+    }
+    // True once per SHIFT press since the last call (GetAsyncKeyState & 1)
+    bool takeShiftEdge()
+    {
+        return running_ ? shiftEdge_.exchange(false, std::memory_order_relaxed) : (GetAsyncKeyState(VK_SHIFT) & 1) != 0;
+    }
+
+private:
+    static LRESULT CALLBACK HookProc(int code, WPARAM wParam, LPARAM lParam)
+    {
+        if (code == HC_ACTION && sSelf)
+            sSelf->onKey(*reinterpret_cast<const KBDLLHOOKSTRUCT *>(lParam));
+        return CallNextHookEx(nullptr, code, wParam, lParam);
+    }
+
+    void onKey(const KBDLLHOOKSTRUCT &k)
+    {
+        bool down = (k.flags & LLKHF_UP) == 0;
+        switch (k.vkCode)
+        {
+        case VK_ESCAPE:
+            if (esc_.exchange(down, std::memory_order_relaxed) != down)
+                gWake.notify();
+            break;
+        case VK_MENU:
+        case VK_LMENU:
+        case VK_RMENU:
+        {
+            uint32_t bit = k.vkCode == VK_RMENU ? 2u : 1u;
+            if (down)
+                alt_.fetch_or(bit, std::memory_order_relaxed);
+            else
+                alt_.fetch_and(~bit, std::memory_order_relaxed);
+            break;
+        }
+        case VK_SHIFT:
+        case VK_LSHIFT:
+        case VK_RSHIFT:
+        {
+            // Autorepeat delivers more downs; only the up->down transition is an edge
+            uint32_t bit = k.vkCode == VK_RSHIFT ? 2u : 1u;
+            uint32_t prev = down ? shift_.fetch_or(bit, std::memory_order_relaxed)
+                                 : shift_.fetch_and(~bit, std::memory_order_relaxed);
+            if (down && !(prev & bit))
+            {
+                shiftEdge_.store(true, std::memory_order_relaxed);
+                gWake.notify();
+            }
+            break;
+        }
+        }
+    }
+
+    void signal(bool ok)
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        running_ = ok;
+        state_ = ok ? 1 : -1;
+        cv_.notify_all();
+    }
+
+    void loop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        threadId_ = GetCurrentThreadId();
+        MSG msg;
+        PeekMessage(&msg, nullptr, 0, 0, 0); // create the queue before anyone posts WM_QUIT
+        // Seed from the current state so a key held at startup is not missed
+        esc_ = (GetAsyncKeyState(VK_ESCAPE) & 0x8000) != 0;
+        alt_ = (GetAsyncKeyState(VK_MENU) & 0x8000) ? 1u : 0u;
+        shift_ = (GetAsyncKeyState(VK_SHIFT) & 0x8000) ? 1u : 0u;
+        sSelf = this;
+        HHOOK hook = SetWindowsHookExA(WH_KEYBOARD_LL, HookProc, GetModuleHandle(nullptr), 0);
+        if (!hook)
+        {
+            std::fprintf(stderr, "[INPUT] Keyboard hook failed (%lu), polling keys instead.\n", GetLastError());
+            sSelf = nullptr;
+            signal(false);
+            return;
+        }
+        signal(true);
+        while (GetMessage(&msg, nullptr, 0, 0) > 0)
+        {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+        running_ = false;
+        UnhookWindowsHookEx(hook);
+        sSelf = nullptr;
+    }
+
+    static inline InputStateService *sSelf = nullptr;
+    std::thread thread_;
+    DWORD threadId_ = 0;
+    std::mutex m_;
+    std::condition_variable cv_;
+    int state_ = 0;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> esc_{false}, shiftEdge_{false};
+    std::atomic<uint32_t> alt_{0}, shift_{0}; // bit 0 left/generic, bit 1 right
+};
+
+static InputStateService gInput;
+
+// ========================= Raw Input Sink =========================
+
+static void update_overlay_state_on_mouse()
+{
+    GetCursorPos(&gCursorPt);
+    overlay_invalidate();
+}
+static void update_overlay_state_on_key(UINT vk, bool down)
+{
+    if (vk < 256)
+        gKeyDown[vk] = down;
+    overlay_invalidate();
+}
+
+// ABS position at WM_INPUT time. The system has already moved the cursor for
+// the packet being handled, so GetCursorPos here is the position this input
+// produced, stamped when it arrived rather than at the next poll.
+static void record_abs_pos_from_input()
+{
+    POINT pt{};
+    if (!GetCursorPos(&pt))
+        return;
+    if (gAbsLastValid && pt.x == gAbsLastPos.x && pt.y == gAbsLastPos.y)
+        return;
+    gAbsLastPos = pt;
+    gAbsLastValid = true;
+    gCursorPt = pt;
+    write_event(SRC_SINK, EV_MOUSE_POS, (int32_t)pt.x, (int32_t)pt.y, 0);
+}
+
+static bool register_raw(HWND hwnd)
+{
+    RAWINPUTDEVICE rids[2]{};
+    rids[0].usUsagePage = 0x01;
+    rids[0].usUsage = 0x02;
+    rids[0].dwFlags = RIDEV_INPUTSINK | RIDEV_NOLEGACY;
+    rids[0].hwndTarget = hwnd;
+    rids[1].usUsagePage = 0x01;
+    rids[1].usUsage = 0x06;
+    rids[1].dwFlags = RIDEV_INPUTSINK | RIDEV_NOLEGACY;
+    rids[1].hwndTarget = hwnd;
+    return RegisterRawInputDevices(rids, 2, sizeof(RAWINPUTDEVICE)) == TRUE;
+}
+
+// Records one raw input packet. Returns true on ESC (stop recording).
+static bool handle_raw_input(const RAWINPUT *raw)
+{
+    if (raw->header.dwType == RIM_TYPEMOUSE)
+    {
+        const RAWMOUSE &m = raw->data.mouse;
+        gAbsByAlt = gInput.altDown();
+        bool absMode = gAbsByAlt.load() || gAbsByCursor.load();
+
+        if ((m.usFlags & MOUSE_MOVE_ABSOLUTE) == 0)
+        {
+            LONG dx = m.lLastX, dy = m.lLastY;
+            if (dx != 0 || dy != 0)
+            {
+                gLastDx = dx;
+                gLastDy = dy;
+                if (!absMode)
+                    write_event(SRC_SINK, EV_MOUSE_MOVE, (int32_t)dx, (int32_t)dy, 0);
+                update_overlay_state_on_mouse();
+            }
+        }
+        if (gAbsFromInput)
+        {
+            if (absMode)
+                record_abs_pos_from_input();
+            else
+                gAbsLastValid = false; // re-entering ABS always writes the first position
+        }
+        if (m.usButtonFlags & RI_MOUSE_WHEEL)
+        {
+            SHORT wd = *reinterpret_cast<const SHORT *>(&m.usButtonData);
+            gLastWheel = (int)wd;
+            write_event(SRC_SINK, EV_MOUSE_WHEEL, (int32_t)wd, 0, 0);
+            update_overlay_state_on_mouse();
+        }
+        auto log_btn = [&](int btn, bool down)
+        {
+            if (btn >= 1 && btn <= 5)
+                gMouseBtn[btn] = down;
+            write_event(SRC_SINK, EV_MOUSE_BUTTON, (int32_t)btn, down ? 1 : 0, 0);
+            update_overlay_state_on_mouse();
+        };
+        if (m.usButtonFlags & RI_MOUSE_LEFT_BUTTON_DOWN)
+            log_btn(1, true);
+        if (m.usButtonFlags & RI_MOUSE_LEFT_BUTTON_UP)
+            log_btn(1, false);
+        if (m.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_DOWN)
+            log_btn(2, true);
+        if (m.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_UP)
+            log_btn(2, false);
+        if (m.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_DOWN)
+            log_btn(3, true);
+        if (m.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_UP)
+            log_btn(3, false);
+        if (m.usButtonFlags & RI_MOUSE_BUTTON_4_DOWN)
+            log_btn(4, true);
+        if (m.usButtonFlags & RI_MOUSE_BUTTON_4_UP)
+            log_btn(4, false);
+        if (m.usButtonFlags & RI_MOUSE_BUTTON_5_DOWN)
+            log_btn(5, true);
+        if (m.usButtonFlags & RI_MOUSE_BUTTON_5_UP)
+            log_btn(5, false);
+    }
+    else if (raw->header.dwType == RIM_TYPEKEYBOARD)
+    {
+        const RAWKEYBOARD &kb = raw->data.keyboard;
+        bool isBreak = (kb.Flags & RI_KEY_BREAK) != 0;
+        UINT vk = kb.VKey;
+        if (vk == 255)
+            return false;
+        gAbsByAlt = gInput.altDown();
+        if (gAbsFromInput && gAbsByAlt && !isBreak && vk == VK_MENU)
+            record_abs_pos_from_input(); // anchor ABS at the Alt press, before any movement
+        if (!isBreak && vk == VK_ESCAPE)
+            return true;
+        if (isBreak)
+        {
+            write_event(SRC_SINK, EV_KEY_UP, (int32_t)vk, 0, 0);
+            update_overlay_state_on_key(vk, false);
+        }
+        else
+        {
+            write_event(SRC_SINK, EV_KEY_DOWN, (int32_t)vk, 0, 0);
+            update_overlay_state_on_key(vk, true);
+        }
+    }
+    return false;
+}
+
+static LRESULT CALLBACK SinkProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch (msg)
+    {
+    case WM_INPUT:
+    {
+        if (!gRecording)
+            break;
+        UINT size = 0;
+        GetRawInputData((HRAWINPUT)lParam, RID_INPUT, nullptr, &size, sizeof(RAWINPUTHEADER));
+        if (!size)
+            break;
+        if (gRawBuf.size() < size)
+            gRawBuf.resize(size);
+        if (GetRawInputData((HRAWINPUT)lParam, RID_INPUT,
+                            gRawBuf.data(), &size, sizeof(RAWINPUTHEADER)) != size)
+            break;
+        if (handle_raw_input(reinterpret_cast<const RAWINPUT *>(gRawBuf.data())))
+            PostMessage(hwnd, WM_CLOSE, 0, 0);
+        break;
+    }
+    case WM_CLOSE:
+        DestroyWindow(hwnd);
+        return 0;
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+static bool create_sink_window()
+{
+    WNDCLASSA wc{};
+    wc.lpfnWndProc = SinkProc;
+    wc.hInstance = GetModuleHandle(nullptr);
+    wc.lpszClassName = kSinkClassName;
+    if (!RegisterClassA(&wc))
+    {
+        DWORD e = GetLastError();
+        if (e != ERROR_CLASS_ALREADY_EXISTS)
+        {
+            std::fprintf(stderr, "RegisterClassA sink failed (%lu)\n", e);
+            return false;
+        }
+    }
+    gSinkHwnd = CreateWindowExA(0, kSinkClassName, "RawIO_Sink",
+                                WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, 100, 100,
+                                nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
+    if (!gSinkHwnd)
+    {
+        std::fprintf(stderr, "CreateWindowExA sink failed (%lu)\n", GetLastError());
+        return false;
+    }
+    ShowWindow(gSinkHwnd, SW_HIDE);
+    gAbsLastValid = false;
+    if (!register_raw(gSinkHwnd))
+    {
+        std::fprintf(stderr, "RegisterRawInputDevices failed (%lu)\n", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+static void destroy_sink_window()
+{
+    if (gSinkHwnd)
+    {
+        DestroyWindow(gSinkHwnd);
+        gSinkHwnd = nullptr;
+    }
+}
+
+// ========================= Raw Input Thread =========================
+
+static constexpr UINT kMsgRecordStop = WM_APP + 1; // posted to the recording thread on ESC
+
+static LRESULT CALLBACK RawInputProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// Buffered replacement for the sink window: a message-only window on its own
+// THREAD_PRIORITY_HIGHEST thread. Each wakeup drains every pending packet
+// with GetRawInputBuffer, so a 4-8 kHz mouse costs one call per batch rather
+// than two GetRawInputData calls and a dispatch per packet. The overlay keeps
+// the recording thread's message loop to itself.
+class RawInputThread
+{
+public:
+    // ESC posts kMsgRecordStop to notifyThread
+    bool start(DWORD notifyThread)
+    {
+        notify_ = notifyThread;
+        batches_ = packets_ = maxBatch_ = readErrors_ = 0;
+        hist_.fill(0);
+        stopPosted_ = false;
+        state_ = 0;
+        run_ = true;
+        thread_ = std::thread([this]() { loop(); });
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [&] { return state_ != 0; });
+        if (state_ < 0)
+        {
+            thread_.join();
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        run_ = false;
+        if (hwnd_)
+            PostMessage(hwnd_, WM_NULL, 0, 0);
+        thread_.join();
+    }
+
+    void printReport() const
+    {
+        if (!batches_)
+            return;
+        std::printf("[RECORD] Raw input: %llu packets in %llu batches (avg %.1f, max %llu), read errors %llu, "
+                    "ring drops %llu\n",
+                    (unsigned long long)packets_, (unsigned long long)batches_,
+                    (double)packets_ / batches_, (unsigned long long)maxBatch_,
+                    (unsigned long long)readErrors_, (unsigned long long)gProducers[SRC_SINK].dropped.load());
+        static const char *kLabels[kHistBuckets] = {"1", "2-4", "5-16", "17-64", ">64"};
+        std::printf("[RECORD] Batch sizes:");
+        for (int b = 0; b < kHistBuckets; ++b)
+            std::printf(" %s:%llu", kLabels[b], (unsigned long long)hist_[b]);
+        std::printf("\n");
+    }
+
+private:
+    static constexpr int kHistBuckets = 5;
+
+    void signal(int state)
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        state_ = state;
+        cv_.notify_all();
+    }
+
+    void loop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        WNDCLASSA wc{};
+        wc.lpfnWndProc = RawInputProc;
+        wc.hInstance = GetModuleHandle(nullptr);
+        wc.lpszClassName = kRawInputClassName;
+        if (!RegisterClassA(&wc) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
+        {
+            std::fprintf(stderr, "RegisterClassA raw input failed (%lu)\n", GetLastError());
+            signal(-1);
+            return;
+        }
+        hwnd_ = CreateWindowExA(0, kRawInputClassName, "RawIO_Input", 0, 0, 0, 0, 0,
+                                HWND_MESSAGE, nullptr, GetModuleHandle(nullptr), nullptr);
+        if (!hwnd_ || !register_raw(hwnd_))
+        {
+            std::fprintf(stderr, "Raw input thread setup failed (%lu)\n", GetLastError());
+            if (hwnd_)
+                DestroyWindow(hwnd_);
+            hwnd_ = nullptr;
+            signal(-1);
+            return;
+        }
+        gAbsLastValid = false;
+        signal(1);
+
+        buf_.resize(kInitialBufBytes / sizeof(uint64_t)); // uint64_t keeps packets 8-byte aligned
+        while (run_)
+        {
+            // MWMO_INPUTAVAILABLE: input that arrived while draining or peeking
+            // below counts as "seen" and would otherwise not wake this wait
+            MsgWaitForMultipleObjectsEx(0, nullptr, 100, QS_RAWINPUT | QS_POSTMESSAGE, MWMO_INPUTAVAILABLE);
+            drain();
+            // Everything but WM_INPUT, which GetRawInputBuffer has already consumed
+            MSG msg;
+            while (PeekMessage(&msg, nullptr, 0, WM_INPUT - 1, PM_REMOVE) ||
+                   PeekMessage(&msg, nullptr, WM_INPUT + 1, 0xFFFFFFFF, PM_REMOVE))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+        }
+        drain();
+        DestroyWindow(hwnd_);
+        hwnd_ = nullptr;
+    }
+
+    void drain()
+    {
+        uint64_t batch = 0;
+        for (;;)
+        {
+            UINT cb = (UINT)(buf_.size() * sizeof(uint64_t));
+            RAWINPUT *raw = reinterpret_cast<RAWINPUT *>(buf_.data());
+            UINT n = GetRawInputBuffer(raw, &cb, sizeof(RAWINPUTHEADER));
+            if (n == (UINT)-1)
+            {
+                // Next packet larger than the buffer: grow once, otherwise give up this wakeup
+                UINT need = 0;
+                GetRawInputBuffer(nullptr, &need, sizeof(RAWINPUTHEADER));
+                ++readErrors_;
+                if (need * 8 > buf_.size() * sizeof(uint64_t))
+                {
+                    buf_.resize(need * 8 / sizeof(uint64_t) + 1);
+                    continue;
+                }
+                break;
+            }
+            if (n == 0)
+                break;
+            for (UINT k = 0; k < n; ++k, raw = NEXTRAWINPUTBLOCK(raw))
+            {
+                // Packets before the countdown ends are drained and discarded
+                if (gRecording && handle_raw_input(raw) && !stopPosted_)
+                {
+                    stopPosted_ = true;
+                    PostThreadMessage(notify_, kMsgRecordStop, 0, 0);
+                }
+            }
+            batch += n;
+        }
+        if (!batch)
+            return;
+        ++batches_;
+        packets_ += batch;
+        maxBatch_ = std::max(maxBatch_, batch);
+        ++hist_[batch == 1 ? 0 : batch <= 4 ? 1 : batch <= 16 ? 2 : batch <= 64 ? 3 : 4];
+    }
+
+    static constexpr size_t kInitialBufBytes = 64 * 1024;
+
+    std::thread thread_;
+    std::atomic<bool> run_{false};
+    std::mutex m_;
+    std::condition_variable cv_;
+    int state_ = 0; // 0 starting, 1 running, -1 failed
+    HWND hwnd_ = nullptr;
+    DWORD notify_ = 0;
+    bool stopPosted_ = false;
+    std::vector<uint64_t> buf_;
+    uint64_t batches_ = 0, packets_ = 0, maxBatch_ = 0, readErrors_ = 0;
+    std::array<uint64_t, kHistBuckets> hist_{};
+};
+
+static RawInputThread gRawInput;
+
+// Starts the recording input path: the buffered thread, or the sink window
+// on this thread with --raw=message (also the fallback if the thread fails).
+static bool start_record_input(bool &buffered)
+{
+    buffered = false;
+    if (gRawBuffered)
+    {
+        if (gRawInput.start(GetCurrentThreadId()))
+        {
+            buffered = true;
+            return true;
+        }
+        std::fprintf(stderr, "[RECORD] Buffered raw input unavailable, using the sink window.\n");
+    }
+    return create_sink_window();
+}
+
+static void stop_record_input(bool buffered)
+{
+    if (buffered)
+    {
+        gRawInput.stop();
+        gRawInput.printReport();
+    }
+    else
+        destroy_sink_window();
+}
+
+// ========================= Match Spaces =========================
+
+// Pixel space a template is matched in. Single-channel spaces cost about a
+// third of BGR in TM_CCOEFF_NORMED, and hue/saturation pick a coloured marker
+// out of a desaturated world. Scores don't carry over between spaces, so a
+// template outside BGR brings its own calibrated threshold (bench calibrate).
+// OpenCV hue is circular (0..179) but TM_CCOEFF_NORMED treats it as linear,
+// so hue is refused for templates whose colours straddle red (see hue_wraps).
+enum MatchSpace
+{
+    SPACE_BGR,
+    SPACE_GRAY,
+    SPACE_HUE,
+    SPACE_SAT,
+    kSpaceCount
+};
+static const char *const kSpaceNames[kSpaceCount] = {"bgr", "gray", "hue", "sat"};
+
+static bool parse_space(const char *s, MatchSpace &out)
+{
+    for (int i = 0; i < kSpaceCount; ++i)
+        if (std::strcmp(s, kSpaceNames[i]) == 0)
+        {
+            out = (MatchSpace)i;
+            return true;
+        }
+    return false;
+}
+
+// Spaces some loaded template matches in. The capture thread derives these
+// planes once per published frame; bits are only ever added.
+static std::atomic<unsigned> gFrameSpaces{0};
+
+// One frame in every match space; [SPACE_BGR] is the frame itself
+using FramePlanes = std::array<cv::Mat, kSpaceCount>;
+
+// BGR -> one match space. hsv is scratch for the hue/sat extraction.
+static void convert_to_space(const cv::Mat &bgr, MatchSpace sp, cv::Mat &out, cv::Mat &hsv)
+{
+    switch (sp)
+    {
+    case SPACE_GRAY:
+        cv::cvtColor(bgr, out, cv::COLOR_BGR2GRAY);
+        break;
+    case SPACE_HUE:
+    case SPACE_SAT:
+        cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+        cv::extractChannel(hsv, out, sp == SPACE_HUE ? 0 : 1);
+        break;
+    default:
+        out = bgr;
+        break;
+    }
+}
+
+// True when a template's coloured pixels sit on both sides of the 0/179 hue
+// seam (reds): adjacent shades then score as opposites and hue matching is
+// noise. Grey and dark pixels carry no hue and are ignored.
+static bool hue_wraps(const cv::Mat &bgr)
+{
+    constexpr int kBand = 15, kMinSat = 40, kMinVal = 40;
+    cv::Mat hsv;
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    int coloured = 0, low = 0, high = 0;
+    for (int y = 0; y < hsv.rows; ++y)
+    {
+        const uchar *p = hsv.ptr<uchar>(y);
+        for (int x = 0; x < hsv.cols; ++x, p += 3)
+        {
+            if (p[1] < kMinSat || p[2] < kMinVal)
+                continue;
+            ++coloured;
+            low += p[0] < kBand;
+            high += p[0] >= 180 - kBand;
+        }
+    }
+    // A few stray pixels on the far side don't make the score unstable
+    return coloured > 0 && low * 20 >= coloured && high * 20 >= coloured;
+}
+
+// Fills every space in mask from p[SPACE_BGR]; hue and sat share one HSV pass
+static void derive_planes(FramePlanes &p, unsigned mask, cv::Mat &hsv)
+{
+    if (mask & (1u << SPACE_GRAY))
+        cv::cvtColor(p[SPACE_BGR], p[SPACE_GRAY], cv::COLOR_BGR2GRAY);
+    if (mask & ((1u << SPACE_HUE) | (1u << SPACE_SAT)))
+    {
+        cv::cvtColor(p[SPACE_BGR], hsv, cv::COLOR_BGR2HSV);
+        if (mask & (1u << SPACE_HUE))
+            cv::extractChannel(hsv, p[SPACE_HUE], 0);
+        if (mask & (1u << SPACE_SAT))
+            cv::extractChannel(hsv, p[SPACE_SAT], 1);
+    }
+}
+
+// The frame in sp: the derived plane, or converted into scratch when this
+// frame was published before any template asked for sp
+static const cv::Mat &plane_for(const FramePlanes &p, MatchSpace sp, cv::Mat &scratch, cv::Mat &hsv)
+{
+    if (sp == SPACE_BGR || !p[sp].empty())
+        return p[sp];
+    convert_to_space(p[SPACE_BGR], sp, scratch, hsv);
+    return scratch;
+}
+
+// ========================= Screen Capture =========================
+
+template <class T>
+static void com_release(T *&p)
+{
+    if (p)
+    {
+        p->Release();
+        p = nullptr;
+    }
+}
+
+// Persistent GDI grabber: one memory DC + DIB section reused across grabs.
+// Used as the capture-service fallback when DXGI duplication is unavailable
+// (RDP sessions, rotated outputs, some hybrid-GPU laptops).
+class GdiGrabber
+{
+public:
+    ~GdiGrabber() { release(); }
+
+    // Grabs the rect (x,y,w,h) in virtual-screen coordinates into dst as BGR
+    bool grab(int x, int y, int w, int h, cv::Mat &dst)
+    {
+        if (w <= 0 || h <= 0)
+            return false;
+        if (!ensure(w, h))
+            return false;
+        HDC hScreen = GetDC(NULL);
+        BOOL ok = BitBlt(memDC_, 0, 0, w, h, hScreen, x, y, SRCCOPY | CAPTUREBLT);
+        ReleaseDC(NULL, hScreen);
+        if (!ok)
+            return false;
+        GdiFlush();
+        cv::Mat bgra(h, w, CV_8UC4, bits_, (size_t)w * 4);
+        cv::cvtColor(bgra, dst, cv::COLOR_BGRA2BGR);
+        return true;
+    }
+
+    // Draws icon at (x,y) at its native size on a flat gray w x h canvas into dst as BGR
+    bool drawIcon(HICON icon, int x, int y, int w, int h, cv::Mat &dst)
+    {
+        if (!icon || w <= 0 || h <= 0)
+            return false;
+        if (!ensure(w, h))
+            return false;
+        std::memset(bits_, 0x80, (size_t)w * h * 4);
+        if (!DrawIconEx(memDC_, x, y, icon, 0, 0, 0, nullptr, DI_NORMAL))
+            return false;
+        GdiFlush();
+        cv::Mat bgra(h, w, CV_8UC4, bits_, (size_t)w * 4);
+        cv::cvtColor(bgra, dst, cv::COLOR_BGRA2BGR);
+        return true;
+    }
+
+    void release()
+    {
+        if (memDC_)
+        {
+            SelectObject(memDC_, oldBmp_);
+            DeleteDC(memDC_);
+            memDC_ = nullptr;
+        }
+        if (bmp_)
+        {
+            DeleteObject(bmp_);
+            bmp_ = nullptr;
+        }
+        bits_ = nullptr;
+        w_ = h_ = 0;
+    }
+
+private:
+    bool ensure(int w, int h)
+    {
+        if (memDC_ && w == w_ && h == h_)
+            return true;
+        release();
+        HDC hScreen = GetDC(NULL);
+        memDC_ = CreateCompatibleDC(hScreen);
+        BITMAPINFO bi{};
+        bi.bmiHeader.biSize = sizeof(bi.bmiHeader);
+        bi.bmiHeader.biWidth = w;
+        bi.bmiHeader.biHeight = -h;
+        bi.bmiHeader.biPlanes = 1;
+        bi.bmiHeader.biBitCount = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+        bmp_ = CreateDIBSection(hScreen, &bi, DIB_RGB_COLORS, &bits_, nullptr, 0);
+        ReleaseDC(NULL, hScreen);
+        if (!memDC_ || !bmp_ || !bits_)
+        {
+            release();
+            return false;
+        }
+        oldBmp_ = SelectObject(memDC_, bmp_);
+        w_ = w;
+        h_ = h;
+        return true;
+    }
+
+    HDC memDC_ = nullptr;
+    HBITMAP bmp_ = nullptr;
+    HGDIOBJ oldBmp_ = nullptr;
+    void *bits_ = nullptr;
+    int w_ = 0, h_ = 0;
+};
+
+// Change detection works on kGateTile squares of the BGR frame
+static const int kGateTile = 64;
+
+// Fletcher-style sum over one tile's rows: position-sensitive, and the inner
+// loop is two adds per 8 bytes
+static uint64_t tile_checksum(const cv::Mat &bgr, const cv::Rect &r)
+{
+    uint64_t a = 0, b = 0;
+    const size_t rowBytes = (size_t)r.width * bgr.elemSize();
+    for (int y = r.y; y < r.y + r.height; ++y)
+    {
+        const uchar *p = bgr.ptr<uchar>(y) + (size_t)r.x * bgr.elemSize();
+        size_t i = 0;
+        for (; i + 8 <= rowBytes; i += 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, p + i, 8);
+            a += w;
+            b += a;
+        }
+        for (; i < rowBytes; ++i)
+        {
+            a += p[i];
+            b += a;
+        }
+    }
+    return a ^ (b * 0x9E3779B97F4A7C15ull);
+}
+
+// The game: the last foreground window of another process, ignoring the
+// console hosts this runs in. Capture keeps following it while the console
+// has focus; none yet (or closed) means the whole virtual screen.
+static HWND track_game_window()
+{
+    static HWND game = nullptr;
+    HWND fg = GetForegroundWindow();
+    DWORD pid = 0;
+    char cls[64] = {};
+    if (fg && fg != game && fg != GetConsoleWindow() && fg != GetShellWindow() &&
+        GetWindowThreadProcessId(fg, &pid) && pid != GetCurrentProcessId() &&
+        GetClassNameA(fg, cls, sizeof(cls)) && std::strcmp(cls, "ConsoleWindowClass") != 0 &&
+        std::strcmp(cls, "CASCADIA_HOSTING_WINDOW_CLASS") != 0)
+    {
+        game = fg;
+        char title[128] = {};
+        GetWindowTextA(fg, title, sizeof(title));
+        std::printf("[CAPTURE] Game window: \"%s\"\n", title);
+    }
+    if (game && !IsWindow(game))
+        game = nullptr;
+    return game;
+}
+
+static RECT virtual_screen_rect()
+{
+    const int vx = GetSystemMetrics(SM_XVIRTUALSCREEN), vy = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    return RECT{vx, vy, vx + GetSystemMetrics(SM_CXVIRTUALSCREEN), vy + GetSystemMetrics(SM_CYVIRTUALSCREEN)};
+}
+
+// Desktop rect to grab for --capture. Capture thread only (track_game_window
+// keeps state). A minimised game keeps `last`.
+static RECT capture_target_rect(const RECT &last)
+{
+    if (gCaptureScope == CAPTURE_VIRTUAL)
+        return virtual_screen_rect();
+    HWND game = track_game_window();
+    if (!game)
+        return virtual_screen_rect();
+    if (IsIconic(game))
+        return last.right > last.left ? last : virtual_screen_rect();
+
+    MONITORINFO mi{};
+    mi.cbSize = sizeof(mi);
+    if (!GetMonitorInfoA(MonitorFromWindow(game, MONITOR_DEFAULTTONEAREST), &mi))
+        return virtual_screen_rect();
+    if (gCaptureScope == CAPTURE_WINDOW)
+    {
+        RECT rc{};
+        POINT tl{0, 0};
+        if (GetClientRect(game, &rc) && ClientToScreen(game, &tl))
+        {
+            // Clipped to its monitor: off-screen parts have no pixels to grab
+            RECT w{std::max(tl.x, mi.rcMonitor.left), std::max(tl.y, mi.rcMonitor.top),
+                   std::min(tl.x + rc.right, mi.rcMonitor.right), std::min(tl.y + rc.bottom, mi.rcMonitor.bottom)};
+            if (w.right > w.left && w.bottom > w.top)
+                return w;
+        }
+    }
+    return mi.rcMonitor;
+}
+
+// One published frame of the capture target. Slots are reused, so readers must not
+// keep the Mat past the lifetime of their CaptureFrameRef.
+struct CaptureFrame
+{
+    cv::Mat bgr;
+    FramePlanes planes;              // [SPACE_BGR] aliases bgr; the rest per gFrameSpaces
+    uint64_t generation = 0;
+    uint64_t t_us = 0;
+    int originX = 0, originY = 0;    // desktop position of pixel (0,0): frame + origin = screen coords
+    std::vector<cv::Rect> dirty;     // DXGI dirty+move rects (frame coords); empty on GDI path
+    std::vector<uint64_t> tiles;     // kGateTile checksums, row-major (see FrameGate)
+    int tileCols = 0, tileRows = 0;
+};
+
+// Pins one ring slot for reading. The writer never reuses a pinned slot.
+class CaptureFrameRef
+{
+public:
+    CaptureFrameRef() = default;
+    CaptureFrameRef(const CaptureFrameRef &) = delete;
+    CaptureFrameRef &operator=(const CaptureFrameRef &) = delete;
+    CaptureFrameRef(CaptureFrameRef &&o) noexcept : pin_(o.pin_), frame_(o.frame_)
+    {
+        o.pin_ = nullptr;
+        o.frame_ = nullptr;
+    }
+    CaptureFrameRef &operator=(CaptureFrameRef &&o) noexcept
+    {
+        if (this != &o)
+        {
+            reset();
+            pin_ = o.pin_;
+            frame_ = o.frame_;
+            o.pin_ = nullptr;
+            o.frame_ = nullptr;
+        }
+        return *this;
+    }
+    ~CaptureFrameRef() { reset(); }
+
+    explicit operator bool() const { return frame_ != nullptr; }
+    const CaptureFrame &frame() const { return *frame_; }
+    const cv::Mat &mat() const { return frame_->bgr; }
+    const FramePlanes &planes() const { return frame_->planes; }
+    uint64_t generation() const { return frame_ ? frame_->generation : 0; }
+
+    void reset()
+    {
+        if (pin_)
+            pin_->fetch_sub(1, std::memory_order_release);
+        pin_ = nullptr;
+        frame_ = nullptr;
+    }
+
+private:
+    friend class CaptureService;
+    CaptureFrameRef(std::atomic<int> *pin, const CaptureFrame *f) : pin_(pin), frame_(f) {}
+
+    std::atomic<int> *pin_ = nullptr;
+    const CaptureFrame *frame_ = nullptr;
+};
+
+// Single capture thread shared by hunt, quest walk and cursor detect.
+// DXGI Output Duplication per desktop output, composed into one BGR frame of
+// the capture target (the game's monitor or client rect, or the whole virtual
+// screen; see CaptureScope) and published into a triple-buffered ring with a
+// generation counter. Frames whose dirty/move metadata is empty are not
+// republished, so readers see the same generation while the screen is idle,
+// and each frame carries tile checksums so readers can tell which parts of
+// the screen changed since the frame they last used (FrameGate).
+class CaptureService
+{
+public:
+    static const int kSlots = 3;
+
+    ~CaptureService() { stop(); }
+
+    bool start(int intervalMs)
+    {
+        if (run_.load())
+            return true;
+        intervalMs_ = std::max(1, intervalMs);
+        latest_ = -1;
+        for (auto &p : pins_)
+            p = 0;
+        run_ = true;
+        thread_ = std::thread([this]()
+                              { loop(); });
+        return true;
+    }
+
+    void stop()
+    {
+        run_ = false;
+        newFrameCv_.notify_all();
+        gWake.notify();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    bool running() const { return run_.load(); }
+    bool usingDxgi() const { return dxgiActive_.load(); }
+    uint64_t generation() const { return gen_.load(std::memory_order_acquire); }
+
+    // Latest published frame, or an empty ref before the first publish
+    CaptureFrameRef latest()
+    {
+        for (;;)
+        {
+            int s = latest_.load(std::memory_order_acquire);
+            if (s < 0)
+                return CaptureFrameRef();
+            int p = pins_[s].load(std::memory_order_acquire);
+            if (p < 0)
+                continue; // writer just re-took this slot; reload latest_
+            if (!pins_[s].compare_exchange_weak(p, p + 1, std::memory_order_acq_rel))
+                continue;
+            // s may have been stale: the writer could have taken, partly
+            // overwritten and (on a failed compose) released it before the
+            // pin landed. Only a slot that is still latest is whole.
+            if (latest_.load(std::memory_order_acquire) == s)
+                return CaptureFrameRef(&pins_[s], &slots_[s]);
+            pins_[s].fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // Blocks up to timeoutMs for a frame with generation > gen
+    CaptureFrameRef waitNewer(uint64_t gen, int timeoutMs)
+    {
+        if (generation() <= gen)
+        {
+            std::unique_lock<std::mutex> lk(waitMu_);
+            newFrameCv_.wait_for(lk, std::chrono::milliseconds(timeoutMs),
+                                 [&]()
+                                 { return !run_.load() || generation() > gen; });
+        }
+        return latest();
+    }
+
+    uint64_t published() const { return published_.load(); }
+    uint64_t idleSkips() const { return idleSkips_.load(); }
+    uint64_t ringFull() const { return ringFull_.load(); }
+
+private:
+    struct DxgiOutput
+    {
+        ID3D11Device *dev = nullptr;
+        ID3D11DeviceContext *ctx = nullptr;
+        IDXGIOutputDuplication *dupl = nullptr;
+        ID3D11Texture2D *staging = nullptr;
+        RECT rect{};
+        bool hasImage = false;
+    };
+
+    void loop()
+    {
+        apply_thread_role(ROLE_CAPTURE);
+        const RECT virt = virtual_screen_rect();
+        std::printf("[CAPTURE] Virtual screen %dx%d at (%d,%d)\n", (int)(virt.right - virt.left),
+                    (int)(virt.bottom - virt.top), (int)virt.left, (int)virt.top);
+        target_ = RECT{};
+        bool dxgi = initDxgi();
+        dxgiActive_ = dxgi;
+        std::printf("[CAPTURE] Backend: %s (%zu outputs)\n", dxgi ? "DXGI duplication" : "GDI BitBlt", outputs_.size());
+        auto lastRetry = std::chrono::steady_clock::now();
+
+        while (run_)
+        {
+            if (!gRecording && !gPlaying && !gRunQuestWalk.load())
+            {
+                gWake.waitUntil([&] { return !run_ || gRecording || gPlaying || gRunQuestWalk; });
+                continue;
+            }
+            auto t0 = std::chrono::steady_clock::now();
+
+            // Follow the game across monitors; a new target is a new frame
+            // even when no output has fresh pixels
+            bool changed = updateTarget();
+            if (dxgi)
+            {
+                bool lost = false;
+                changed |= pollDxgi(lost);
+                if (lost)
+                {
+                    // Mode change, UAC desktop, fullscreen switch: rebuild or fall back
+                    dxgi = initDxgi();
+                    dxgiActive_ = dxgi;
+                    std::printf("[CAPTURE] Access lost - backend now %s\n", dxgi ? "DXGI" : "GDI");
+                    lastRetry = t0;
+                    continue;
+                }
+            }
+            else
+            {
+                changed = true; // GDI has no change metadata
+                if (t0 - lastRetry > std::chrono::seconds(5))
+                {
+                    lastRetry = t0;
+                    if ((dxgi = initDxgi()))
+                    {
+                        dxgiActive_ = true;
+                        std::puts("[CAPTURE] DXGI duplication recovered.");
+                        continue;
+                    }
+                }
+            }
+
+            if (!changed)
+                idleSkips_++;
+            else
+            {
+                int slot = acquireWriteSlot();
+                if (slot < 0)
+                {
+                    ringFull_++; // every other slot pinned by readers; they keep the previous frame
+                    tilesStale_ = true; // this poll's dirty rects are lost
+                }
+                else
+                {
+                    CaptureFrame &f = slots_[slot];
+                    bool ok;
+                    {
+                        TraceScope ts(TS_CAPTURE);
+                        ok = dxgi ? composeDxgi(f) : composeGdi(f);
+                        if (ok)
+                        {
+                            f.planes[SPACE_BGR] = f.bgr;
+                            derive_planes(f.planes, gFrameSpaces.load(std::memory_order_relaxed), hsv_);
+                            hashTiles(f, dxgi);
+                        }
+                    }
+                    if (ok)
+                        publish(slot);
+                    else
+                    {
+                        pins_[slot].store(0, std::memory_order_release);
+                        tilesStale_ = true;
+                    }
+                }
+            }
+
+            auto spent = std::chrono::steady_clock::now() - t0;
+            auto budget = std::chrono::milliseconds(intervalMs_);
+            if (spent < budget)
+                std::this_thread::sleep_for(budget - spent);
+        }
+        releaseDxgi();
+        gdi_.release();
+        dxgiActive_ = false;
+    }
+
+    int acquireWriteSlot()
+    {
+        int cur = latest_.load(std::memory_order_acquire);
+        for (int i = 0; i < kSlots; ++i)
+        {
+            if (i == cur)
+                continue;
+            int expected = 0;
+            if (pins_[i].compare_exchange_strong(expected, -1, std::memory_order_acq_rel))
+                return i;
+        }
+        return -1;
+    }
+
+    void publish(int slot)
+    {
+        uint64_t g = gen_.load(std::memory_order_relaxed) + 1;
+        slots_[slot].generation = g;
+        pins_[slot].store(0, std::memory_order_release);
+        latest_.store(slot, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(waitMu_);
+            gen_.store(g, std::memory_order_release);
+        }
+        newFrameCv_.notify_all();
+        published_++;
+    }
+
+    // Returns true when the target rect moved or resized
+    bool updateTarget()
+    {
+        RECT t = capture_target_rect(target_);
+        if (t.left == target_.left && t.top == target_.top && t.right == target_.right && t.bottom == target_.bottom)
+            return false;
+        target_ = t;
+        tilesStale_ = true; // same-size monitor switch: checksums carry over nothing
+        std::printf("[CAPTURE] Target %dx%d at (%d,%d) (%s)\n", (int)(t.right - t.left), (int)(t.bottom - t.top),
+                    (int)t.left, (int)t.top,
+                    gCaptureScope == CAPTURE_WINDOW ? "window" : gCaptureScope == CAPTURE_MONITOR ? "monitor" : "virtual");
+        return true;
+    }
+
+    void prepare_frame(CaptureFrame &f)
+    {
+        const int w = target_.right - target_.left, h = target_.bottom - target_.top;
+        if (f.bgr.rows != h || f.bgr.cols != w || f.bgr.type() != CV_8UC3 ||
+            f.originX != target_.left || f.originY != target_.top)
+        {
+            f.bgr.create(h, w, CV_8UC3);
+            f.bgr.setTo(cv::Scalar(0, 0, 0)); // gaps between non-rectangular monitor layouts
+        }
+        f.originX = target_.left;
+        f.originY = target_.top;
+        f.t_us = steady_us();
+    }
+
+    bool composeGdi(CaptureFrame &f)
+    {
+        prepare_frame(f);
+        f.dirty.clear();
+        return gdi_.grab(f.originX, f.originY, f.bgr.cols, f.bgr.rows, f.bgr);
+    }
+
+    bool initDxgi()
+    {
+        releaseDxgi();
+        tilesStale_ = true; // fresh duplications start without dirty metadata
+        IDXGIFactory1 *factory = nullptr;
+        if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void **)&factory)))
+            return false;
+        bool complete = true;
+        for (UINT a = 0;; ++a)
+        {
+            IDXGIAdapter1 *adapter = nullptr;
+            if (factory->EnumAdapters1(a, &adapter) == DXGI_ERROR_NOT_FOUND)
+                break;
+            ID3D11Device *dev = nullptr;
+            ID3D11DeviceContext *ctx = nullptr;
+            if (FAILED(D3D11CreateDevice(adapter, D3D_DRIVER_TYPE_UNKNOWN, nullptr, 0, nullptr, 0,
+                                         D3D11_SDK_VERSION, &dev, nullptr, &ctx)))
+            {
+                adapter->Release();
+                continue;
+            }
+            for (UINT o = 0;; ++o)
+            {
+                IDXGIOutput *output = nullptr;
+                if (adapter->EnumOutputs(o, &output) == DXGI_ERROR_NOT_FOUND)
+                    break;
+                DXGI_OUTPUT_DESC desc{};
+                output->GetDesc(&desc);
+                if (desc.AttachedToDesktop)
+                {
+                    IDXGIOutput1 *output1 = nullptr;
+                    IDXGIOutputDuplication *dupl = nullptr;
+                    bool rotated = desc.Rotation != DXGI_MODE_ROTATION_IDENTITY &&
+                                   desc.Rotation != DXGI_MODE_ROTATION_UNSPECIFIED;
+                    if (!rotated &&
+                        SUCCEEDED(output->QueryInterface(__uuidof(IDXGIOutput1), (void **)&output1)) &&
+                        SUCCEEDED(output1->DuplicateOutput(dev, &dupl)))
+                    {
+                        DxgiOutput out;
+                        out.dev = dev;
+                        out.ctx = ctx;
+                        dev->AddRef();
+                        ctx->AddRef();
+                        out.dupl = dupl;
+                        out.rect = desc.DesktopCoordinates;
+                        outputs_.push_back(out);
+                    }
+                    else
+                        complete = false;
+                    com_release(output1);
+                }
+                output->Release();
+            }
+            ctx->Release();
+            dev->Release();
+            adapter->Release();
+        }
+        factory->Release();
+        // A partial set of outputs would leave holes in the frame; use GDI instead
+        if (!complete || outputs_.empty())
+        {
+            releaseDxgi();
+            return false;
+        }
+        return true;
+    }
+
+    void releaseDxgi()
+    {
+        for (auto &o : outputs_)
+        {
+            com_release(o.staging);
+            com_release(o.dupl);
+            com_release(o.ctx);
+            com_release(o.dev);
+        }
+        outputs_.clear();
+    }
+
+    // Drains pending frames from every output into its staging texture.
+    // Returns true if any output's pixels changed since the last publish.
+    bool pollDxgi(bool &lost)
+    {
+        bool changed = false;
+        pendingDirty_.clear();
+        for (auto &o : outputs_)
+        {
+            // Outputs outside the target aren't drained; their pending updates
+            // (and dirty metadata) accumulate until the game moves there
+            if (!overlapsTarget(o))
+                continue;
+            DXGI_OUTDUPL_FRAME_INFO info{};
+            IDXGIResource *res = nullptr;
+            HRESULT hr = o.dupl->AcquireNextFrame(0, &info, &res);
+            if (hr == DXGI_ERROR_WAIT_TIMEOUT)
+                continue;
+            if (FAILED(hr))
+            {
+                lost = true;
+                return false;
+            }
+
+            // LastPresentTime == 0 means only the pointer moved
+            bool pixels = info.LastPresentTime.QuadPart != 0 && collectDirty(o, info);
+            if (pixels || !o.hasImage)
+            {
+                ID3D11Texture2D *tex = nullptr;
+                if (SUCCEEDED(res->QueryInterface(__uuidof(ID3D11Texture2D), (void **)&tex)))
+                {
+                    if (!o.staging)
+                    {
+                        D3D11_TEXTURE2D_DESC td{};
+                        tex->GetDesc(&td);
+                        td.Usage = D3D11_USAGE_STAGING;
+                        td.BindFlags = 0;
+                        td.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+                        td.MiscFlags = 0;
+                        td.MipLevels = 1;
+                        td.ArraySize = 1;
+                        o.dev->CreateTexture2D(&td, nullptr, &o.staging);
+                    }
+                    if (o.staging)
+                    {
+                        o.ctx->CopyResource(o.staging, tex);
+                        o.hasImage = true;
+                        changed = true;
+                    }
+                    tex->Release();
+                }
+            }
+            res->Release();
+            o.dupl->ReleaseFrame();
+        }
+        return changed;
+    }
+
+    // Appends this output's dirty and move-destination rects to pendingDirty_
+    // (frame coords). Returns false when the metadata is empty.
+    bool collectDirty(DxgiOutput &o, const DXGI_OUTDUPL_FRAME_INFO &info)
+    {
+        if (info.TotalMetadataBufferSize == 0)
+            return false;
+        if (metaBuf_.size() < info.TotalMetadataBufferSize)
+            metaBuf_.resize(info.TotalMetadataBufferSize);
+        const int ox = o.rect.left - target_.left, oy = o.rect.top - target_.top;
+        size_t before = pendingDirty_.size();
+
+        UINT used = 0;
+        auto *moves = reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT *>(metaBuf_.data());
+        if (SUCCEEDED(o.dupl->GetFrameMoveRects((UINT)metaBuf_.size(), moves, &used)))
+            for (UINT i = 0; i < used / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i)
+            {
+                const RECT &r = moves[i].DestinationRect;
+                pendingDirty_.emplace_back(ox + r.left, oy + r.top, r.right - r.left, r.bottom - r.top);
+            }
+        used = 0;
+        auto *rects = reinterpret_cast<RECT *>(metaBuf_.data());
+        if (SUCCEEDED(o.dupl->GetFrameDirtyRects((UINT)metaBuf_.size(), rects, &used)))
+            for (UINT i = 0; i < used / sizeof(RECT); ++i)
+            {
+                const RECT &r = rects[i];
+                pendingDirty_.emplace_back(ox + r.left, oy + r.top, r.right - r.left, r.bottom - r.top);
+            }
+        return pendingDirty_.size() > before;
+    }
+
+    bool overlapsTarget(const DxgiOutput &o) const
+    {
+        return o.rect.left < target_.right && target_.left < o.rect.right &&
+               o.rect.top < target_.bottom && target_.top < o.rect.bottom;
+    }
+
+    // Converts the target's part of each output's staging texture into the
+    // slot (BGRA -> BGR, in place)
+    bool composeDxgi(CaptureFrame &f)
+    {
+        prepare_frame(f);
+        const int vx = f.originX, vy = f.originY;
+        const cv::Rect bounds(0, 0, f.bgr.cols, f.bgr.rows);
+        for (auto &o : outputs_)
+        {
+            if (!o.staging || !overlapsTarget(o))
+                continue;
+            D3D11_MAPPED_SUBRESOURCE m{};
+            if (FAILED(o.ctx->Map(o.staging, 0, D3D11_MAP_READ, 0, &m)))
+                return false; // the slot would keep this output's pixels from an older frame
+            const int w = o.rect.right - o.rect.left, h = o.rect.bottom - o.rect.top;
+            cv::Rect dst = cv::Rect(o.rect.left - vx, o.rect.top - vy, w, h) & bounds;
+            if (dst.area() > 0)
+            {
+                cv::Mat src(h, w, CV_8UC4, m.pData, m.RowPitch);
+                cv::Mat srcRoi = src(cv::Rect(dst.x - (o.rect.left - vx), dst.y - (o.rect.top - vy), dst.width, dst.height));
+                cv::Mat dstRoi = f.bgr(dst);
+                cv::cvtColor(srcRoi, dstRoi, cv::COLOR_BGRA2BGR);
+            }
+            o.ctx->Unmap(o.staging, 0);
+        }
+        f.dirty.assign(pendingDirty_.begin(), pendingDirty_.end());
+        return true;
+    }
+
+    // Per-tile checksums for FrameGate. With DXGI metadata only the tiles
+    // under this frame's dirty/move rects are rehashed; the rest carry over
+    // from the previous publish. GDI frames and resizes hash every tile.
+    void hashTiles(CaptureFrame &f, bool useDirty)
+    {
+        if (!gFrameGate)
+        {
+            f.tiles.clear();
+            f.tileCols = f.tileRows = 0;
+            return;
+        }
+        const int cols = (f.bgr.cols + kGateTile - 1) / kGateTile;
+        const int rows = (f.bgr.rows + kGateTile - 1) / kGateTile;
+        const cv::Rect bounds(0, 0, f.bgr.cols, f.bgr.rows);
+        auto tileRect = [&](int tx, int ty)
+        { return cv::Rect(tx * kGateTile, ty * kGateTile, kGateTile, kGateTile) & bounds; };
+
+        if (!useDirty || tilesStale_ || (int)tileSums_.size() != cols * rows)
+        {
+            tileSums_.resize((size_t)cols * rows);
+            for (int ty = 0; ty < rows; ++ty)
+                for (int tx = 0; tx < cols; ++tx)
+                    tileSums_[(size_t)ty * cols + tx] = tile_checksum(f.bgr, tileRect(tx, ty));
+            tilesStale_ = false;
+        }
+        else
+        {
+            tileMark_.assign(tileSums_.size(), 0);
+            for (const cv::Rect &d : f.dirty)
+            {
+                cv::Rect r = d & bounds;
+                if (r.area() <= 0)
+                    continue;
+                for (int ty = r.y / kGateTile; ty <= (r.br().y - 1) / kGateTile; ++ty)
+                    for (int tx = r.x / kGateTile; tx <= (r.br().x - 1) / kGateTile; ++tx)
+                    {
+                        size_t i = (size_t)ty * cols + tx;
+                        if (!tileMark_[i])
+                        {
+                            tileMark_[i] = 1;
+                            tileSums_[i] = tile_checksum(f.bgr, tileRect(tx, ty));
+                        }
+                    }
+            }
+        }
+        f.tiles.assign(tileSums_.begin(), tileSums_.end());
+        f.tileCols = cols;
+        f.tileRows = rows;
+    }
+
+    CaptureFrame slots_[kSlots];
+    std::atomic<int> pins_[kSlots]{}; // -1 = writer owns, >= 0 = reader count
+    std::atomic<int> latest_{-1};
+    std::atomic<uint64_t> gen_{0};
+    std::mutex waitMu_;
+    std::condition_variable newFrameCv_;
+
+    std::atomic<bool> run_{false};
+    std::atomic<bool> dxgiActive_{false};
+    std::thread thread_;
+    int intervalMs_ = 33;
+
+    std::vector<DxgiOutput> outputs_;
+    RECT target_{}; // desktop rect being captured (capture_target_rect)
+    std::vector<BYTE> metaBuf_;
+    std::vector<cv::Rect> pendingDirty_;
+    std::vector<uint64_t> tileSums_; // checksums of the last published frame
+    std::vector<uint8_t> tileMark_;  // tiles already rehashed this frame
+    bool tilesStale_ = true;         // a change went unpublished: rehash everything
+    GdiGrabber gdi_;
+    cv::Mat hsv_;
+
+    std::atomic<uint64_t> published_{0};
+    std::atomic<uint64_t> idleSkips_{0};
+    std::atomic<uint64_t> ringFull_{0};
+};
+
+static CaptureService gCapture;
+
+static void start_capture_service()
+{
+    gCapture.start(gCaptureMs);
+}
+
+static void stop_capture_service()
+{
+    if (!gCapture.running())
+        return;
+    gCapture.stop();
+    std::printf("[CAPTURE] Stopped. published=%llu idle_skips=%llu ring_full=%llu\n",
+                (unsigned long long)gCapture.published(), (unsigned long long)gCapture.idleSkips(),
+                (unsigned long long)gCapture.ringFull());
+}
+
+// ========================= Frame Gate =========================
+
+// One consumer's view of what changed on screen since the frame it last
+// processed. Consumers skip generations (hunt scans every scan_ms, capture
+// publishes faster), so this compares the capture thread's tile checksums
+// against a private copy instead of summing per-frame dirty rects.
+class FrameGate
+{
+public:
+    // Areas of region (frame coords) covering every tile that differs from
+    // the last accept()ed frame, each grown by margin so matches overlapping
+    // a changed tile fit, clipped to region and merged where they overlap.
+    // Empty when nothing changed; just region on the first frame, after the
+    // capture target moved or resized, with --gate=off, or when most of
+    // region changed.
+    const std::vector<cv::Rect> &changed(const CaptureFrame &f, const cv::Rect &requested,
+                                         cv::Size margin = cv::Size())
+    {
+        out_.clear();
+        // Callers pass rects that can reach past the frame (a marker at the
+        // left edge, a user --battle-roi); tile indices must stay in range
+        const cv::Rect region = requested & cv::Rect(0, 0, f.bgr.cols, f.bgr.rows);
+        if (region.area() <= 0)
+            return out_;
+        if (f.tiles.empty() || f.tileCols != cols_ || f.tileRows != rows_ || sums_.size() != f.tiles.size() ||
+            f.originX != originX_ || f.originY != originY_)
+        {
+            out_.push_back(region);
+            return out_;
+        }
+
+        const int tx0 = region.x / kGateTile, ty0 = region.y / kGateTile;
+        const int tx1 = std::min(cols_ - 1, (region.br().x - 1) / kGateTile);
+        const int ty1 = std::min(rows_ - 1, (region.br().y - 1) / kGateTile);
+        int total = 0, dirty = 0;
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+            {
+                ++total;
+                size_t i = (size_t)ty * cols_ + tx;
+                if (f.tiles[i] == sums_[i])
+                    continue;
+                ++dirty;
+                cv::Rect r(tx * kGateTile - margin.width, ty * kGateTile - margin.height,
+                           kGateTile + 2 * margin.width, kGateTile + 2 * margin.height);
+                out_.push_back(r & region);
+            }
+        if (dirty * 2 > total)
+        {
+            out_.assign(1, region);
+            return out_;
+        }
+
+        // Merge overlapping areas until none overlap
+        for (bool merged = true; merged;)
+        {
+            merged = false;
+            for (size_t i = 0; i < out_.size(); ++i)
+                for (size_t j = i + 1; j < out_.size(); ++j)
+                    if ((out_[i] & out_[j]).area() > 0)
+                    {
+                        out_[i] |= out_[j];
+                        out_[j] = out_.back();
+                        out_.pop_back();
+                        merged = true;
+                        --j;
+                    }
+        }
+        return out_;
+    }
+
+    void accept(const CaptureFrame &f)
+    {
+        sums_.assign(f.tiles.begin(), f.tiles.end());
+        cols_ = f.tileCols;
+        rows_ = f.tileRows;
+        originX_ = f.originX;
+        originY_ = f.originY;
+    }
+
+private:
+    std::vector<uint64_t> sums_;
+    int cols_ = 0, rows_ = 0;
+    int originX_ = 0, originY_ = 0;
+    std::vector<cv::Rect> out_;
+};
+
+// ========================= Frame Arenas =========================
+
+struct MatchHit
+{
+    cv::Point topLeft;
+    double score;
+};
+
+// Scratch owned by one vision thread (hunt, quest, cursor, bench). Buffers are
+// sized by the first frame and then reused: cv::Mat::create() is a no-op when
+// size and type match and vectors only clear(), so steady-state scans don't
+// touch the heap. Never share one between threads.
+struct VisionArena
 {
-    INPUT in{};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = (WORD)vk;
-    in.ki.dwFlags = down ? 0 : KEYEVENTF_KEYUP;
-    SendInput(1, &in, sizeof(INPUT));
-}
+    cv::Mat result;             // matchTemplate output
+    cv::Mat roi;                // grabbed / cropped pixels
+    cv::Mat plane, hsv;         // roi converted to a template's match space
+    std::vector<MatchHit> cand; // local maxima before NMS
+    std::vector<MatchHit> hits; // NMS survivors, strongest first
+    // OpenCL backend: frame upload, result map and an uploaded template keyed
+    // by its host pixels (templates outlive the threads that match them)
+    cv::UMat frameDev, templDev, resultDev;
+    const uchar *templKey = nullptr;
+};
 
-static void release_move_keys()
+// Fixed set of Mats handed to another stage through a Mailbox. A slot is
+// reused once the pool holds the only reference, i.e. the consumer and the
+// mailbox have both let go of it; otherwise writing into it would race the
+// reader. Grows to 3 slots in practice (mailbox, consumer, producer).
+class MatPool
 {
-    send_key(false, 'W');
-    send_key(false, 'A');
-    send_key(false, 'S');
-    send_key(false, 'D');
-    send_key(false, VK_SHIFT);
-}
+public:
+    cv::Mat &acquire()
+    {
+        for (auto &m : slots_)
+            if (!m.u || CV_XADD(&m.u->refcount, 0) == 1)
+                return m;
+        return slots_.emplace_back();
+    }
 
-// ========================= Raw Input Sink =========================
+private:
+    std::deque<cv::Mat> slots_; // deque: references stay valid as it grows
+};
 
-static void update_overlay_state_on_mouse()
+// ROI of side 2*halfSize centred on the cursor, as a view into the shared frame
+static cv::Mat roi_around_cursor(const CaptureFrame &f, int halfSize)
 {
-    GetCursorPos(&gCursorPt);
-    overlay_invalidate();
+    POINT pt{};
+    if (!GetCursorPos(&pt) || f.bgr.empty())
+        return cv::Mat();
+    cv::Rect r(pt.x - f.originX - halfSize, pt.y - f.originY - halfSize, halfSize * 2, halfSize * 2);
+    r &= cv::Rect(0, 0, f.bgr.cols, f.bgr.rows);
+    if (r.area() <= 0)
+        return cv::Mat();
+    return f.bgr(r);
 }
-static void update_overlay_state_on_key(UINT vk, bool down)
+
+// Cursor-thread only: the grabber keeps its DC and DIB between calls and the
+// pixels land in the caller's buffer
+static bool capture_roi_around_cursor(int halfSize, cv::Mat &out)
 {
-    if (vk < 256)
-        gKeyDown[vk] = down;
-    overlay_invalidate();
+    static GdiGrabber grabber;
+    POINT pt{};
+    if (!GetCursorPos(&pt))
+        return false;
+    return grabber.grab(pt.x - halfSize, pt.y - halfSize, halfSize * 2, halfSize * 2, out);
 }
 
-static bool register_raw(HWND hwnd)
+// Crop the distance label area below a detected quest marker
+// markerCenter = center pixel of the matched template on screen
+// templH       = height of the quest marker template (pixels)
+// out          = caller-owned buffer, reused when it is already roiW x roiH
+static bool crop_distance_label(const cv::Mat &screen, cv::Point markerCenter,
+                                int templH, cv::Mat &out, int roiW = 80, int roiH = 28)
 {
-    RAWINPUTDEVICE rids[2]{};
-    rids[0].usUsagePage = 0x01;
-    rids[0].usUsage = 0x02;
-    rids[0].dwFlags = RIDEV_INPUTSINK | RIDEV_NOLEGACY;
-    rids[0].hwndTarget = hwnd;
-    rids[1].usUsagePage = 0x01;
-    rids[1].usUsage = 0x06;
-    rids[1].dwFlags = RIDEV_INPUTSINK | RIDEV_NOLEGACY;
-    rids[1].hwndTarget = hwnd;
-    return RegisterRawInputDevices(rids, 2, sizeof(RAWINPUTDEVICE)) == TRUE;
+    if (screen.cols < roiW || screen.rows < roiH)
+        return false;
+    int x = markerCenter.x - roiW / 2;
+    int y = markerCenter.y + templH / 2 + 2; // just below the marker bottom edge
+    x = std::max(0, std::min(screen.cols - roiW, x));
+    y = std::max(0, std::min(screen.rows - roiH, y));
+    screen(cv::Rect(x, y, roiW, roiH)).copyTo(out);
+    return true;
 }
 
-static LRESULT CALLBACK SinkProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+// ========================= Template Bank =========================
+
+// What to precompute when a template enters the bank
+struct BankOptions
 {
-    switch (msg)
+    std::vector<double> scales;    // extra pre-scaled variants (1.0 is always the original)
+    int interp = cv::INTER_LINEAR; // interpolation used for the scaled variants
+    bool gray = false;             // single-channel copy
+    bool edges = false;            // Canny edge map (implies gray)
+    bool dft = false;              // cache DFT spectra so large matches skip template transforms
+};
+
+// Cached DFT of a zero-mean template for one padded transform size
+struct TemplateSpectrum
+{
+    cv::Size dftSize;
+    std::vector<cv::Mat> spec; // one CCS-packed spectrum per channel
+    double norm = 0;           // sqrt(sum over channels of sum (T - mean)^2)
+};
+
+// Immutable after construction except the lazily grown spectrum cache.
+// Shared by the detector, cursor detect and quest walk through shared_ptr.
+struct BankTemplate
+{
+    std::string path;
+    cv::Mat bgr;
+    MatchSpace space = SPACE_BGR; // from the .match sidecar
+    cv::Mat img;                  // bgr in space: what every matcher uses
+    double th = -1;               // calibrated threshold for space; < 0 = the caller's
+    std::vector<double> scales;
+    std::vector<cv::Mat> scaled; // parallel to scales, in space
+    cv::Mat gray, edges;
+    BankOptions opts;
+
+    double threshold(double fallback) const { return th >= 0 ? th : fallback; }
+
+    // Pre-scaled variant, or nullptr if that scale was not requested at load
+    const cv::Mat *variant(double scale) const
     {
-    case WM_INPUT:
+        if (std::fabs(scale - 1.0) < 1e-6)
+            return &img;
+        for (size_t i = 0; i < scales.size(); ++i)
+            if (std::fabs(scales[i] - scale) < 1e-6)
+                return &scaled[i];
+        return nullptr;
+    }
+
+    std::shared_ptr<const TemplateSpectrum> spectrum(cv::Size dftSize) const
     {
-        if (!gRecording)
-            break;
-        UINT size = 0;
-        GetRawInputData((HRAWINPUT)lParam, RID_INPUT, nullptr, &size, sizeof(RAWINPUTHEADER));
-        if (!size)
-            break;
-        if (gRawBuf.size() < size)
-            gRawBuf.resize(size);
-        if (GetRawInputData((HRAWINPUT)lParam, RID_INPUT,
-                            gRawBuf.data(), &size, sizeof(RAWINPUTHEADER)) != size)
-            break;
+        std::lock_guard<std::mutex> lk(specMu_);
+        for (const auto &sp : spectra_)
+            if (sp->dftSize == dftSize)
+                return sp;
+        auto sp = std::make_shared<TemplateSpectrum>();
+        sp->dftSize = dftSize;
+        cv::Mat f;
+        img.convertTo(f, CV_32F);
+        std::vector<cv::Mat> planes;
+        cv::split(f, planes);
+        double sq = 0;
+        for (auto &pl : planes)
+        {
+            cv::Scalar m = cv::mean(pl);
+            cv::subtract(pl, m, pl);
+            double n = cv::norm(pl);
+            sq += n * n;
+            cv::Mat padded = cv::Mat::zeros(dftSize, CV_32F);
+            pl.copyTo(padded(cv::Rect(0, 0, pl.cols, pl.rows)));
+            cv::Mat s;
+            cv::dft(padded, s, 0, pl.rows);
+            sp->spec.push_back(s);
+        }
+        sp->norm = std::sqrt(sq);
+        spectra_.push_back(sp);
+        return sp;
+    }
+
+    // Device copy of bgr or one of its scaled variants for the OpenCL backend,
+    // uploaded on first use and then shared by every matching thread
+    const cv::UMat &device(const cv::Mat &variant) const
+    {
+        std::lock_guard<std::mutex> lk(specMu_);
+        for (const auto &d : device_)
+            if (d.first == variant.data)
+                return d.second;
+        cv::UMat &u = device_.emplace_back(variant.data, cv::UMat()).second;
+        variant.copyTo(u);
+        return u;
+    }
+
+private:
+    mutable std::mutex specMu_;
+    mutable std::vector<std::shared_ptr<const TemplateSpectrum>> spectra_;
+    mutable std::deque<std::pair<const uchar *, cv::UMat>> device_; // deque: handed-out refs stay valid
+};
+
+// Per-thread buffers for match_template_dft
+struct DftScratch
+{
+    cv::Mat channel, plane, spec, prod, acc, corr, sum, sqsum;
+};
 
-        RAWINPUT *raw = reinterpret_cast<RAWINPUT *>(gRawBuf.data());
+static cv::Size dft_size_for(cv::Size img)
+{
+    return cv::Size(cv::getOptimalDFTSize(img.width), cv::getOptimalDFTSize(img.height));
+}
+
+// TM_CCOEFF_NORMED using the template's cached spectrum: per frame only the image
+// channels are transformed, products are summed in the frequency domain and one
+// inverse DFT gives the correlation. Normalisation uses integral images, the same
+// multi-channel formula matchTemplate uses.
+static void match_template_dft(const cv::Mat &img, const BankTemplate &t, cv::Mat &result, DftScratch &sc)
+{
+    const int w = t.img.cols, h = t.img.rows, cn = img.channels();
+    const int rw = img.cols - w + 1, rh = img.rows - h + 1;
+    if (rw <= 0 || rh <= 0 || cn != t.img.channels())
+    {
+        result.release();
+        return;
+    }
+    const cv::Size ds = dft_size_for(img.size());
+    auto sp = t.spectrum(ds);
 
-        if (raw->header.dwType == RIM_TYPEMOUSE)
+    if (sc.plane.rows != ds.height || sc.plane.cols != ds.width)
+        sc.plane = cv::Mat::zeros(ds, CV_32F);
+    cv::Mat planeRoi = sc.plane(cv::Rect(0, 0, img.cols, img.rows));
+    for (int c = 0; c < cn; ++c)
+    {
+        cv::extractChannel(img, sc.channel, c);
+        sc.channel.convertTo(planeRoi, CV_32F);
+        cv::dft(sc.plane, sc.spec, 0, img.rows);
+        if (c == 0)
+            cv::mulSpectrums(sc.spec, sp->spec[c], sc.acc, 0, true);
+        else
         {
-            const RAWMOUSE &m = raw->data.mouse;
-            gAbsByAlt = ((GetAsyncKeyState(VK_MENU) & 0x8000) != 0);
-            bool absMode = gAbsByAlt.load() || gAbsByCursor.load();
+            cv::mulSpectrums(sc.spec, sp->spec[c], sc.prod, 0, true);
+            cv::add(sc.acc, sc.prod, sc.acc);
+        }
+    }
+    cv::dft(sc.acc, sc.corr, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, rh);
 
-            if ((m.usFlags & MOUSE_MOVE_ABSOLUTE) == 0)
-            {
-                LONG dx = m.lLastX, dy = m.lLastY;
-                if (dx != 0 || dy != 0)
-                {
-                    gLastDx = dx;
-                    gLastDy = dy;
-                    if (!absMode)
-                        write_event(EV_MOUSE_MOVE, (int32_t)dx, (int32_t)dy, 0);
-                    update_overlay_state_on_mouse();
-                }
-            }
-            if (m.usButtonFlags & RI_MOUSE_WHEEL)
-            {
-                SHORT wd = *reinterpret_cast<const SHORT *>(&m.usButtonData);
-                gLastWheel = (int)wd;
-                write_event(EV_MOUSE_WHEEL, (int32_t)wd, 0, 0);
-                update_overlay_state_on_mouse();
-            }
-            auto log_btn = [&](int btn, bool down)
-            {
-                if (btn >= 1 && btn <= 5)
-                    gMouseBtn[btn] = down;
-                write_event(EV_MOUSE_BUTTON, (int32_t)btn, down ? 1 : 0, 0);
-                update_overlay_state_on_mouse();
-            };
-            if (m.usButtonFlags & RI_MOUSE_LEFT_BUTTON_DOWN)
-                log_btn(1, true);
-            if (m.usButtonFlags & RI_MOUSE_LEFT_BUTTON_UP)
-                log_btn(1, false);
-            if (m.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_DOWN)
-                log_btn(2, true);
-            if (m.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_UP)
-                log_btn(2, false);
-            if (m.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_DOWN)
-                log_btn(3, true);
-            if (m.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_UP)
-                log_btn(3, false);
-            if (m.usButtonFlags & RI_MOUSE_BUTTON_4_DOWN)
-                log_btn(4, true);
-            if (m.usButtonFlags & RI_MOUSE_BUTTON_4_UP)
-                log_btn(4, false);
-            if (m.usButtonFlags & RI_MOUSE_BUTTON_5_DOWN)
-                log_btn(5, true);
-            if (m.usButtonFlags & RI_MOUSE_BUTTON_5_UP)
-                log_btn(5, false);
-        }
-        else if (raw->header.dwType == RIM_TYPEKEYBOARD)
-        {
-            const RAWKEYBOARD &kb = raw->data.keyboard;
-            bool isBreak = (kb.Flags & RI_KEY_BREAK) != 0;
-            UINT vk = kb.VKey;
-            if (vk == 255)
-                break;
-            gAbsByAlt = ((GetAsyncKeyState(VK_MENU) & 0x8000) != 0);
-            if (!isBreak && vk == VK_ESCAPE)
-            {
-                PostMessage(hwnd, WM_CLOSE, 0, 0);
-                break;
-            }
-            if (isBreak)
-            {
-                write_event(EV_KEY_UP, (int32_t)vk, 0, 0);
-                update_overlay_state_on_key(vk, false);
-            }
-            else
+    cv::integral(img, sc.sum, sc.sqsum, CV_64F, CV_64F);
+    result.create(rh, rw, CV_32F);
+    const double invN = 1.0 / ((double)w * h);
+    for (int y = 0; y < rh; ++y)
+    {
+        const double *s0 = sc.sum.ptr<double>(y), *s1 = sc.sum.ptr<double>(y + h);
+        const double *q0 = sc.sqsum.ptr<double>(y), *q1 = sc.sqsum.ptr<double>(y + h);
+        const float *corr = sc.corr.ptr<float>(y);
+        float *r = result.ptr<float>(y);
+        for (int x = 0; x < rw; ++x)
+        {
+            const int a = x * cn, b = (x + w) * cn;
+            double var = 0;
+            for (int c = 0; c < cn; ++c)
             {
-                write_event(EV_KEY_DOWN, (int32_t)vk, 0, 0);
-                update_overlay_state_on_key(vk, true);
+                double S = s1[b + c] - s1[a + c] - s0[b + c] + s0[a + c];
+                double Q = q1[b + c] - q1[a + c] - q0[b + c] + q0[a + c];
+                var += Q - S * S * invN;
             }
+            double denom = std::sqrt(std::max(var, 0.0)) * sp->norm;
+            r[x] = denom > 1e-6 ? (float)std::clamp(corr[x] / denom, -1.0, 1.0) : 0.f;
         }
-        break;
     }
-    case WM_CLOSE:
-        DestroyWindow(hwnd);
-        return 0;
-    case WM_DESTROY:
-        PostQuitMessage(0);
-        return 0;
+}
+
+// TM_CCOEFF_NORMED of a bank template, via the cached spectrum when it has one
+static void match_bank_template(const cv::Mat &img, const BankTemplate &t, cv::Mat &result, DftScratch &sc)
+{
+    if (t.opts.dft)
+        match_template_dft(img, t, result, sc);
+    else
+        cv::matchTemplate(img, t.img, result, cv::TM_CCOEFF_NORMED);
+}
+
+// <template>.match next to the image, written by bench calibrate:
+//   space=gray th=0.712
+// The threshold is optional; without it the caller's threshold applies.
+static bool read_match_sidecar(const std::string &path, MatchSpace &space, double &th)
+{
+    FILE *f = std::fopen((path + ".match").c_str(), "r");
+    if (!f)
+        return false;
+    char name[16] = {};
+    double v = -1;
+    int n = std::fscanf(f, "space=%15s th=%lf", name, &v);
+    std::fclose(f);
+    MatchSpace sp;
+    if (n < 1 || !parse_space(name, sp))
+    {
+        std::fprintf(stderr, "[BANK] Ignoring malformed %s.match\n", path.c_str());
+        return false;
     }
-    return DefWindowProc(hwnd, msg, wParam, lParam);
+    space = sp;
+    th = (n == 2) ? v : -1;
+    return true;
 }
 
-static bool create_sink_window()
+// ========================= GPU Backend =========================
+
+// --gpu=opencl routes matchTemplate through OpenCV's transparent API. Bank
+// templates stay on the device (BankTemplate::device), every scan uploads its
+// frame once and keeps result maps there, so only peak scores come back; the
+// marker search downloads its result map for the NMS walk. Small windowed
+// matches (marker tracking, peak refine) follow the frame they refine.
+
+// A failing kernel (device reset, driver crash) switches the backend off for
+// the rest of the session; the caller redoes that piece of work on the CPU.
+static void gpu_disable(const cv::Exception &e)
 {
-    WNDCLASSA wc{};
-    wc.lpfnWndProc = SinkProc;
-    wc.hInstance = GetModuleHandle(nullptr);
-    wc.lpszClassName = kSinkClassName;
-    if (!RegisterClassA(&wc))
+    if (gGpuMatch.exchange(false))
+        std::fprintf(stderr, "[GPU] OpenCL error, falling back to CPU matching: %s\n", e.what());
+}
+
+static void init_gpu_backend()
+{
+    if (!gGpuMatch)
+        return;
+    auto fallback = [](const char *why)
     {
-        DWORD e = GetLastError();
-        if (e != ERROR_CLASS_ALREADY_EXISTS)
+        gGpuMatch = false;
+        std::fprintf(stderr, "[GPU] %s - matching on the CPU.\n", why);
+    };
+    if (!cv::ocl::haveOpenCL())
+        return fallback("No OpenCL runtime");
+    cv::ocl::setUseOpenCL(true);
+    const cv::ocl::Device &dev = cv::ocl::Device::getDefault();
+    if (!cv::ocl::useOpenCL() || !dev.available())
+        return fallback("No OpenCL device");
+    // Compiles the match kernels now and catches broken drivers before any scan
+    try
+    {
+        cv::UMat img, templ, result;
+        cv::Mat::zeros(64, 64, CV_8UC3).copyTo(img);
+        cv::Mat::zeros(8, 8, CV_8UC3).copyTo(templ);
+        cv::matchTemplate(img, templ, result, cv::TM_CCOEFF_NORMED);
+        cv::ocl::finish();
+    }
+    catch (const cv::Exception &e)
+    {
+        std::fprintf(stderr, "[GPU] Probe match failed: %s\n", e.what());
+        return fallback("OpenCL unusable");
+    }
+    std::printf("[GPU] OpenCL matching on %s (%s)\n", dev.name().c_str(), dev.vendorName().c_str());
+}
+
+// Best TM_CCOEFF_NORMED score of templ over an image already on the device
+static double gpu_match_max(const cv::UMat &img, const cv::UMat &templ, cv::UMat &result, cv::Point *loc = nullptr)
+{
+    cv::matchTemplate(img, templ, result, cv::TM_CCOEFF_NORMED);
+    double mn = 0, mx = 0;
+    cv::Point mnL, mxL;
+    cv::minMaxLoc(result, &mn, &mx, &mnL, &mxL);
+    if (loc)
+        *loc = mxL;
+    return mx;
+}
+
+// Loads each template file once; later loads of the same path reuse the entry
+// (hunt restarts on SHIFT no longer re-read and re-scale every PNG).
+class TemplateBank
+{
+public:
+    std::shared_ptr<const BankTemplate> load(const std::string &path, const BankOptions &opts)
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        BankOptions want = opts;
+        for (auto &e : entries_)
         {
-            std::fprintf(stderr, "RegisterClassA sink failed (%lu)\n", e);
+            if (e->path != path)
+                continue;
+            if (covers(e->opts, opts))
+                return e;
+            want = merge(e->opts, opts); // rebuild with the union; old holders keep theirs
+            break;
+        }
+        cv::Mat img = cv::imread(path, cv::IMREAD_COLOR);
+        if (img.empty())
+            return nullptr;
+        auto t = build(path, img, want);
+        for (auto &e : entries_)
+            if (e->path == path)
+            {
+                e = t;
+                return t;
+            }
+        entries_.push_back(t);
+        return t;
+    }
+
+private:
+    static bool covers(const BankOptions &have, const BankOptions &want)
+    {
+        if ((want.gray && !have.gray) || (want.edges && !have.edges) || (want.dft && !have.dft))
             return false;
+        for (double s : want.scales)
+            if (std::none_of(have.scales.begin(), have.scales.end(),
+                             [&](double h)
+                             { return std::fabs(h - s) < 1e-6; }))
+                return false;
+        return true;
+    }
+
+    static BankOptions merge(const BankOptions &a, const BankOptions &b)
+    {
+        BankOptions m = a;
+        m.gray = a.gray || b.gray;
+        m.edges = a.edges || b.edges;
+        m.dft = a.dft || b.dft;
+        for (double s : b.scales)
+            if (!covers(m, BankOptions{{s}}))
+                m.scales.push_back(s);
+        return m;
+    }
+
+    static std::shared_ptr<BankTemplate> build(const std::string &path, const cv::Mat &img, const BankOptions &opts)
+    {
+        auto t = std::make_shared<BankTemplate>();
+        t->path = path;
+        t->bgr = img;
+        t->opts = opts;
+        if (read_match_sidecar(path, t->space, t->th) && t->space == SPACE_HUE && hue_wraps(img))
+        {
+            std::fprintf(stderr, "[BANK] %s: hue spans the 0/179 wrap; matched in BGR instead\n", path.c_str());
+            t->space = SPACE_BGR;
+            t->th = -1;
+        }
+        if (t->space != SPACE_BGR)
+        {
+            gFrameSpaces.fetch_or(1u << t->space);
+            if (t->th < 0)
+                std::fprintf(stderr, "[BANK] %s: %s match without a calibrated th; BGR threshold used\n",
+                             path.c_str(), kSpaceNames[t->space]);
         }
+        cv::Mat hsv;
+        convert_to_space(img, t->space, t->img, hsv);
+        for (double s : opts.scales)
+        {
+            if (std::fabs(s - 1.0) < 1e-6)
+                continue;
+            cv::Mat v;
+            int w = (int)std::lround(img.cols * s), h = (int)std::lround(img.rows * s);
+            if (w >= 1 && h >= 1)
+                cv::resize(t->img, v, cv::Size(w, h), 0, 0, opts.interp);
+            t->scales.push_back(s);
+            t->scaled.push_back(v);
+        }
+        if (opts.gray || opts.edges)
+            cv::cvtColor(img, t->gray, cv::COLOR_BGR2GRAY);
+        if (opts.edges)
+            cv::Canny(t->gray, t->edges, 50, 150);
+        if (opts.dft)
+        {
+            // Warm the cache for full capture frames: the primary monitor is the
+            // likely game output, the virtual screen with --capture=virtual
+            bool virt = gCaptureScope == CAPTURE_VIRTUAL;
+            int vw = GetSystemMetrics(virt ? SM_CXVIRTUALSCREEN : SM_CXSCREEN);
+            int vh = GetSystemMetrics(virt ? SM_CYVIRTUALSCREEN : SM_CYSCREEN);
+            if (vw >= img.cols && vh >= img.rows)
+                t->spectrum(dft_size_for(cv::Size(vw, vh)));
+        }
+        return t;
     }
-    gSinkHwnd = CreateWindowExA(0, kSinkClassName, "RawIO_Sink",
-                                WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, 100, 100,
-                                nullptr, nullptr, GetModuleHandle(nullptr), nullptr);
-    if (!gSinkHwnd)
+
+    std::mutex mu_;
+    std::vector<std::shared_ptr<BankTemplate>> entries_;
+};
+
+static TemplateBank gBank;
+
+// ========================= Worker pool =========================
+
+// Fixed fork-join pool. run() hands out task indices through an atomic counter;
+// the calling thread participates as slot 0, workers use slots 1..size()-1, so
+// callers can keep per-slot scratch without locking.
+class WorkerPool
+{
+public:
+    ~WorkerPool() { stop(); }
+
+    void start(int threads)
     {
-        std::fprintf(stderr, "CreateWindowExA sink failed (%lu)\n", GetLastError());
-        return false;
+        stop();
+        stop_ = false;
+        for (int i = 1; i < threads; ++i)
+            workers_.emplace_back([this, i]()
+                                  { workerLoop(i); });
     }
-    ShowWindow(gSinkHwnd, SW_HIDE);
-    if (!register_raw(gSinkHwnd))
+
+    void stop()
     {
-        std::fprintf(stderr, "RegisterRawInputDevices failed (%lu)\n", GetLastError());
-        return false;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        wakeCv_.notify_all();
+        for (auto &t : workers_)
+            if (t.joinable())
+                t.join();
+        workers_.clear();
     }
-    return true;
-}
 
-static void destroy_sink_window()
+    int size() const { return (int)workers_.size() + 1; }
+
+    // Runs fn(task, slot) for every task in [0, n) and blocks until all are done.
+    // fn is only borrowed for the call, so no std::function (and no heap
+    // block for a large capture) is built per scan.
+    template <class Fn>
+    void run(int n, const Fn &fn)
+    {
+        if (workers_.empty() || n <= 1)
+        {
+            for (int t = 0; t < n; ++t)
+                fn(t, 0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            job_ = &fn;
+            call_ = [](const void *f, int task, int slot)
+            { (*static_cast<const Fn *>(f))(task, slot); };
+            jobN_ = n;
+            next_ = 0;
+            ++batch_;
+        }
+        wakeCv_.notify_all();
+        drain(0);
+        std::unique_lock<std::mutex> lk(mu_);
+        doneCv_.wait(lk, [&]()
+                     { return active_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void drain(int slot)
+    {
+        for (int t; (t = next_.fetch_add(1)) < jobN_.load();)
+        {
+            try
+            {
+                call_(job_, t, slot);
+            }
+            catch (const std::exception &e)
+            {
+                std::fprintf(stderr, "[POOL] task %d failed: %s\n", t, e.what());
+            }
+        }
+    }
+
+    void workerLoop(int slot)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;)
+        {
+            wakeCv_.wait(lk, [&]()
+                         { return stop_ || batch_ != seen; });
+            if (stop_)
+                return;
+            seen = batch_;
+            if (!job_)
+                continue;
+            ++active_;
+            lk.unlock();
+            drain(slot);
+            lk.lock();
+            if (--active_ == 0)
+                doneCv_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mu_;
+    std::condition_variable wakeCv_, doneCv_;
+    const void *job_ = nullptr;
+    void (*call_)(const void *, int, int) = nullptr;
+    std::atomic<int> jobN_{0};
+    std::atomic<int> next_{0};
+    uint64_t batch_ = 0;
+    int active_ = 0;
+    bool stop_ = false;
+};
+
+// ========================= Mailbox =========================
+
+// Single-slot latest-value channel between pipeline stages. post()
+// overwrites a value the consumer hasn't taken yet, so a slow stage always
+// works on the newest input instead of building a backlog.
+template <class T>
+class Mailbox
 {
-    if (gSinkHwnd)
+public:
+    void post(const T &v)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (full_)
+                ++overwritten_;
+            value_ = v;
+            full_ = true;
+            ++seq_;
+        }
+        cv_.notify_one();
+    }
+
+    // Wait for a value that hasn't been taken yet; false once closed.
+    bool take(T &out)
     {
-        DestroyWindow(gSinkHwnd);
-        gSinkHwnd = nullptr;
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&]
+                 { return full_ || closed_; });
+        if (!full_)
+            return false;
+        out = value_;
+        full_ = false;
+        return true;
     }
-}
 
-// ========================= Screen Capture =========================
+    // Latest value without consuming it; seq counts posts so callers can
+    // tell a fresh value from one they have already seen.
+    bool peek(T &out, uint64_t &seq) const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!seq_)
+            return false;
+        out = value_;
+        seq = seq_;
+        return true;
+    }
 
-static cv::Mat capture_screen_full()
-{
-    const int vx = GetSystemMetrics(SM_XVIRTUALSCREEN), vy = GetSystemMetrics(SM_YVIRTUALSCREEN);
-    const int vw = GetSystemMetrics(SM_CXVIRTUALSCREEN), vh = GetSystemMetrics(SM_CYVIRTUALSCREEN);
-    HDC hScreen = GetDC(NULL), hDC = CreateCompatibleDC(hScreen);
-    HBITMAP hBmp = CreateCompatibleBitmap(hScreen, vw, vh);
-    HGDIOBJ old = SelectObject(hDC, hBmp);
-    BitBlt(hDC, 0, 0, vw, vh, hScreen, vx, vy, SRCCOPY | CAPTUREBLT);
-    BITMAPINFOHEADER bi{};
-    bi.biSize = sizeof(bi);
-    bi.biWidth = vw;
-    bi.biHeight = -vh;
-    bi.biPlanes = 1;
-    bi.biBitCount = 32;
-    bi.biCompression = BI_RGB;
-    cv::Mat bgra(vh, vw, CV_8UC4);
-    GetDIBits(hDC, hBmp, 0, vh, bgra.data, (BITMAPINFO *)&bi, DIB_RGB_COLORS);
-    SelectObject(hDC, old);
-    DeleteObject(hBmp);
-    DeleteDC(hDC);
-    ReleaseDC(NULL, hScreen);
-    cv::Mat bgr;
-    cv::cvtColor(bgra, bgr, cv::COLOR_BGRA2BGR);
-    return bgr;
-}
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
 
-static cv::Mat capture_roi_around_cursor(int halfSize)
-{
-    POINT pt{};
-    if (!GetCursorPos(&pt))
-        return cv::Mat();
-    int w = halfSize * 2, h = halfSize * 2, x0 = pt.x - halfSize, y0 = pt.y - halfSize;
-    HDC hScreen = GetDC(NULL), hDC = CreateCompatibleDC(hScreen);
-    HBITMAP hBmp = CreateCompatibleBitmap(hScreen, w, h);
-    HGDIOBJ old = SelectObject(hDC, hBmp);
-    BitBlt(hDC, 0, 0, w, h, hScreen, x0, y0, SRCCOPY | CAPTUREBLT);
-    BITMAPINFOHEADER bi{};
-    bi.biSize = sizeof(bi);
-    bi.biWidth = w;
-    bi.biHeight = -h;
-    bi.biPlanes = 1;
-    bi.biBitCount = 32;
-    bi.biCompression = BI_RGB;
-    cv::Mat bgra(h, w, CV_8UC4);
-    GetDIBits(hDC, hBmp, 0, h, bgra.data, (BITMAPINFO *)&bi, DIB_RGB_COLORS);
-    SelectObject(hDC, old);
-    DeleteObject(hBmp);
-    DeleteDC(hDC);
-    ReleaseDC(NULL, hScreen);
-    cv::Mat bgr;
-    cv::cvtColor(bgra, bgr, cv::COLOR_BGRA2BGR);
-    return bgr;
-}
+    uint64_t overwritten() const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        return overwritten_;
+    }
 
-// Crop the distance label area below a detected quest marker
-// markerCenter = center pixel of the matched template on screen
-// templH       = height of the quest marker template (pixels)
-static cv::Mat crop_distance_label(const cv::Mat &screen, cv::Point markerCenter,
-                                   int templH, int roiW = 80, int roiH = 28)
-{
-    int x = markerCenter.x - roiW / 2;
-    int y = markerCenter.y + templH / 2 + 2; // just below the marker bottom edge
-    x = std::max(0, std::min(screen.cols - roiW, x));
-    y = std::max(0, std::min(screen.rows - roiH, y));
-    return screen(cv::Rect(x, y, roiW, roiH)).clone();
-}
+private:
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    T value_{};
+    bool full_ = false;
+    bool closed_ = false;
+    uint64_t seq_ = 0;
+    uint64_t overwritten_ = 0;
+};
 
 // ========================= Template Detector =========================
 
@@ -844,6 +4880,7 @@ public:
     bool loadEnemyTemplates(const std::string &path)
     {
         enemies_.clear();
+        enemyBank_.clear();
         enemyNames_.clear();
         DWORD attr = GetFileAttributesA(path.c_str());
         if (attr == INVALID_FILE_ATTRIBUTES)
@@ -852,49 +4889,153 @@ public:
             return false;
         }
         if (attr & FILE_ATTRIBUTE_DIRECTORY)
-            return loadFolder(path);
-        Mat img = imread(path, IMREAD_COLOR);
-        if (img.empty())
+        {
+            bool ok = loadFolder(path);
+            rebuildCoarse();
+            return ok;
+        }
+        auto t = gBank.load(path, enemy_bank_options());
+        if (!t)
         {
             std::fprintf(stderr, "Failed to load: %s\n", path.c_str());
             return false;
         }
-        enemies_.push_back(img);
-        enemyNames_.push_back(path);
-        std::printf("Loaded enemy: %s (%dx%d)\n", path.c_str(), img.cols, img.rows);
+        addEnemy(t, path);
+        rebuildCoarse();
+        std::printf("Loaded enemy: %s (%dx%d)\n", path.c_str(), t->bgr.cols, t->bgr.rows);
         return true;
     }
 
     bool loadBattleStartTemplate(const std::string &file)
     {
-        battle_ = imread(file, IMREAD_COLOR);
-        if (battle_.empty())
+        // Large banner: cache its spectrum so each scan only transforms the frame
+        BankOptions opts;
+        opts.dft = true;
+        battle_ = gBank.load(file, opts);
+        if (!battle_)
         {
             std::fprintf(stderr, "Failed to load battle: %s\n", file.c_str());
             return false;
         }
-        std::printf("Loaded battle-start: %dx%d\n", battle_.cols, battle_.rows);
+        std::printf("Loaded battle-start: %dx%d\n", battle_->bgr.cols, battle_->bgr.rows);
         return true;
     }
 
     void setEnemyThreshold(double t) { enemyTh_ = t; }
     void setBattleThreshold(double t) { battleTh_ = t; }
 
-    bool isBattleStart(const Mat &screen, double *outConf = nullptr) const
+    bool isBattleStart(const FramePlanes &frame, double *outConf = nullptr) const
     {
-        if (battle_.empty() || battle_.cols > screen.cols || battle_.rows > screen.rows)
+        if (!battle_)
             return false;
-        Mat result;
-        matchTemplate(screen, battle_, result, TM_CCOEFF_NORMED);
+        const Mat &full = plane_for(frame, battle_->space, own_[battle_->space], hsv_);
+        battleView_ = full(battleArea(full.size()));
+        const Mat &screen = battleView_;
+        const double th = battle_->threshold(battleTh_);
+        if (battle_->img.cols > screen.cols || battle_->img.rows > screen.rows)
+            return false;
+        if (gGpuMatch)
+        {
+            try
+            {
+                screen.copyTo(gpuFrame_);
+                double maxVal = gpu_match_max(gpuFrame_, battle_->device(battle_->img), gpuBattle_);
+                if (outConf)
+                    *outConf = maxVal;
+                return maxVal >= th;
+            }
+            catch (const cv::Exception &e)
+            {
+                gpu_disable(e);
+            }
+        }
+        Mat &result = battleResult_;
+        match_bank_template(screen, *battle_, result, battleScratch_);
         double minVal = 0, maxVal = 0;
         Point minLoc, maxLoc;
         minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc);
         if (outConf)
             *outConf = maxVal;
-        return maxVal >= battleTh_;
+        return maxVal >= th;
+    }
+
+    // Coarse-to-fine: 1 = full resolution only, 2 or 4 = match on a 1/N frame first
+    void setPyramid(int factor)
+    {
+        pyramid_ = (factor >= 4) ? 4 : (factor >= 2 ? 2 : 1);
+        rebuildCoarse();
+    }
+    // Search only inside roi (screen coords); empty rect = whole screen
+    void setSearchRoi(const cv::Rect &roi) { roi_ = roi; }
+    // The banner appears at a fixed place: match it only inside roi
+    void setBattleRoi(const cv::Rect &roi) { battleRoi_ = roi; }
+
+    // Frame areas the two searches read, for change gating by the caller
+    cv::Rect battleArea(cv::Size frame) const
+    {
+        cv::Rect a = battleRoi_ & cv::Rect(0, 0, frame.width, frame.height);
+        if (!battle_ || a.width < battle_->img.cols || a.height < battle_->img.rows)
+            return cv::Rect(0, 0, frame.width, frame.height); // unset, or too small for the banner
+        return a;
+    }
+    cv::Rect enemyArea(cv::Size frame) const
+    {
+        cv::Rect a(0, 0, frame.width, frame.height);
+        if (roi_.area() > 0)
+            a &= roi_;
+        return a;
+    }
+    cv::Size maxEnemySize() const
+    {
+        cv::Size s;
+        for (const auto &t : enemies_)
+            s = cv::Size(std::max(s.width, t.cols), std::max(s.height, t.rows));
+        return s;
+    }
+    cv::Size enemySize(int idx) const
+    {
+        return (idx >= 0 && idx < (int)enemies_.size()) ? enemies_[idx].size() : cv::Size();
+    }
+    double enemyThreshold(int idx) const { return enemyTh(idx); }
+    // Ignore matches whose centre falls inside any of these rects (HUD, quest log)
+    void setExcludeRects(const std::vector<cv::Rect> &rects) { exclude_ = rects; }
+
+    struct ScanTiming
+    {
+        double totalMs = 0, coarseMs = 0, refineMs = 0;
+        int candidates = 0;
+    };
+    const ScanTiming &lastTiming() const { return last_; }
+    void resetTiming()
+    {
+        scans_ = 0;
+        sumMs_ = maxMs_ = 0;
+    }
+
+    void printTimingSummary(const char *tag) const
+    {
+        if (scans_ == 0)
+            return;
+        std::printf("%s scans=%llu avg=%.2fms max=%.2fms (%s pyramid=%d templates=%zu threads=%d roi=%dx%d)\n",
+                    tag, (unsigned long long)scans_, sumMs_ / (double)scans_, maxMs_,
+                    gGpuMatch ? "opencl" : "cpu", pyramid_, enemies_.size(), pool_.size(), lastRoiSize_.width, lastRoiSize_.height);
+    }
+
+    // Match work is spread across a fixed pool: one task per (template, screen band).
+    // threads <= 1 keeps everything on the hunt thread.
+    void setWorkerThreads(int threads)
+    {
+        threads = std::clamp(threads, 1, 64);
+        if (threads != pool_.size())
+            pool_.start(threads);
+        scratch_.resize(pool_.size());
     }
+    int workerThreads() const { return pool_.size(); }
 
-    Point findEnemy(const Mat &screen, double *outConf = nullptr, int *outIdx = nullptr) const
+    // Templates in different spaces compete on score minus their own threshold.
+    // limit (frame coords) narrows the search further, e.g. to changed areas.
+    Point findEnemy(const FramePlanes &frame, double *outConf = nullptr, int *outIdx = nullptr,
+                    const cv::Rect &limit = cv::Rect()) const
     {
         if (enemies_.empty())
         {
@@ -904,31 +5045,136 @@ public:
                 *outIdx = -1;
             return Point(-1, -1);
         }
+        auto t0 = std::chrono::steady_clock::now();
+        last_ = ScanTiming{};
+
+        const Mat &screen = frame[SPACE_BGR];
+        cv::Rect area(0, 0, screen.cols, screen.rows);
+        if (roi_.area() > 0)
+            area &= roi_;
+        if (limit.area() > 0)
+            area &= limit;
+        if (area.area() <= 0)
+        {
+            if (outConf)
+                *outConf = -1;
+            if (outIdx)
+                *outIdx = -1;
+            return Point(-1, -1);
+        }
+        lastRoiSize_ = area.size();
+        const cv::Size coarseSize(area.width / pyramid_, area.height / pyramid_);
+        for (int sp = 0; sp < kSpaceCount; ++sp)
+            if (spacesUsed_ & (1u << sp))
+                views_[sp] = plane_for(frame, (MatchSpace)sp, own_[sp], hsv_)(area);
+
+        // OpenCL: one upload per space, the pyramid level is built on the device
+        bool gpu = false;
+        if (gGpuMatch && enemiesDev_.size() == enemies_.size())
+        {
+            try
+            {
+                for (int sp = 0; sp < kSpaceCount; ++sp)
+                    if (spacesUsed_ & (1u << sp))
+                    {
+                        views_[sp].copyTo(gpuViews_[sp]);
+                        if (pyramid_ > 1)
+                            cv::resize(gpuViews_[sp], gpuCoarse_[sp], coarseSize, 0, 0, cv::INTER_AREA);
+                    }
+                gpu = true;
+            }
+            catch (const cv::Exception &e)
+            {
+                gpu_disable(e);
+            }
+        }
+        if (pyramid_ > 1 && !gpu)
+            for (int sp = 0; sp < kSpaceCount; ++sp)
+                if (spacesUsed_ & (1u << sp))
+                    cv::resize(views_[sp], coarseViews_[sp], coarseSize, 0, 0, cv::INTER_AREA);
+        double resizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+        // Split the screen into bands only when there are fewer templates than workers
+        const int nTempl = (int)enemies_.size();
+        const int workers = pool_.size();
+        int nBands = 1;
+        if (!gpu && workers > nTempl)
+            nBands = std::clamp((workers + nTempl - 1) / nTempl, 1, std::max(1, area.height / kMinBandRows));
+        const int nTasks = nTempl * nBands;
+        tasks_.assign(nTasks, TaskOut{});
+        if ((int)scratch_.size() < workers)
+            scratch_.resize(workers);
+
+        // Lock-free reduction: (ordered score bits << 32 | ~task) max via CAS
+        std::atomic<uint64_t> best{0};
+        auto runTask = [&](int task, int slot)
+        {
+            const int i = task / nBands, band = task % nBands;
+            const int y0 = area.height * band / nBands, y1 = area.height * (band + 1) / nBands;
+            const int sp = enemyBank_[i]->space;
+            const double th = enemyTh(i);
+            TaskOut &out = tasks_[task];
+            if (gpu)
+                matchTask(enemiesDev_[i], coarseDev_[i], th, y0, y1, gpuViews_[sp], gpuCoarse_[sp], area.tl(),
+                          gpuScratch_, out);
+            else
+                matchTask(enemies_[i], coarse_[i], th, y0, y1, views_[sp], coarseViews_[sp], area.tl(),
+                          scratch_[slot], out);
+            if (!out.valid)
+                return;
+            uint64_t key = score_key(out.score - th, task);
+            uint64_t cur = best.load(std::memory_order_relaxed);
+            while (key > cur && !best.compare_exchange_weak(cur, key, std::memory_order_relaxed))
+            {
+            }
+        };
+        if (gpu)
+        {
+            // The device queue serialises kernels anyway: run the tasks from this thread
+            try
+            {
+                for (int task = 0; task < nTasks; ++task)
+                    runTask(task, 0);
+            }
+            catch (const cv::Exception &e)
+            {
+                gpu_disable(e);
+                return findEnemy(frame, outConf, outIdx, limit);
+            }
+        }
+        else
+            pool_.run(nTasks, runTask);
+
         double bestScore = -1;
         Point bestLoc(-1, -1);
         int bestIdx = -1;
-        for (int i = 0; i < (int)enemies_.size(); ++i)
+        uint64_t key = best.load();
+        if (key != 0)
         {
-            const Mat &t = enemies_[i];
-            if (t.cols > screen.cols || t.rows > screen.rows)
-                continue;
-            Mat result;
-            matchTemplate(screen, t, result, TM_CCOEFF_NORMED);
-            double minVal = 0, maxVal = 0;
-            Point minLoc, maxLoc;
-            minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc);
-            if (maxVal > bestScore)
-            {
-                bestScore = maxVal;
-                bestLoc = maxLoc;
-                bestIdx = i;
-            }
+            int task = (int)(0xFFFFFFFFu - (uint32_t)(key & 0xFFFFFFFFu));
+            bestScore = tasks_[task].score;
+            bestLoc = tasks_[task].loc;
+            bestIdx = task / nBands;
+        }
+
+        // coarse/refine are CPU time summed over tasks; totalMs is wall time
+        last_.coarseMs = resizeMs;
+        for (const auto &t : tasks_)
+        {
+            last_.coarseMs += t.coarseMs;
+            last_.refineMs += t.refineMs;
+            last_.candidates += t.candidates;
         }
+        last_.totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        scans_++;
+        sumMs_ += last_.totalMs;
+        maxMs_ = std::max(maxMs_, last_.totalMs);
+
         if (outConf)
             *outConf = bestScore;
         if (outIdx)
             *outIdx = bestIdx;
-        if (bestIdx >= 0 && bestScore >= enemyTh_)
+        if (bestIdx >= 0 && bestScore >= enemyTh(bestIdx))
             return Point(bestLoc.x + enemies_[bestIdx].cols / 2, bestLoc.y + enemies_[bestIdx].rows / 2);
         return Point(-1, -1);
     }
@@ -938,6 +5184,7 @@ public:
         return (idx >= 0 && idx < (int)enemyNames_.size()) ? enemyNames_[idx].c_str() : "";
     }
 
+    // target in desktop coords: frame coords plus the frame's origin
     static void moveCursorTowards(const Point &target, int steps = 18, int stepMs = 6)
     {
         POINT pt{};
@@ -983,14 +5230,13 @@ private:
             if (!has_image_ext(name))
                 continue;
             std::string full = folder + "\\" + name;
-            Mat img = imread(full, IMREAD_COLOR);
-            if (img.empty())
+            auto t = gBank.load(full, enemy_bank_options());
+            if (!t)
             {
                 std::fprintf(stderr, "Failed: %s\n", full.c_str());
                 continue;
             }
-            enemies_.push_back(img);
-            enemyNames_.push_back(name);
+            addEnemy(t, name);
             ++count;
         } while (FindNextFileA(h, &data));
         FindClose(h);
@@ -998,46 +5244,281 @@ private:
         return count > 0;
     }
 
+    // M is cv::Mat on the CPU path, cv::UMat on the OpenCL one
+    template <class M>
+    struct MatchScratchT
+    {
+        M result, refine;
+    };
+    using MatchScratch = MatchScratchT<Mat>;
+    struct TaskOut
+    {
+        bool valid = false;
+        double score = -1;
+        Point loc{-1, -1}; // template top-left, screen coords
+        double coarseMs = 0, refineMs = 0;
+        int candidates = 0;
+    };
+
+    // Orders by score, then prefers the lower task index (same tie-break as a serial loop)
+    static uint64_t score_key(double score, int task)
+    {
+        float f = (float)score;
+        uint32_t bits = 0;
+        std::memcpy(&bits, &f, sizeof(bits));
+        bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+        return ((uint64_t)bits << 32) | (uint64_t)(0xFFFFFFFFu - (uint32_t)task);
+    }
+
+    // Best match of template t (tc = its coarse variant, may be empty) whose
+    // top-left row lies in [y0, y1) of view; th = that template's threshold
+    template <class M>
+    void matchTask(const M &t, const M &tc, double th, int y0, int y1, const M &view, const M &coarseView,
+                   cv::Point origin, MatchScratchT<M> &sc, TaskOut &out) const
+    {
+        if (t.cols > view.cols || t.rows > view.rows)
+            return;
+        auto consider = [&](double score, Point topLeftInView)
+        {
+            if (!out.valid || score > out.score)
+            {
+                out.valid = true;
+                out.score = score;
+                out.loc = Point(topLeftInView.x + origin.x, topLeftInView.y + origin.y);
+            }
+        };
+
+        const bool coarseOk = pyramid_ > 1 && !tc.empty() &&
+                              tc.cols <= coarseView.cols && tc.rows <= coarseView.rows;
+        auto a = std::chrono::steady_clock::now();
+        if (!coarseOk)
+        {
+            // Template too small to survive downscaling: plain full-resolution match
+            int rows = std::min(view.rows - y0, (y1 - y0) + t.rows - 1);
+            if (rows < t.rows)
+                return;
+            matchTemplate(view(cv::Rect(0, y0, view.cols, rows)), t, sc.result, TM_CCOEFF_NORMED);
+            mask_excluded(sc.result, t.size(), cv::Point(origin.x, origin.y + y0));
+            double minVal = 0, maxVal = 0;
+            Point minLoc, maxLoc;
+            minMaxLoc(sc.result, &minVal, &maxVal, &minLoc, &maxLoc);
+            consider(maxVal, Point(maxLoc.x, maxLoc.y + y0));
+            out.refineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - a).count();
+            return;
+        }
+
+        const int cy0 = y0 / pyramid_, cy1 = (y1 + pyramid_ - 1) / pyramid_;
+        int crows = std::min(coarseView.rows - cy0, (cy1 - cy0) + tc.rows - 1);
+        if (crows < tc.rows)
+            return;
+        matchTemplate(coarseView(cv::Rect(0, cy0, coarseView.cols, crows)), tc, sc.result, TM_CCOEFF_NORMED);
+        mask_excluded(sc.result, tc.size(), cv::Point(origin.x, origin.y + cy0 * pyramid_), pyramid_);
+        // Downscaled scores run lower than full-res ones; keep a wide margin
+        const double coarseTh = th - kCoarseMargin;
+        Point peaks[kCoarsePeaks];
+        int nPeaks = 0;
+        for (; nPeaks < kCoarsePeaks; ++nPeaks)
+        {
+            double minVal = 0, maxVal = 0;
+            Point minLoc, maxLoc;
+            minMaxLoc(sc.result, &minVal, &maxVal, &minLoc, &maxLoc);
+            // The best peak is always refined so outConf stays meaningful below threshold
+            if (nPeaks > 0 && maxVal < coarseTh)
+                break;
+            peaks[nPeaks] = Point(maxLoc.x, maxLoc.y + cy0);
+            int hw = std::max(1, tc.cols / 2), hh = std::max(1, tc.rows / 2);
+            cv::Rect clr = cv::Rect(maxLoc.x - hw, maxLoc.y - hh, hw * 2 + 1, hh * 2 + 1) &
+                           cv::Rect(0, 0, sc.result.cols, sc.result.rows);
+            sc.result(clr).setTo(cv::Scalar(-1));
+        }
+        auto b = std::chrono::steady_clock::now();
+        out.coarseMs = std::chrono::duration<double, std::milli>(b - a).count();
+
+        // Refine each peak in a small full-resolution window around its upscaled position
+        const int pad = pyramid_ * 2;
+        for (int k = 0; k < nPeaks; ++k)
+        {
+            cv::Rect win(peaks[k].x * pyramid_ - pad, peaks[k].y * pyramid_ - pad,
+                         t.cols + pad * 2, t.rows + pad * 2);
+            win &= cv::Rect(0, 0, view.cols, view.rows);
+            if (win.width < t.cols || win.height < t.rows)
+                continue;
+            matchTemplate(view(win), t, sc.refine, TM_CCOEFF_NORMED);
+            mask_excluded(sc.refine, t.size(), cv::Point(origin.x + win.x, origin.y + win.y));
+            double minVal = 0, maxVal = 0;
+            Point minLoc, maxLoc;
+            minMaxLoc(sc.refine, &minVal, &maxVal, &minLoc, &maxLoc);
+            consider(maxVal, Point(win.x + maxLoc.x, win.y + maxLoc.y));
+            out.candidates++;
+        }
+        out.refineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - b).count();
+    }
+
+    // Coarse variants for every supported pyramid factor are built once by the bank
+    static BankOptions enemy_bank_options()
+    {
+        BankOptions o;
+        o.scales = {0.5, 0.25};
+        o.interp = cv::INTER_AREA;
+        return o;
+    }
+
+    void addEnemy(const std::shared_ptr<const BankTemplate> &t, const std::string &name)
+    {
+        enemyBank_.push_back(t);
+        enemies_.push_back(t->img); // header only, pixels stay in the bank
+        enemyNames_.push_back(name);
+    }
+
+    double enemyTh(int i) const { return enemyBank_[i]->threshold(enemyTh_); }
+
+    void rebuildCoarse()
+    {
+        spacesUsed_ = 0;
+        for (const auto &t : enemyBank_)
+            spacesUsed_ |= 1u << t->space;
+        coarse_.assign(enemies_.size(), Mat());
+        if (pyramid_ > 1)
+            for (size_t i = 0; i < enemyBank_.size(); ++i)
+            {
+                const Mat *v = enemyBank_[i]->variant(1.0 / pyramid_);
+                if (v && v->cols >= kMinCoarseSide && v->rows >= kMinCoarseSide)
+                    coarse_[i] = *v;
+            }
+        rebuildDevice();
+    }
+
+    // UMat headers onto the bank's device copies, parallel to enemies_/coarse_
+    void rebuildDevice()
+    {
+        enemiesDev_.clear();
+        coarseDev_.clear();
+        if (!gGpuMatch)
+            return;
+        try
+        {
+            for (size_t i = 0; i < enemyBank_.size(); ++i)
+            {
+                enemiesDev_.push_back(enemyBank_[i]->device(enemies_[i]));
+                coarseDev_.push_back(coarse_[i].empty() ? cv::UMat() : enemyBank_[i]->device(coarse_[i]));
+            }
+        }
+        catch (const cv::Exception &e)
+        {
+            gpu_disable(e);
+            enemiesDev_.clear();
+            coarseDev_.clear();
+        }
+    }
+
+    // Blank result cells whose template centre lands in an excluded rect.
+    // origin = screen position of result(0,0)'s template top-left; scale = pyramid factor.
+    template <class M>
+    void mask_excluded(M &result, cv::Size templ, cv::Point origin, int scale = 1) const
+    {
+        for (const auto &ex : exclude_)
+        {
+            int x0 = (ex.x - origin.x) / scale - templ.width / 2;
+            int y0 = (ex.y - origin.y) / scale - templ.height / 2;
+            cv::Rect r(x0, y0, ex.width / scale + 1, ex.height / scale + 1);
+            r &= cv::Rect(0, 0, result.cols, result.rows);
+            if (r.area() > 0)
+                result(r).setTo(cv::Scalar(-1));
+        }
+    }
+
+    static const int kCoarsePeaks = 3;
+    static const int kMinCoarseSide = 8;
+    static const int kMinBandRows = 128;
+    static constexpr double kCoarseMargin = 0.15;
+
+    std::vector<std::shared_ptr<const BankTemplate>> enemyBank_;
     std::vector<Mat> enemies_;
+    std::vector<Mat> coarse_;
+    std::vector<cv::UMat> enemiesDev_, coarseDev_; // empty unless --gpu=opencl
+    unsigned spacesUsed_ = 0;                      // match spaces of the enemy set
     std::vector<std::string> enemyNames_;
-    Mat battle_;
+    std::shared_ptr<const BankTemplate> battle_;
     double enemyTh_ = 0.75;
     double battleTh_ = 0.88;
+    int pyramid_ = 1;
+    cv::Rect roi_;
+    cv::Rect battleRoi_;
+    std::vector<cv::Rect> exclude_;
+
+    // Scratch reused across scans (hunt thread + pool slots)
+    mutable WorkerPool pool_;
+    mutable std::vector<MatchScratch> scratch_;
+    mutable std::vector<TaskOut> tasks_;
+    mutable FramePlanes own_, views_, coarseViews_; // own_: planes converted here, not by capture
+    mutable Mat hsv_;
+    mutable Mat battleResult_;
+    mutable Mat battleView_;
+    mutable DftScratch battleScratch_;
+    mutable cv::UMat gpuFrame_, gpuBattle_;
+    mutable std::array<cv::UMat, kSpaceCount> gpuViews_, gpuCoarse_;
+    mutable MatchScratchT<cv::UMat> gpuScratch_;
+    mutable ScanTiming last_;
+    mutable cv::Size lastRoiSize_;
+    mutable uint64_t scans_ = 0;
+    mutable double sumMs_ = 0, maxMs_ = 0;
 };
 
 static TemplateDetector gDet;
 
 // ========================= Cursor Template Detection =========================
 
+static const double kCursorScales[] = {1.00, 0.90, 1.10, 0.80, 1.20};
+static const int kNumCursorScales = (int)(sizeof(kCursorScales) / sizeof(kCursorScales[0]));
+
 static bool load_abs_cursor_template(const std::string &path)
 {
     if (path.empty())
         return false;
-    gAbsCursorTempl = cv::imread(path, cv::IMREAD_COLOR);
-    if (gAbsCursorTempl.empty())
+    BankOptions opts;
+    opts.scales.assign(kCursorScales + 1, kCursorScales + kNumCursorScales); // [0] is 1.0
+    gAbsCursorTempl = gBank.load(path, opts);
+    if (!gAbsCursorTempl)
     {
         std::fprintf(stderr, "[ABS] Failed cursor template: %s\n", path.c_str());
         return false;
     }
     std::printf("[ABS] Loaded cursor template: %s (%dx%d)\n",
-                path.c_str(), gAbsCursorTempl.cols, gAbsCursorTempl.rows);
+                path.c_str(), gAbsCursorTempl->bgr.cols, gAbsCursorTempl->bgr.rows);
     return true;
 }
 
-static double best_match_score_multiscale(const cv::Mat &roi, const cv::Mat &templ)
+static double best_match_score_multiscale(const cv::Mat &roi, const BankTemplate &templ, VisionArena &arena)
 {
-    static const double scales[] = {1.00, 0.90, 1.10, 0.80, 1.20};
     double best = -1.0;
-    for (double s : scales)
+    if (gGpuMatch)
     {
-        cv::Mat tScaled;
-        if (std::fabs(s - 1.0) < 1e-6)
-            tScaled = templ;
-        else
-            cv::resize(templ, tScaled, cv::Size(), s, s, cv::INTER_LINEAR);
+        try
+        {
+            roi.copyTo(arena.frameDev);
+            for (double s : kCursorScales)
+            {
+                const cv::Mat *v = templ.variant(s);
+                if (v && !v->empty() && v->cols <= roi.cols && v->rows <= roi.rows)
+                    best = std::max(best, gpu_match_max(arena.frameDev, templ.device(*v), arena.resultDev));
+            }
+            return best;
+        }
+        catch (const cv::Exception &e)
+        {
+            gpu_disable(e);
+            best = -1.0;
+        }
+    }
+    cv::Mat &result = arena.result;
+    for (double s : kCursorScales)
+    {
+        const cv::Mat *v = templ.variant(s);
+        if (!v)
+            continue;
+        const cv::Mat &tScaled = *v;
         if (tScaled.empty() || tScaled.cols > roi.cols || tScaled.rows > roi.rows)
             continue;
-        cv::Mat result;
         cv::matchTemplate(roi, tScaled, result, cv::TM_CCOEFF_NORMED);
         double minV = 0, maxV = 0;
         cv::Point mL, xL;
@@ -1048,37 +5529,150 @@ static double best_match_score_multiscale(const cv::Mat &roi, const cv::Mat &tem
     return best;
 }
 
+// Identity of the OS cursor image: FNV-1a over the mask and colour bitmaps plus
+// the hotspot. GetIconInfo hands back copies, so both bitmaps are freed here.
+static uint64_t cursor_shape_hash(HCURSOR cur, int &w, int &h)
+{
+    ICONINFO ii{};
+    if (!GetIconInfo(cur, &ii))
+        return 0;
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&](const void *p, size_t n)
+    {
+        const uint8_t *b = (const uint8_t *)p;
+        for (size_t k = 0; k < n; ++k)
+            hash = (hash ^ b[k]) * 1099511628211ull;
+    };
+    mix(&ii.xHotspot, sizeof(ii.xHotspot));
+    mix(&ii.yHotspot, sizeof(ii.yHotspot));
+    w = h = 0;
+    std::vector<uint8_t> bits;
+    for (HBITMAP bmp : {ii.hbmMask, ii.hbmColor})
+    {
+        if (!bmp)
+            continue;
+        BITMAP bm{};
+        if (GetObjectA(bmp, sizeof(bm), &bm))
+        {
+            bits.resize((size_t)bm.bmWidthBytes * bm.bmHeight);
+            LONG n = GetBitmapBits(bmp, (LONG)bits.size(), bits.data());
+            mix(&bm.bmWidth, sizeof(bm.bmWidth));
+            mix(&bm.bmHeight, sizeof(bm.bmHeight));
+            if (n > 0)
+                mix(bits.data(), (size_t)n);
+            w = std::max(w, (int)bm.bmWidth);
+            // A monochrome cursor stacks AND over XOR in one mask of double height
+            h = std::max(h, ii.hbmColor ? (int)bm.bmHeight : (int)bm.bmHeight / 2);
+        }
+        DeleteObject(bmp);
+    }
+    return hash;
+}
+
+// roi is BGR; it is converted here (a few KB, unlike the frame planes)
+static double cursor_match_score(const cv::Mat &bgrRoi, const BankTemplate &templ, VisionArena &arena)
+{
+    const cv::Mat &base = templ.img;
+    if (bgrRoi.empty() || base.empty())
+        return -1.0;
+    if (templ.space != SPACE_BGR)
+        convert_to_space(bgrRoi, templ.space, arena.plane, arena.hsv);
+    const cv::Mat &roi = (templ.space != SPACE_BGR) ? arena.plane : bgrRoi;
+    if (gCursorMultiScale)
+        return best_match_score_multiscale(roi, templ, arena);
+    if (base.cols > roi.cols || base.rows > roi.rows)
+        return -1.0;
+    cv::Mat &r = arena.result;
+    cv::matchTemplate(roi, base, r, cv::TM_CCOEFF_NORMED);
+    double mn = 0, mx = 0;
+    cv::Point mL, xL;
+    cv::minMaxLoc(r, &mn, &mx, &mL, &xL);
+    return mx;
+}
+
+// Shape mode: while the OS cursor is showing, only hCursor is polled (cheap);
+// a new handle is hashed, and a new hash is drawn on a gray canvas and matched
+// once, the verdict cached per hash. A hidden OS cursor means the game draws
+// its own, so that falls back to scanning the screen around the pointer.
 static void start_cursor_detect_thread()
 {
     if (gAbsCursorTemplatePath.empty())
         return;
     if (!load_abs_cursor_template(gAbsCursorTemplatePath))
         return;
+    start_capture_service();
     gRunCursorDetect = true;
-    gCursorDetectThread = std::thread([]()
+    gCursorDetectThread = std::thread([templ = gAbsCursorTempl]()
                                       {
+        apply_thread_role(ROLE_CURSOR);
+        constexpr int kShapePollMs = 10;
+        GdiGrabber canvas;
+        VisionArena arena;
+        std::vector<std::pair<uint64_t, bool>> verdicts; // a handful of shapes per session
+        HCURSOR lastCur = nullptr;
+        uint64_t lastHash = 0;
+        unsigned matches = 0;
         while (gRunCursorDetect)
         {
-            if (!gRecording && !gPlaying) { gAbsByCursor = false; Sleep(50); continue; }
-            cv::Mat roi = capture_roi_around_cursor(80);
-            if (roi.empty() || gAbsCursorTempl.empty())
-            { gAbsByCursor = false; Sleep(gCursorScanMs); continue; }
-            double score = gCursorMultiScale
-                ? best_match_score_multiscale(roi, gAbsCursorTempl)
-                : [&]()->double{
-                      if (gAbsCursorTempl.cols>roi.cols||gAbsCursorTempl.rows>roi.rows) return -1.0;
-                      cv::Mat r; cv::matchTemplate(roi,gAbsCursorTempl,r,cv::TM_CCOEFF_NORMED);
-                      double mn=0,mx=0; cv::Point mL,xL; cv::minMaxLoc(r,&mn,&mx,&mL,&xL); return mx;
-                  }();
-            gAbsByCursor = (score >= gCursorTh);
-            Sleep(gCursorScanMs);
+            if (!gRecording && !gPlaying)
+            {
+                gAbsByCursor = false; lastCur = nullptr; lastHash = 0;
+                gWake.waitUntil([] { return !gRunCursorDetect || gRecording || gPlaying; });
+                continue;
+            }
+            CURSORINFO ci{};
+            ci.cbSize = sizeof(ci);
+            if (gCursorShapeMode && GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING) && ci.hCursor)
+            {
+                if (ci.hCursor != lastCur)
+                {
+                    lastCur = ci.hCursor;
+                    int cw = 0, ch = 0;
+                    uint64_t hash = cursor_shape_hash(ci.hCursor, cw, ch);
+                    if (hash != lastHash)
+                    {
+                        lastHash = hash;
+                        auto it = std::find_if(verdicts.begin(), verdicts.end(),
+                                               [&](const auto &v) { return v.first == hash; });
+                        if (it == verdicts.end())
+                        {
+                            // Canvas big enough for the largest scaled template around the cursor
+                            int side = std::max({cw, ch, templ->bgr.cols, templ->bgr.rows}) * 2;
+                            double score = canvas.drawIcon(ci.hCursor, (side - cw) / 2, (side - ch) / 2, side, side, arena.roi)
+                                ? cursor_match_score(arena.roi, *templ, arena) : -1.0;
+                            ++matches;
+                            verdicts.emplace_back(hash, score >= templ->threshold(gCursorTh));
+                            it = verdicts.end() - 1;
+                            std::printf("[ABS] Cursor shape %016llx (%dx%d) score=%.2f -> %s\n",
+                                        (unsigned long long)hash, cw, ch, score, it->second ? "ABS" : "REL");
+                        }
+                        gAbsByCursor = it->second;
+                    }
+                }
+                gWake.sleepFor(kShapePollMs, [] { return !gRunCursorDetect; });
+                continue;
+            }
+            lastCur = nullptr;
+            lastHash = 0;
+            // View into the shared frame; direct BitBlt until the first publish
+            // or while the cursor is off the captured monitor
+            CaptureFrameRef frame = gCapture.latest();
+            cv::Mat roi = frame ? roi_around_cursor(frame.frame(), 80) : cv::Mat();
+            if (roi.empty() && capture_roi_around_cursor(80, arena.roi))
+                roi = arena.roi;
+            double score = cursor_match_score(roi, *templ, arena);
+            frame = CaptureFrameRef();
+            gAbsByCursor = (score >= templ->threshold(gCursorTh));
+            gWake.sleepFor(gCursorScanMs, [] { return !gRunCursorDetect; });
         }
+        if (matches)
+            std::printf("[ABS] Cursor shape matches run: %u\n", matches);
         gAbsByCursor = false; });
 }
 
 static void stop_cursor_detect_thread()
 {
-    gRunCursorDetect = false;
+    set_and_wake(gRunCursorDetect, false);
     if (gCursorDetectThread.joinable())
         gCursorDetectThread.join();
     gAbsByCursor = false;
@@ -1099,19 +5693,19 @@ static void start_abs_poll_thread()
                 if (GetCursorPos(&pt) && (pt.x!=last.x || pt.y!=last.y))
                 {
                     last=pt; gCursorPt=pt;
-                    write_event(EV_MOUSE_POS,(int32_t)pt.x,(int32_t)pt.y,0);
+                    write_event(SRC_ABS_POLL, EV_MOUSE_POS,(int32_t)pt.x,(int32_t)pt.y,0);
                     overlay_invalidate();
                 }
             }
             else { POINT pt{}; if(GetCursorPos(&pt)) gCursorPt=pt; }
-            gAbsByAlt = ((GetAsyncKeyState(VK_MENU) & 0x8000) != 0);
-            Sleep(gAbsPollMs);
+            gAbsByAlt = gInput.altDown();
+            gWake.sleepFor(gAbsPollMs, [] { return !gRunAbsPoll; });
         } });
 }
 
 static void stop_abs_poll_thread()
 {
-    gRunAbsPoll = false;
+    set_and_wake(gRunAbsPoll, false);
     if (gAbsPollThread.joinable())
         gAbsPollThread.join();
 }
@@ -1123,45 +5717,92 @@ static bool point_in_rect(int x, int y, const RECT &r)
     return x >= r.left && x <= r.right && y >= r.top && y <= r.bottom;
 }
 
-struct MatchHit
-{
-    cv::Point topLeft;
-    double score;
-};
-
-static std::vector<MatchHit> find_all_matches(const cv::Mat &screen, const cv::Mat &templ, double th)
+// All peaks >= th, strongest first, none within half a template of a
+// stronger one. One scan collects 3x3 local maxima, then greedy NMS over
+// the (few) candidates replaces repeated whole-matrix minMaxLoc.
+// Results land in arena.hits; the returned reference is valid until the
+// arena's next search.
+static const std::vector<MatchHit> &find_all_matches(const cv::Mat &screen, const cv::Mat &templ, double th,
+                                                     VisionArena &arena)
 {
-    std::vector<MatchHit> hits;
+    std::vector<MatchHit> &hits = arena.hits;
+    std::vector<MatchHit> &cand = arena.cand;
+    hits.clear();
+    cand.clear();
     if (screen.empty() || templ.empty() || templ.cols > screen.cols || templ.rows > screen.rows)
         return hits;
-    cv::Mat result;
-    cv::matchTemplate(screen, templ, result, cv::TM_CCOEFF_NORMED);
-    while (true)
+    cv::Mat &result = arena.result;
+    bool onDevice = false;
+    if (gGpuMatch)
     {
-        double minV = 0, maxV = 0;
-        cv::Point minL, maxL;
-        cv::minMaxLoc(result, &minV, &maxV, &minL, &maxL);
-        if (maxV < th)
-            break;
-        hits.push_back({maxL, maxV});
-        int x0 = std::max(0, maxL.x - templ.cols / 2), y0 = std::max(0, maxL.y - templ.rows / 2);
-        int x1 = std::min(result.cols, maxL.x + templ.cols / 2), y1 = std::min(result.rows, maxL.y + templ.rows / 2);
-        cv::rectangle(result, cv::Rect(x0, y0, x1 - x0, y1 - y0), cv::Scalar(0), cv::FILLED);
+        try
+        {
+            screen.copyTo(arena.frameDev);
+            if (arena.templKey != templ.data)
+            {
+                templ.copyTo(arena.templDev);
+                arena.templKey = templ.data;
+            }
+            cv::matchTemplate(arena.frameDev, arena.templDev, arena.resultDev, cv::TM_CCOEFF_NORMED);
+            arena.resultDev.copyTo(result);
+            onDevice = true;
+        }
+        catch (const cv::Exception &e)
+        {
+            gpu_disable(e);
+        }
+    }
+    if (!onDevice)
+        cv::matchTemplate(screen, templ, result, cv::TM_CCOEFF_NORMED);
+
+    const float t = (float)th;
+    for (int y = 0; y < result.rows; ++y)
+    {
+        const float *up = result.ptr<float>(std::max(0, y - 1));
+        const float *row = result.ptr<float>(y);
+        const float *dn = result.ptr<float>(std::min(result.rows - 1, y + 1));
+        for (int x = 0; x < result.cols; ++x)
+        {
+            float v = row[x];
+            if (v < t)
+                continue;
+            int xl = std::max(0, x - 1), xr = std::min(result.cols - 1, x + 1);
+            if (v < row[xl] || v < row[xr] || v < up[xl] || v < up[x] || v < up[xr] ||
+                v < dn[xl] || v < dn[x] || v < dn[xr])
+                continue;
+            cand.push_back({cv::Point(x, y), v});
+        }
+    }
+    std::sort(cand.begin(), cand.end(), [](const MatchHit &a, const MatchHit &b)
+              { return a.score > b.score; });
+
+    const int hw = templ.cols / 2, hh = templ.rows / 2;
+    for (const auto &c : cand)
+    {
+        bool suppressed = false;
+        for (const auto &h : hits)
+            if (std::abs(c.topLeft.x - h.topLeft.x) < hw && std::abs(c.topLeft.y - h.topLeft.y) < hh)
+            {
+                suppressed = true;
+                break;
+            }
+        if (!suppressed)
+            hits.push_back(c);
     }
     return hits;
 }
 
-static bool pick_world_marker(const cv::Mat &screen, const cv::Mat &questTempl, double th,
+static bool pick_world_marker(const cv::Mat &screen, const cv::Mat &questTempl, double th, VisionArena &arena,
                               cv::Point &outCenter, double &outScore)
 {
-    auto hits = find_all_matches(screen, questTempl, th);
+    const auto &hits = find_all_matches(screen, questTempl, th, arena);
     if (hits.empty())
         return false;
     const int cx0 = screen.cols / 2, cy0 = screen.rows / 2;
     bool found = false;
     double bestCost = 1e30, bestScore = 0;
     cv::Point bestCenter(-1, -1);
-    for (auto &h : hits)
+    for (const auto &h : hits)
     {
         int cx = h.topLeft.x + questTempl.cols / 2, cy = h.topLeft.y + questTempl.rows / 2;
         if (point_in_rect(cx, cy, gQuestLogIgnore))
@@ -1169,44 +5810,177 @@ static bool pick_world_marker(const cv::Mat &screen, const cv::Mat &questTempl,
         double dx = cx - cx0, dy = cy - cy0, cost = dx * dx + dy * dy;
         if (!found || cost < bestCost)
         {
-            found = true;
-            bestCost = cost;
-            bestScore = h.score;
-            bestCenter = cv::Point(cx, cy);
+            found = true;
+            bestCost = cost;
+            bestScore = h.score;
+            bestCenter = cv::Point(cx, cy);
+        }
+    }
+    if (!found)
+        return false;
+    outCenter = bestCenter;
+    outScore = bestScore;
+    return true;
+}
+
+// Follows the world marker between ticks: searches a window around the
+// constant-velocity prediction from the last two fixes and only falls back
+// to pick_world_marker over the full frame when the tracked score drops
+// below th (or the marker was lost).
+class MarkerTracker
+{
+public:
+    bool locate(const cv::Mat &screen, const cv::Mat &templ, double th, uint64_t t_us,
+                cv::Point &outCenter, double &outScore)
+    {
+        if (tracking_ && track(screen, templ, th, t_us, outCenter, outScore))
+        {
+            ++tracked_;
+            update(outCenter, t_us, true);
+            return true;
+        }
+        ++full_;
+        tracking_ = pick_world_marker(screen, templ, th, arena_, outCenter, outScore);
+        if (tracking_)
+            update(outCenter, t_us, false);
+        return tracking_;
+    }
+
+    uint64_t trackedCount() const { return tracked_; }
+    uint64_t fullCount() const { return full_; }
+    // Shared with callers that bypass tracking on the same thread
+    VisionArena &arena() { return arena_; }
+
+private:
+    bool track(const cv::Mat &screen, const cv::Mat &templ, double th, uint64_t t_us,
+               cv::Point &outCenter, double &outScore)
+    {
+        double dt = t_us > lastUs_ ? (double)(t_us - lastUs_) : 0.0;
+        double px = last_.x + vx_ * dt, py = last_.y + vy_ * dt;
+        // Window: template plus a margin that grows with the predicted step
+        int margin = kMinMargin + (int)(std::abs(vx_ * dt) + std::abs(vy_ * dt));
+        cv::Rect win((int)px - templ.cols / 2 - margin, (int)py - templ.rows / 2 - margin,
+                     templ.cols + 2 * margin, templ.rows + 2 * margin);
+        win &= cv::Rect(0, 0, screen.cols, screen.rows);
+        if (win.width < templ.cols || win.height < templ.rows)
+            return false;
+
+        cv::matchTemplate(screen(win), templ, arena_.result, cv::TM_CCOEFF_NORMED);
+        double mn = 0, mx = 0;
+        cv::Point mnL, mxL;
+        cv::minMaxLoc(arena_.result, &mn, &mx, &mnL, &mxL);
+        if (mx < th)
+            return false;
+        cv::Point c(win.x + mxL.x + templ.cols / 2, win.y + mxL.y + templ.rows / 2);
+        if (point_in_rect(c.x, c.y, gQuestLogIgnore))
+            return false;
+        outCenter = c;
+        outScore = mx;
+        return true;
+    }
+
+    void update(cv::Point c, uint64_t t_us, bool keepVelocity)
+    {
+        if (keepVelocity && t_us > lastUs_)
+        {
+            double dt = (double)(t_us - lastUs_);
+            // Light smoothing; capture jitter makes raw per-frame velocity noisy
+            vx_ = 0.5 * vx_ + 0.5 * (c.x - last_.x) / dt;
+            vy_ = 0.5 * vy_ + 0.5 * (c.y - last_.y) / dt;
         }
+        else
+            vx_ = vy_ = 0.0;
+        last_ = c;
+        lastUs_ = t_us;
     }
-    if (!found)
-        return false;
-    outCenter = bestCenter;
-    outScore = bestScore;
-    return true;
-}
+
+    static constexpr int kMinMargin = 48; // px around the template
+
+    bool tracking_ = false;
+    cv::Point last_{-1, -1};
+    uint64_t lastUs_ = 0;
+    double vx_ = 0.0, vy_ = 0.0; // px per us
+    VisionArena arena_;
+    uint64_t tracked_ = 0, full_ = 0;
+};
 
 // ========================= Quest Walk Thread =========================
 
 static void stop_quest_walk()
 {
-    gRunQuestWalk = false;
+    set_and_wake(gRunQuestWalk, false);
     if (gQuestWalkThread.joinable())
         gQuestWalkThread.join();
 }
 
-static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int deadzonePx, int tickMs)
+static void start_quest_walk(const std::shared_ptr<const BankTemplate> &questBank, double markerTh, int deadzonePx, int tickMs)
 {
     stop_quest_walk();
-    gRunQuestWalk = true;
+    start_capture_service();
+    set_and_wake(gRunQuestWalk, true);
 
-    gQuestWalkThread = std::thread([questTempl, markerTh, deadzonePx, tickMs]()
+    gQuestWalkThread = std::thread([questBank, markerTh, deadzonePx, tickMs]()
                                    {
+        apply_thread_role(ROLE_QUEST);
+        // One tick, cut short by stop, ESC or a battle starting
+        auto tick_wait = [tickMs]()
+        { gWake.sleepFor(tickMs, [] { return !gRunQuestWalk || gBattleStarted || gInput.escDown(); }); };
+        const cv::Mat &questTempl = questBank->img;
+        const double th = questBank->threshold(markerTh);
+        cv::Mat planeScratch, hsv;
         std::puts("[QUEST] Thread started. ESC to stop.");
 
-        // Tesseract lives on this thread only
-        TesseractOCR ocr;
-        bool ocrOk = ocr.init("tessdata", "eng");
-        if (!ocrOk) std::puts("[QUEST] WARNING: Tesseract unavailable - no distance OCR.");
+        // OCR stage: its own thread (Tesseract and the digit recognizer live
+        // there only), fed the newest distance label by the detect stage.
+        // Steering below never waits on it and uses the latest reading.
+        struct OcrJob { cv::Mat roi; uint64_t t_us = 0; };
+        struct OcrReading { int dist = -1; uint64_t t_us = 0; double ms = 0.0; };
+        Mailbox<OcrJob> ocrJobs;
+        Mailbox<OcrReading> ocrReadings;
+        std::thread ocrThread([&ocrJobs, &ocrReadings]()
+        {
+            apply_thread_role(ROLE_OCR);
+            TesseractOCR ocr;
+            bool ocrOk = ocr.init("tessdata", "eng");
+            DigitRecognizer digits;
+            if (gQuestDigits) digits.load(kDefaultDigitsPath);
+            if (!ocrOk && !digits.ready())
+                std::puts("[QUEST] WARNING: Tesseract unavailable - no distance OCR.");
+
+            OcrJob job;
+            while (ocrJobs.take(job))
+            {
+                TraceScope ts(TS_OCR);
+                int distM = -1;
+                if (digits.ready())
+                {
+                    distM = digits.read(job.roi);
+                    gQuestOcrMs = digits.lastMs();
+                    gQuestOcrSource = 2;
+                }
+                if (distM < 0 && ocrOk)
+                {
+                    distM = ocr.readDistance(job.roi);
+                    gQuestOcrMs = ocr.lastMs();
+                    gQuestOcrSource = ocr.lastCached() ? 1 : 0;
+                    gQuestOcrHitRate = ocr.hitRate();
+                    if (gQuestDigits && !ocr.lastCached())
+                        digits.learn(job.roi, distM);
+                }
+                ocrReadings.post(OcrReading{distM, job.t_us, gQuestOcrMs.load()});
+            }
+        });
 
         bool arrived = false;   // true when we stopped at <= kArrivalMeters
         int  prevDist = -1;     // last valid OCR distance
+        uint64_t seenSeq = 0;   // last OCR reading consumed
+        MarkerTracker tracker;
+        MatPool ocrRois;        // label crops in flight to the OCR thread
+        LogLimiter posLog;
+        FrameGate markerGate;   // screen as of the last marker search
+        bool haveLast = false, lastFound = false;
+        cv::Point lastCenter; double lastConf = 0.0;
+        uint64_t reusedPicks = 0;
 
         // Begin walking
         send_key(true, 'W');
@@ -1215,19 +5989,16 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
         while (gRunQuestWalk)
         {
             // --- ESC ---
-            if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
-            { std::puts("[QUEST] ESC."); gRunQuestWalk = false; break; }
+            if (gInput.escDown())
+            { std::puts("[QUEST] ESC."); set_and_wake(gRunQuestWalk, false); break; }
 
             // --- Battle pause ---
             if (gBattleStarted.load())
             {
                 std::puts("[QUEST] Battle detected - pausing.");
                 release_move_keys();
-                while (gRunQuestWalk && gBattleStarted.load())
-                {
-                    if (GetAsyncKeyState(VK_ESCAPE) & 0x8000) { gRunQuestWalk=false; break; }
-                    Sleep(200);
-                }
+                gWake.waitUntil([] { return !gRunQuestWalk || !gBattleStarted || gInput.escDown(); });
+                if (gInput.escDown()) set_and_wake(gRunQuestWalk, false);
                 if (!gRunQuestWalk) break;
                 std::puts("[QUEST] Resuming after battle.");
                 arrived = false;
@@ -1237,12 +6008,47 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
             }
 
             // --- Capture + find marker ---
-            cv::Mat screen = capture_screen_full();
+            CaptureFrameRef frame = gCapture.latest();
+            if (!frame) { tick_wait(); continue; }
+            const cv::Mat &screen = frame.mat();
+            const cv::Mat &plane = plane_for(frame.planes(), questBank->space, planeScratch, hsv);
+            const int screenCols = screen.cols;
+            const uint64_t frameUs = frame.frame().t_us;
+            const uint64_t detStartUs = steady_us();
             cv::Point markerCenter; double conf = 0.0;
-            bool markerFound = pick_world_marker(screen, questTempl, markerTh, markerCenter, conf);
+            bool markerFound;
+            // The last pick stands while its marker and distance label are
+            // pixel-identical (or, with no marker, while nothing changed at all)
+            cv::Rect watch(0, 0, screen.cols, screen.rows);
+            if (lastFound)
+                watch = cv::Rect(lastCenter.x - questTempl.cols / 2, lastCenter.y - questTempl.rows / 2,
+                                 questTempl.cols, questTempl.rows) |
+                        cv::Rect(lastCenter.x - 40, lastCenter.y + questTempl.rows / 2 + 2, 80, 28);
+            const bool reuse = haveLast && markerGate.changed(frame.frame(), watch).empty();
+            if (reuse)
+            {
+                markerFound = lastFound;
+                markerCenter = lastCenter;
+                conf = lastConf;
+                reusedPicks++;
+            }
+            else
+            {
+                TraceScope ts(TS_MATCH);
+                markerFound = gQuestTrack
+                    ? tracker.locate(plane, questTempl, th, frameUs, markerCenter, conf)
+                    : pick_world_marker(plane, questTempl, th, tracker.arena(), markerCenter, conf);
+                markerGate.accept(frame.frame());
+                haveLast = true;
+                lastFound = markerFound;
+                lastCenter = markerCenter;
+                lastConf = conf;
+            }
+            const double detMs = (steady_us() - detStartUs) / 1000.0;
 
             if (!markerFound)
             {
+                frame.reset();
                 gQuestMarkerX = gQuestMarkerY = -1; gQuestMarkerConf = 0.0;
                 // Marker not visible: keep going forward, release steering
                 if (!arrived)
@@ -1250,7 +6056,7 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
                     send_key(false, 'A'); send_key(false, 'D'); send_key(false, 'S');
                 }
                 overlay_invalidate();
-                Sleep(tickMs);
+                tick_wait();
                 continue;
             }
 
@@ -1258,24 +6064,38 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
             gQuestMarkerY    = markerCenter.y;
             gQuestMarkerConf = conf;
 
-            // --- OCR distance number below marker ---
-            int distM = -1;
-            if (ocrOk)
+            // --- Hand the distance label to the OCR stage (a reused pick's label is unchanged) ---
+            if (!reuse)
             {
-                cv::Mat distRoi = crop_distance_label(screen, markerCenter, questTempl.rows, 80, 28);
-                if (!distRoi.empty())
-                    distM = ocr.readDistance(distRoi);
+                cv::Mat &distRoi = ocrRois.acquire();
+                if (crop_distance_label(screen, markerCenter, questTempl.rows, distRoi, 80, 28))
+                    ocrJobs.post(OcrJob{distRoi, frameUs});
             }
+            frame.reset(); // unpin before the key logic and tick sleep
 
-            // Keep last valid reading if OCR failed this frame
-            if (distM >= 0) prevDist = distM;
-            else            distM    = prevDist;
+            // Latest reading; keep the last valid one if OCR failed
+            OcrReading rd; uint64_t seq = 0;
+            bool grew = false; // distance jumped up since the previous reading
+            if (ocrReadings.peek(rd, seq) && seq != seenSeq)
+            {
+                seenSeq = seq;
+                if (rd.dist >= 0)
+                {
+                    grew = prevDist >= 0 && rd.dist > prevDist + 2;
+                    prevDist = rd.dist;
+                }
+            }
+            int distM = prevDist;
 
             gQuestDistanceM = distM;
             overlay_invalidate();
 
-            std::printf("[QUEST] pos=(%d,%d) conf=%.2f dist=%dm arrived=%d\n",
-                        markerCenter.x, markerCenter.y, conf, distM, (int)arrived);
+            const uint64_t nowUs = steady_us();
+            if (posLog.allow())
+                std::printf("[QUEST] pos=(%d,%d) conf=%.2f dist=%dm arrived=%d  cap=%.1fms det=%.1fms ocr=%.1fms age=%.0fms\n",
+                            markerCenter.x, markerCenter.y, conf, distM, (int)arrived,
+                            (detStartUs - frameUs) / 1000.0, detMs, rd.ms,
+                            rd.t_us ? (nowUs - rd.t_us) / 1000.0 : -1.0);
 
             // ============================================================
             // Distance-based movement control
@@ -1289,7 +6109,7 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
                     std::printf("[QUEST] ARRIVED - dist=%dm <= %dm. Stopping.\n", distM, kArrivalMeters);
                     release_move_keys();
                     arrived = true;
-                    Sleep(tickMs);
+                    tick_wait();
                     continue;
                 }
 
@@ -1323,9 +6143,9 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
                 {
                     // Still at destination.
                     // Overshoot guard: if distance is growing we've drifted past - press S to correct
-                    if (prevDist >= 0 && distM >= 0 && distM > prevDist + 2)
+                    if (grew)
                     {
-                        std::printf("[QUEST] Overshot! %d->%dm - pressing S.\n", prevDist, distM);
+                        std::printf("[QUEST] Overshot! now %dm - pressing S.\n", distM);
                         send_key(false, 'W'); send_key(false, VK_SHIFT);
                         send_key(true,  'S');
                         Sleep(300);
@@ -1336,7 +6156,7 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
                         // Fully stopped
                         send_key(false, 'W'); send_key(false, 'S'); send_key(false, VK_SHIFT);
                     }
-                    Sleep(tickMs);
+                    tick_wait();
                     continue;
                 }
             }
@@ -1345,7 +6165,7 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
             // Horizontal steering: A / D based on marker X vs screen center
             // ============================================================
 
-            int centerX = screen.cols / 2;
+            int centerX = screenCols / 2;
             int dx = markerCenter.x - centerX;
 
             if (dx < -deadzonePx)
@@ -1363,19 +6183,25 @@ static void start_quest_walk(const cv::Mat &questTempl, double markerTh, int dea
 
             GetCursorPos(&gCursorPt);
             overlay_invalidate();
-            Sleep(tickMs);
+            tick_wait();
         }
 
+        ocrJobs.close();
+        ocrThread.join();
         release_move_keys();
         gQuestMarkerX = gQuestMarkerY = -1; gQuestDistanceM = -1;
-        std::puts("[QUEST] Quest walk stopped."); });
+        std::printf("[QUEST] Quest walk stopped. (%llu OCR frames superseded before read, "
+                    "marker tracked=%llu full=%llu unchanged=%llu)\n",
+                    (unsigned long long)ocrJobs.overwritten(),
+                    (unsigned long long)tracker.trackedCount(), (unsigned long long)tracker.fullCount(),
+                    (unsigned long long)reusedPicks); });
 }
 
 // ========================= Hunt control =========================
 
 static void stop_auto_hunt()
 {
-    gAutoHuntRun = false;
+    set_and_wake(gAutoHuntRun, false);
     if (gAutoHuntThread.joinable())
         gAutoHuntThread.join();
 }
@@ -1384,23 +6210,129 @@ static void start_auto_hunt_with_saved_config(); // forward
 
 static void maybe_restart_hunt_on_shift()
 {
-    if ((GetAsyncKeyState(VK_SHIFT) & 1) == 0)
+    if (!gInput.takeShiftEdge())
         return;
     if (gAutoHuntRun.load())
         return;
     if (!gBattleStarted.load())
         return;
     std::printf("[HUNT] SHIFT -> restart hunt, clear battle flag.\n");
-    gBattleStarted = false;
+    set_and_wake(gBattleStarted, false);
     start_auto_hunt_with_saved_config();
 }
 
+// Templates, thresholds and the --pyramid/--roi/--exclude/--threads options
+static bool configure_detector(TemplateDetector &det, const char *enemyTemplatesPath,
+                               const char *battleStartTemplatePath,
+                               double enemyThreshold, double battleThreshold)
+{
+    if (!det.loadEnemyTemplates(enemyTemplatesPath))
+    {
+        std::fprintf(stderr, "[HUNT] Failed enemy templates: %s\n", enemyTemplatesPath);
+        return false;
+    }
+    if (!det.loadBattleStartTemplate(battleStartTemplatePath))
+    {
+        std::fprintf(stderr, "[HUNT] Failed battle template: %s\n", battleStartTemplatePath);
+        return false;
+    }
+    det.setEnemyThreshold(enemyThreshold);
+    det.setBattleThreshold(battleThreshold);
+    det.setPyramid(gEnemyPyramid);
+    det.setSearchRoi(gEnemyRoi);
+    det.setBattleRoi(gBattleRoi);
+    det.setExcludeRects(gEnemyExclude);
+    det.setWorkerThreads(gMatchThreads > 0 ? gMatchThreads
+                                           : (int)std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u));
+    det.resetTiming();
+    return true;
+}
+
+// Hunt-thread change gating: each search compares the screen with the frame
+// it last ran on and rematches only what changed since
+struct HuntGate
+{
+    FrameGate battle, enemy;
+    bool valid = false; // hit/conf/idx hold a previous scan
+    Point hit{-1, -1};
+    double conf = -1;
+    int idx = -1;
+    uint64_t full = 0, partial = 0, reused = 0, battleSkips = 0;
+};
+
+static bool battle_start_gated(const CaptureFrame &f, HuntGate &g, double *outConf)
+{
+    if (g.battle.changed(f, gDet.battleArea(f.bgr.size())).empty())
+    {
+        // A banner can't appear in pixels that didn't change since the last miss
+        g.battleSkips++;
+        return false;
+    }
+    bool battle = gDet.isBattleStart(f.planes, outConf);
+    g.battle.accept(f);
+    return battle;
+}
+
+// Nothing changed: the previous result stands. Changes away from the previous
+// hit: unchanged areas still score below it, so only the changed areas are
+// matched and compete with it. The hit's own pixels changed: full scan, since
+// the runner-up could be anywhere.
+static Point find_enemy_gated(const CaptureFrame &f, HuntGate &g, double *outConf, int *outIdx)
+{
+    const cv::Rect area = gDet.enemyArea(f.bgr.size());
+    const auto &changed = g.enemy.changed(f, area, gDet.maxEnemySize());
+    bool full = !g.valid || (changed.size() == 1 && changed[0] == area);
+    if (!full && g.hit.x >= 0)
+    {
+        const cv::Size s = gDet.enemySize(g.idx);
+        const cv::Rect box(g.hit.x - s.width / 2, g.hit.y - s.height / 2, s.width, s.height);
+        for (const cv::Rect &r : changed)
+            full |= (r & box).area() > 0;
+    }
+
+    if (full)
+    {
+        g.hit = gDet.findEnemy(f.planes, &g.conf, &g.idx);
+        g.full++;
+    }
+    else if (changed.empty())
+        g.reused++;
+    else
+    {
+        if (g.hit.x < 0)
+        {
+            g.conf = -1; // the old sub-threshold best may have been in a changed area
+            g.idx = -1;
+        }
+        for (const cv::Rect &r : changed)
+        {
+            double c = -1;
+            int i = -1;
+            Point q = gDet.findEnemy(f.planes, &c, &i, r);
+            if (i >= 0 && (g.idx < 0 || c - gDet.enemyThreshold(i) > g.conf - gDet.enemyThreshold(g.idx)))
+            {
+                g.hit = q;
+                g.conf = c;
+                g.idx = i;
+            }
+        }
+        g.partial++;
+    }
+    g.valid = true;
+    g.enemy.accept(f);
+    if (outConf)
+        *outConf = g.conf;
+    if (outIdx)
+        *outIdx = g.idx;
+    return g.hit;
+}
+
 static void start_auto_hunt(const char *enemyTemplatesPath, const char *battleStartTemplatePath,
                             double enemyThreshold, double battleThreshold,
                             int scanMs, int attackCooldownMs)
 {
     stop_auto_hunt();
-    gBattleStarted = false;
+    set_and_wake(gBattleStarted, false);
     gHuntInfo.detections = 0;
     gHuntInfo.attacks = 0;
     gHuntInfo.lastX = -1;
@@ -1410,54 +6342,72 @@ static void start_auto_hunt(const char *enemyTemplatesPath, const char *battleSt
     gHuntInfo.setLastName("(none)");
     overlay_invalidate();
 
-    if (!gDet.loadEnemyTemplates(enemyTemplatesPath))
-    {
-        std::fprintf(stderr, "[HUNT] Failed enemy templates: %s\n", enemyTemplatesPath);
-        return;
-    }
-    if (!gDet.loadBattleStartTemplate(battleStartTemplatePath))
-    {
-        std::fprintf(stderr, "[HUNT] Failed battle template: %s\n", battleStartTemplatePath);
+    if (!configure_detector(gDet, enemyTemplatesPath, battleStartTemplatePath, enemyThreshold, battleThreshold))
         return;
-    }
-
-    gDet.setEnemyThreshold(enemyThreshold);
-    gDet.setBattleThreshold(battleThreshold);
     if (scanMs < 20)
         scanMs = 20;
     if (attackCooldownMs < 100)
         attackCooldownMs = 100;
 
+    start_capture_service();
     gAutoHuntRun = true;
     gAutoHuntThread = std::thread([=]()
                                   {
         auto lastAttack = std::chrono::steady_clock::now() - std::chrono::milliseconds(attackCooldownMs);
         int tick = 0;
+        LogLimiter debugLog, scanLog;
+        HuntGate gate;
+        apply_thread_role(ROLE_HUNT);
         std::printf("[HUNT] Thread started.\n");
 
-        while (gAutoHuntRun)
+        auto battleStarted = [&](const CaptureFrame &f)
         {
-            if (!gRecording && !gPlaying && !gRunQuestWalk.load()) { Sleep(50); continue; }
-
-            Mat screen = capture_screen_full();
-
             double battleConf = 0.0;
-            if (gDet.isBattleStart(screen, &battleConf))
+            bool battle;
             {
-                gBattleStarted=true;
-                gHuntInfo.lastWasBattle=true; gHuntInfo.lastConf=battleConf;
-                gHuntInfo.setLastName("BattleStart"); gHuntInfo.lastX=gHuntInfo.lastY=-1;
-                overlay_invalidate();
-                std::printf("[HUNT] Battle Start conf=%.2f. Hunt OFF. SHIFT to restart.\n", battleConf);
-                gAutoHuntRun = false; break;
+                TraceScope ts(TS_MATCH);
+                battle = battle_start_gated(f, gate, &battleConf);
+            }
+            if (!battle)
+                return false;
+            set_and_wake(gBattleStarted, true);
+            gHuntInfo.lastWasBattle=true; gHuntInfo.lastConf=battleConf;
+            gHuntInfo.setLastName("BattleStart"); gHuntInfo.lastX=gHuntInfo.lastY=-1;
+            overlay_invalidate();
+            std::printf("[HUNT] Battle Start conf=%.2f. Hunt OFF. SHIFT to restart.\n", battleConf);
+            set_and_wake(gAutoHuntRun, false);
+            return true;
+        };
+
+        while (gAutoHuntRun)
+        {
+            if (!gRecording && !gPlaying && !gRunQuestWalk.load())
+            {
+                gWake.waitUntil([] { return !gAutoHuntRun || gRecording || gPlaying || gRunQuestWalk; });
+                continue;
             }
 
+            CaptureFrameRef frame = gCapture.latest();
+            if (!frame) { gWake.sleepFor(scanMs, [] { return !gAutoHuntRun; }); continue; }
+            const uint64_t frameGen = frame.generation();
+            if (battleStarted(frame.frame()))
+                break;
+
             double enemyConf=0.0; int idx=-1;
-            Point p = gDet.findEnemy(screen, &enemyConf, &idx);
+            Point p;
+            {
+                TraceScope ts(TS_MATCH);
+                p = find_enemy_gated(frame.frame(), gate, &enemyConf, &idx);
+            }
+            const Point origin(frame.frame().originX, frame.frame().originY); // frame -> desktop coords
+            frame.reset(); // unpin before attack/sleep so the capture ring keeps moving
+            const auto &tm = gDet.lastTiming();
+            gHuntInfo.lastScanMs = tm.totalMs;
             tick++;
-            if ((tick%25)==0)
-                std::printf("[DEBUG] conf=%.3f th=%.3f best=%s\n",
-                            enemyConf, enemyThreshold, gDet.enemyName(idx));
+            if ((tick%25)==0 && debugLog.allow())
+                std::printf("[DEBUG] conf=%.3f th=%.3f best=%s scan=%.2fms (coarse=%.2f refine=%.2f cand=%d)\n",
+                            enemyConf, enemyThreshold, gDet.enemyName(idx),
+                            tm.totalMs, tm.coarseMs, tm.refineMs, tm.candidates);
 
             if (p.x >= 0 && p.y >= 0)
             {
@@ -1472,7 +6422,7 @@ static void start_auto_hunt(const char *enemyTemplatesPath, const char *battleSt
                     auto now = std::chrono::steady_clock::now();
                     if (now-lastAttack >= std::chrono::milliseconds(attackCooldownMs))
                     {
-                        TemplateDetector::moveCursorTowards(p, 18, 6);
+                        TemplateDetector::moveCursorTowards(Point(p.x + origin.x, p.y + origin.y), 18, 6);
                         send_mouse_button(1, true); Sleep(35); send_mouse_button(1, false);
                         gHuntInfo.attacks++; overlay_invalidate();
                         std::printf("[HUNT] Attacked: %s conf=%.2f at=(%d,%d)\n",
@@ -1480,12 +6430,41 @@ static void start_auto_hunt(const char *enemyTemplatesPath, const char *battleSt
                         lastAttack = now;
                     }
                 }
-                else
+                else if (scanLog.allow())
                     std::printf("[SCAN] Enemy: %s conf=%.2f at=(%d,%d)\n",
                                 gDet.enemyName(idx), enemyConf, p.x, p.y);
             }
-            Sleep(scanMs);
-        } });
+
+            if (gBattleRoi.area() <= 0)
+            {
+                gWake.sleepFor(scanMs, [] { return !gAutoHuntRun; });
+                continue;
+            }
+            // --battle-roi: the banner check is a small match, so it runs on
+            // every new frame while the enemy scan waits out scan_ms
+            const auto scanDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(scanMs);
+            uint64_t gen = frameGen;
+            bool battle = false;
+            while (gAutoHuntRun && !battle)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(scanDue - std::chrono::steady_clock::now());
+                if (left.count() <= 0)
+                    break;
+                CaptureFrameRef next = gCapture.waitNewer(gen, (int)std::min<long long>(left.count(), 50));
+                if (next && next.generation() > gen)
+                {
+                    gen = next.generation();
+                    battle = battleStarted(next.frame());
+                }
+            }
+            if (battle)
+                break;
+        }
+        gDet.printTimingSummary("[HUNT] Scan timing:");
+        if (gFrameGate)
+            std::printf("[HUNT] Frame gate: enemy full=%llu partial=%llu reused=%llu, battle skipped=%llu\n",
+                        (unsigned long long)gate.full, (unsigned long long)gate.partial,
+                        (unsigned long long)gate.reused, (unsigned long long)gate.battleSkips); });
 }
 
 static void start_auto_hunt_with_saved_config()
@@ -1507,203 +6486,581 @@ static void stop_all_threads()
     stop_auto_hunt();
     stop_cursor_detect_thread();
     stop_abs_poll_thread();
+    stop_capture_service();
     release_move_keys();
 }
 
 // ========================= Record / Play =========================
 
-static bool record_to_file(const char *path)
+// Something that runs alongside a record or playback session (hunt, quest
+// walk, cursor detect). Started after the countdown, stopped in reverse.
+struct Assistant
+{
+    const char *name;
+    std::function<void()> start;
+    std::function<void()> stop;
+};
+
+static Assistant cursor_assistant()
+{
+    return {"cursor", []
+            { start_cursor_detect_thread(); },
+            []
+            { stop_cursor_detect_thread(); }};
+}
+
+static Assistant hunt_assistant(const char *ep, const char *bp, double et, double bt, int sm, int cm)
+{
+    std::string e = ep, b = bp;
+    return {"hunt", [=]
+            { start_auto_hunt(e.c_str(), b.c_str(), et, bt, sm, cm); },
+            []
+            { stop_auto_hunt(); }};
+}
+
+static Assistant quest_assistant(std::shared_ptr<const BankTemplate> questTempl, double markerTh, int deadzonePx, int tickMs)
+{
+    return {"quest", [=]
+            { start_quest_walk(questTempl, markerTh, deadzonePx, tickMs); },
+            []
+            { stop_quest_walk(); }};
+}
+
+static void reset_input_state(bool fromCursor)
 {
     ZeroMemory(gMouseBtn, sizeof(gMouseBtn));
     ZeroMemory(gKeyDown, sizeof(gKeyDown));
     gLastDx = gLastDy = 0;
     gLastWheel = 0;
     gCursorPt = POINT{0, 0};
+    if (fromCursor)
+        GetCursorPos(&gCursorPt);
     gAbsByAlt = false;
     gAbsByCursor = false;
+}
 
-    gOut = std::fopen(path, "wb");
-    if (!gOut)
+// Where replayed events go. emit() may queue; flush() runs once per
+// scheduler quantum.
+class EventSink
+{
+public:
+    virtual ~EventSink() = default;
+    virtual void emit(const Event &e) = 0;
+    virtual void flush() = 0;
+    virtual void printReport(const char *) const {}
+};
+
+// Injects events with batched SendInput and mirrors them into the overlay
+// state; the overlay itself is refreshed by playback_ui_update.
+class SendInputSink : public EventSink
+{
+public:
+    explicit SendInputSink(int coalescePx) : batch_(coalescePx) {}
+
+    void emit(const Event &e) override
     {
-        std::fprintf(stderr, "Cannot open: %s\n", path);
-        return false;
+        INPUT in{};
+        switch (e.type)
+        {
+        case EV_MOUSE_MOVE:
+            batch_.addMoveRel(e.a, e.b);
+            gLastDx = e.a;
+            gLastDy = e.b;
+            break;
+        case EV_MOUSE_POS:
+            if (make_mouse_move_abs(e.a, e.b, in))
+                batch_.add(in);
+            break;
+        case EV_MOUSE_WHEEL:
+            batch_.add(make_mouse_wheel(e.a));
+            gLastWheel = (int)e.a;
+            break;
+        case EV_MOUSE_BUTTON:
+            if (make_mouse_button(e.a, e.b != 0, in))
+                batch_.add(in);
+            if (e.a >= 1 && e.a <= 5)
+                gMouseBtn[e.a] = (e.b != 0);
+            break;
+        case EV_KEY_DOWN:
+        case EV_KEY_UP:
+            batch_.add(make_key(e.type == EV_KEY_DOWN, (UINT)e.a));
+            if (e.a >= 0 && e.a < 256)
+                gKeyDown[e.a] = (e.type == EV_KEY_DOWN);
+            break;
+        default:
+            break;
+        }
     }
+    void flush() override { batch_.flush(); }
+    void printReport(const char *tag) const override { batch_.printReport(tag); }
 
-    static char fileBuf[1 << 20];
-    setvbuf(gOut, fileBuf, _IOFBF, sizeof(fileBuf));
+private:
+    InputBatch batch_;
+};
 
-    FileHeader hdr{};
-    hdr.magic = 0x524D4143;
-    hdr.version = 1;
-    FILETIME ft{};
-    GetSystemTimeAsFileTime(&ft);
-    hdr.start_utc = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
-    fwrite(&hdr, sizeof(hdr), 1, gOut);
-    fflush(gOut);
+// Cursor refresh and message pump at gUiHz rather than once per event;
+// the overlay renderer picks the change up on its own tick.
+static void playback_ui_update(uint64_t nowUs, uint64_t &lastUiUs)
+{
+    if (nowUs - lastUiUs < 1000000ull / (uint64_t)std::max(1, gUiHz))
+        return;
+    lastUiUs = nowUs;
+    GetCursorPos(&gCursorPt);
+    overlay_invalidate();
+    pump_messages_nonblocking();
+}
+
+// Records inputs to a .rmac through the event rings, with optional
+// assistants running during the session.
+class RecordEngine
+{
+public:
+    explicit RecordEngine(const char *tag) : tag_(tag) {}
+
+    void addAssistant(Assistant a) { assistants_.push_back(std::move(a)); }
+
+    bool run(const char *path, const char *countdownMsg, const char *banner)
+    {
+        reset_input_state(false);
+
+        auto writer = std::make_unique<MacroWriter>();
+        if (!writer->open(path, gMacroVersion))
+        {
+            std::fprintf(stderr, "%s Cannot open: %s\n", tag_, path);
+            return false;
+        }
+        gOut = writer.get();
+
+        bool buffered = false;
+        if (!start_record_input(buffered))
+        {
+            gOut = nullptr;
+            return false;
+        }
+        if (!create_overlay_window())
+        {
+            stop_record_input(buffered);
+            gOut = nullptr;
+            return false;
+        }
+
+        QueryPerformanceFrequency(&gFreq);
+        QueryPerformanceCounter(&gT0);
+        timeBeginPeriod(1);
+        start_event_writer();
+        if (!gAbsFromInput)
+            start_abs_poll_thread();
+
+        countdown_3s(countdownMsg);
+        for (auto &a : assistants_)
+            a.start();
+        set_and_wake(gRecording, true);
+        overlay_show(true);
+        std::puts(banner);
+
+        // Buffered input and the overlay live on other threads, so messages
+        // may never arrive here; poll SHIFT on a 50 ms timeout instead
+        MSG msg;
+        bool stop = false;
+        while (!stop)
+        {
+            MsgWaitForMultipleObjects(0, nullptr, FALSE, 50, QS_ALLINPUT);
+            while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+            {
+                if (msg.message == kMsgRecordStop || msg.message == WM_QUIT)
+                {
+                    stop = true;
+                    break;
+                }
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+            if (!stop)
+                maybe_restart_hunt_on_shift();
+        }
+
+        set_and_wake(gRecording, false);
+        overlay_show(false);
+        for (auto it = assistants_.rbegin(); it != assistants_.rend(); ++it)
+            it->stop();
+        stop_all_threads();
+        stop_event_writer();
+        timeEndPeriod(1);
+        gOut = nullptr;
+        writer->close();
+        destroy_overlay_window();
+        stop_record_input(buffered);
+        std::printf("%s Recording stopped.\n", tag_);
+        return true;
+    }
+
+private:
+    const char *tag_;
+    std::vector<Assistant> assistants_;
+};
+
+// Replays a .rmac on QPC deadlines into an EventSink (SendInput by
+// default). Supports a speed multiplier, looping and starting from a
+// timestamp; keys held across the seek point are not re-pressed.
+class PlaybackEngine
+{
+public:
+    explicit PlaybackEngine(const char *tag) : tag_(tag) {}
+
+    void addAssistant(Assistant a) { assistants_.push_back(std::move(a)); }
+    void setSink(EventSink *sink) { sink_ = sink; }
+    void setSpeed(double speed) { speed_ = std::clamp(speed, 0.5, 4.0); }
+    void setLoops(int loops) { loops_ = std::max(0, loops); } // 0 = until ESC
+    void setSeek(uint64_t t_us) { seekUs_ = t_us; }
+    void setHeadless(bool headless) { headless_ = headless; } // no overlay window
+    double speed() const { return speed_; }
+    uint64_t seek() const { return seekUs_; }
+
+    bool open(const char *path)
+    {
+        MacroOpen rc = reader_.open(path);
+        if (rc == MACRO_CANT_OPEN)
+        {
+            std::fprintf(stderr, "%s Cannot open: %s\n", tag_, path);
+            return false;
+        }
+        if (rc != MACRO_OK)
+        {
+            std::fprintf(stderr, "%s Invalid file format.\n", tag_);
+            return false;
+        }
+        std::printf("%s Opened %llu events (%.1fs, v%u, %s) from %s\n", tag_,
+                    (unsigned long long)reader_.size(), reader_.durationUs() / 1e6,
+                    reader_.version(), reader_.mapped() ? "mapped" : "streamed", path);
+        return true;
+    }
+
+    bool run(const char *countdownMsg, const char *banner)
+    {
+        countdown_3s(countdownMsg);
+        std::puts(banner);
+        while (gInput.escDown())
+            Sleep(10);
+
+        reset_input_state(true);
+        bool overlay_ok = !headless_ && create_overlay_window();
+        if (overlay_ok)
+        {
+            overlay_show(true);
+            pump_messages_nonblocking();
+        }
+
+        set_and_wake(gPlaying, true);
+        timeBeginPeriod(1);
+        for (auto &a : assistants_)
+            a.start();
+
+        SendInputSink defaultSink(gCoalescePx);
+        EventSink *sink = sink_ ? sink_ : &defaultSink;
+        if (speed_ != 1.0 || loops_ != 1 || seekUs_)
+            std::printf("%s speed=%.2fx loops=%s seek=%.3fs\n", tag_, speed_,
+                        loops_ ? std::to_string(loops_).c_str() : "inf", seekUs_ / 1e6);
+
+        DeadlineScheduler sched;
+        sched.start();
+        uint64_t lastUiUs = 0;
+        // Quantum is in wall time; compare in recorded time.
+        const uint64_t quantum = (uint64_t)(gPlayQuantumUs * speed_);
+        bool stopped = false;
+        for (int pass = 0; !stopped && (loops_ == 0 || pass < loops_); ++pass)
+        {
+            if (gInput.escDown())
+            {
+                std::printf("%s Stopped by ESC.\n", tag_);
+                break;
+            }
+            reader_.seek(seekUs_);
+            const uint64_t base = sched.nowUs();
+            const Event *pe = reader_.next();
+            if (!pe)
+            {
+                // Empty macro or seek past the end: every pass would be empty
+                std::printf("%s Nothing to play after %.3fs (macro is %.3fs).\n", tag_,
+                            seekUs_ / 1e6, reader_.durationUs() / 1e6);
+                break;
+            }
+            while (pe)
+            {
+                maybe_restart_hunt_on_shift();
+                gAbsByAlt = gInput.altDown();
+                if (gInput.escDown())
+                {
+                    std::printf("%s Stopped by ESC.\n", tag_);
+                    stopped = true;
+                    break;
+                }
+
+                const uint64_t due = pe->t_us;
+                sched.waitUntil(base + (uint64_t)((due - std::min(due, seekUs_)) / speed_));
+                do
+                {
+                    sink->emit(*pe);
+                    pe = reader_.next();
+                } while (pe && pe->t_us < due + quantum);
+                sink->flush();
+                playback_ui_update(sched.nowUs(), lastUiUs);
+            }
+            if (!stopped && loops_ != 1)
+                std::printf("%s Pass %d done.\n", tag_, pass + 1);
+        }
+
+        set_and_wake(gPlaying, false);
+        for (auto it = assistants_.rbegin(); it != assistants_.rend(); ++it)
+            it->stop();
+        stop_all_threads();
+        timeEndPeriod(1);
+        if (overlay_ok)
+        {
+            overlay_show(false);
+            destroy_overlay_window();
+            pump_messages_nonblocking();
+        }
+        sched.printReport(tag_);
+        sink->printReport(tag_);
+        std::printf("%s Done.\n", tag_);
+        return true;
+    }
+
+private:
+    const char *tag_;
+    MacroReader reader_;
+    std::vector<Assistant> assistants_;
+    EventSink *sink_ = nullptr;
+    double speed_ = 1.0;
+    int loops_ = 1;
+    uint64_t seekUs_ = 0;
+    bool headless_ = false;
+};
+
+// Apply --speed / --loop / --seek
+static void configure_playback(PlaybackEngine &engine)
+{
+    engine.setSpeed(gPlaySpeed);
+    engine.setLoops(gPlayLoops);
+    engine.setSeek(gPlaySeekUs);
+}
+
+static bool record_to_file(const char *path)
+{
+    RecordEngine engine("[RECORD]");
+    engine.addAssistant(cursor_assistant());
+    return engine.run(path, "Recording will begin", "Recording... (ESC to stop)");
+}
 
-    if (!create_sink_window())
-        return false;
-    if (!create_overlay_window())
+static bool play_file(const char *path)
+{
+    PlaybackEngine engine("[PLAY]");
+    if (!engine.open(path))
         return false;
+    configure_playback(engine);
+    engine.addAssistant(cursor_assistant());
+    return engine.run("Playback will begin", "Playing... (ESC to stop)");
+}
 
-    QueryPerformanceFrequency(&gFreq);
-    QueryPerformanceCounter(&gT0);
-    timeBeginPeriod(1);
-    start_abs_poll_thread();
-    start_cursor_detect_thread();
-
-    countdown_3s("Recording will begin");
-    gRecording = true;
-    overlay_show(true);
-    std::puts("Recording... (ESC to stop)");
+// ========================= Verify =========================
 
-    MSG msg;
-    while (GetMessage(&msg, nullptr, 0, 0) > 0)
+// Records the injected stream back through the same raw input path as
+// `record`, into capPath, for the whole playback pass.
+static Assistant verify_capture_assistant(std::string capPath)
+{
+    struct State
     {
-        maybe_restart_hunt_on_shift();
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-    }
+        std::unique_ptr<MacroWriter> writer;
+        bool buffered = false, ok = false;
+    };
+    auto st = std::make_shared<State>();
+    return {"verify-capture",
+            [st, capPath]()
+            {
+                st->writer = std::make_unique<MacroWriter>();
+                if (!st->writer->open(capPath.c_str(), 2))
+                {
+                    std::fprintf(stderr, "[VERIFY] Cannot open: %s\n", capPath.c_str());
+                    return;
+                }
+                gOut = st->writer.get();
+                if (!start_record_input(st->buffered))
+                {
+                    gOut = nullptr;
+                    return;
+                }
+                st->ok = true;
+                QueryPerformanceFrequency(&gFreq);
+                QueryPerformanceCounter(&gT0);
+                start_event_writer();
+                set_and_wake(gRecording, true);
+            },
+            [st]()
+            {
+                if (!st->ok)
+                    return;
+                Sleep(50); // let the last injected packets arrive
+                set_and_wake(gRecording, false);
+                stop_event_writer();
+                gOut = nullptr;
+                st->writer->close();
+                stop_record_input(st->buffered);
+            }};
+}
 
-    gRecording = false;
-    overlay_show(false);
-    stop_all_threads();
-    flush_events();
-    timeEndPeriod(1);
-    if (gOut)
+// Identity used to pair an expected event with its captured echo. Moves and
+// positions pair in order of arrival; keys, buttons and wheel by value.
+static uint64_t verify_key(const Event &e)
+{
+    switch (e.type)
     {
-        std::fclose(gOut);
-        gOut = nullptr;
+    case EV_KEY_DOWN:
+    case EV_KEY_UP:
+    case EV_MOUSE_WHEEL:
+        return ((uint64_t)e.type << 40) | (uint32_t)e.a;
+    case EV_MOUSE_BUTTON:
+        return ((uint64_t)e.type << 40) | ((uint64_t)(uint32_t)e.a << 1) | (e.b ? 1u : 0u);
+    default:
+        return (uint64_t)e.type << 40;
     }
-    destroy_overlay_window();
-    destroy_sink_window();
-    std::puts("Recording stopped.");
-    return true;
 }
 
-static bool play_file(const char *path)
+static bool load_macro_events(const char *path, std::vector<Event> &out)
 {
-    FILE *in = std::fopen(path, "rb");
-    if (!in)
-    {
-        std::fprintf(stderr, "Cannot open: %s\n", path);
-        return false;
-    }
-    FileHeader hdr{};
-    if (read_exact(in, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != 0x524D4143)
+    MacroReader r;
+    if (r.open(path) != MACRO_OK)
     {
-        std::fprintf(stderr, "Invalid format.\n");
-        std::fclose(in);
+        std::fprintf(stderr, "[VERIFY] Cannot read: %s\n", path);
         return false;
     }
-    std::vector<Event> events;
-    Event ev{};
-    while (read_exact(in, &ev, sizeof(ev)) == sizeof(ev))
-        events.push_back(ev);
-    std::fclose(in);
-
-    countdown_3s("Playback will begin");
-    std::puts("Playing... (ESC to stop)");
-    while (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
-        Sleep(10);
-
-    ZeroMemory(gMouseBtn, sizeof(gMouseBtn));
-    ZeroMemory(gKeyDown, sizeof(gKeyDown));
-    gLastDx = gLastDy = 0;
-    gLastWheel = 0;
-    GetCursorPos(&gCursorPt);
-    gAbsByAlt = false;
-    gAbsByCursor = false;
-
-    bool overlay_ok = create_overlay_window();
-    if (overlay_ok)
-    {
-        overlay_show(true);
-        pump_messages_nonblocking();
-    }
-
-    gPlaying = true;
-    timeBeginPeriod(1);
-    start_cursor_detect_thread();
+    out.clear();
+    out.reserve((size_t)r.size());
+    while (const Event *e = r.next())
+        out.push_back(*e);
+    return true;
+}
 
-    uint64_t prev_t = 0;
-    for (size_t i = 0; i < events.size(); ++i)
+// Pairs expected (file, from seek, scaled by speed) with captured events and
+// reports per-event timing error relative to the first pair, reordering,
+// drift and stream losses.
+static bool verify_compare(const char *expPath, const char *capPath, double speed, uint64_t seekUs)
+{
+    std::vector<Event> exp, cap;
+    if (!load_macro_events(expPath, exp) || !load_macro_events(capPath, cap))
+        return false;
+    exp.erase(exp.begin(), std::lower_bound(exp.begin(), exp.end(), seekUs,
+                                            [](const Event &e, uint64_t t) { return e.t_us < t; }));
+
+    std::map<uint64_t, std::deque<size_t>> pending;
+    for (size_t j = 0; j < cap.size(); ++j)
+        pending[verify_key(cap[j])].push_back(j);
+
+    struct Pair { size_t e, c; };
+    std::vector<Pair> pairs;
+    uint64_t missing[6] = {}, moveMismatch = 0;
+    int64_t expDx = 0, expDy = 0, capDx = 0, capDy = 0;
+    for (size_t i = 0; i < exp.size(); ++i)
     {
-        maybe_restart_hunt_on_shift();
-        gAbsByAlt = ((GetAsyncKeyState(VK_MENU) & 0x8000) != 0);
-        if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
+        const Event &e = exp[i];
+        if (e.type == EV_MOUSE_MOVE)
         {
-            std::puts("\nStopped by ESC.");
-            break;
+            expDx += e.a;
+            expDy += e.b;
         }
-
-        const Event &e = events[i];
-        if (e.t_us > prev_t)
-            std::this_thread::sleep_for(std::chrono::microseconds(e.t_us - prev_t));
-        prev_t = e.t_us;
-
-        switch (e.type)
+        auto it = pending.find(verify_key(e));
+        if (it == pending.end() || it->second.empty())
         {
-        case EV_MOUSE_MOVE:
-            send_mouse_move_rel(e.a, e.b);
-            GetCursorPos(&gCursorPt);
-            gLastDx = e.a;
-            gLastDy = e.b;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_POS:
-            send_mouse_move_abs(e.a, e.b);
-            gCursorPt.x = e.a;
-            gCursorPt.y = e.b;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_WHEEL:
-            send_mouse_wheel(e.a);
-            gLastWheel = (int)e.a;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_BUTTON:
-            send_mouse_button(e.a, e.b != 0);
-            if (e.a >= 1 && e.a <= 5)
-                gMouseBtn[e.a] = (e.b != 0);
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_KEY_DOWN:
-            send_key(true, (UINT)e.a);
-            update_overlay_state_on_key((UINT)e.a, true);
-            pump_messages_nonblocking();
-            break;
-        case EV_KEY_UP:
-            send_key(false, (UINT)e.a);
-            update_overlay_state_on_key((UINT)e.a, false);
-            pump_messages_nonblocking();
-            break;
-        default:
-            break;
+            ++missing[std::min<uint32_t>(e.type, 5)];
+            continue;
         }
+        size_t j = it->second.front();
+        it->second.pop_front();
+        if (e.type == EV_MOUSE_MOVE && (cap[j].a != e.a || cap[j].b != e.b))
+            ++moveMismatch;
+        pairs.push_back({i, j});
     }
+    uint64_t extra = 0;
+    for (const auto &kv : pending)
+        extra += kv.second.size();
+    for (const Event &c : cap)
+        if (c.type == EV_MOUSE_MOVE)
+        {
+            capDx += c.a;
+            capDy += c.b;
+        }
 
-    gPlaying = false;
-    stop_all_threads();
-    timeEndPeriod(1);
-    if (overlay_ok)
+    std::printf("[VERIFY] expected=%zu captured=%zu paired=%zu extra=%llu\n",
+                exp.size(), cap.size(), pairs.size(), (unsigned long long)extra);
+    static const char *kTypeName[6] = {"move", "wheel", "keydown", "keyup", "button", "pos"};
+    for (int t = 0; t < 6; ++t)
+        if (missing[t])
+            std::printf("[VERIFY]   missing %-7s %llu\n", kTypeName[t], (unsigned long long)missing[t]);
+    std::printf("[VERIFY] REL totals expected=(%lld,%lld) captured=(%lld,%lld), %llu moves with different deltas\n",
+                (long long)expDx, (long long)expDy, (long long)capDx, (long long)capDy,
+                (unsigned long long)moveMismatch);
+    if (pairs.size() < 2)
+        return pairs.size() == exp.size();
+
+    // Error of each pair against the first one, in wall-clock microseconds
+    const double e0 = (double)exp[pairs[0].e].t_us, c0 = (double)cap[pairs[0].c].t_us;
+    std::vector<double> err, absErr;
+    err.reserve(pairs.size());
+    size_t reordered = 0, maxCap = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const Pair &p : pairs)
     {
-        overlay_show(false);
-        destroy_overlay_window();
-        pump_messages_nonblocking();
+        double x = (exp[p.e].t_us - e0) / speed;
+        double y = (cap[p.c].t_us - c0) - x;
+        err.push_back(y);
+        absErr.push_back(std::fabs(y));
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
+        if (p.c < maxCap)
+            ++reordered; // echo arrived before one of an earlier expected event
+        maxCap = std::max(maxCap, p.c);
+    }
+    const double n = (double)err.size();
+    const double slope = (n * sxx - sx * sx) > 0 ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 0.0;
+    std::sort(absErr.begin(), absErr.end());
+    auto pct = [&](double q) { return absErr[std::min(absErr.size() - 1, (size_t)(q * (absErr.size() - 1) + 0.5))]; };
+    std::printf("[VERIFY] |timing error| p50=%.0fus p95=%.0fus p99=%.0fus max=%.0fus  mean=%+.0fus\n",
+                pct(0.50), pct(0.95), pct(0.99), absErr.back(), sy / n);
+    std::printf("[VERIFY] drift %+.2f ms/min over %.1fs, reordered=%zu\n",
+                slope * 60000.0, ((exp[pairs.back().e].t_us - e0) / speed) / 1e6, reordered);
+
+    static const double kBucketUs[] = {100, 250, 500, 1000, 2000, 5000, 10000};
+    size_t lo = 0;
+    std::printf("[VERIFY] error histogram:");
+    for (double edge : kBucketUs)
+    {
+        size_t hi = std::upper_bound(absErr.begin(), absErr.end(), edge) - absErr.begin();
+        std::printf(" <=%.0fus:%zu", edge, hi - lo);
+        lo = hi;
     }
-    std::puts("Done.");
+    std::printf(" more:%zu\n", absErr.size() - lo);
     return true;
 }
 
+// Plays path once (honouring --speed/--seek), captures the injected input
+// through the raw input sink into <path>.verify.rmac, then diffs the two.
+static bool verify_playback(const char *path)
+{
+    std::string capPath = std::string(path) + ".verify.rmac";
+    PlaybackEngine engine("[VERIFY]");
+    if (!engine.open(path))
+        return false;
+    configure_playback(engine);
+    engine.setLoops(1);
+    engine.setHeadless(true);
+    engine.addAssistant(verify_capture_assistant(capPath));
+    if (!engine.run("Verify playback will begin", "Verifying... (ESC to stop)"))
+        return false;
+    std::printf("[VERIFY] Captured stream: %s\n", capPath.c_str());
+    return verify_compare(path, capPath.c_str(), engine.speed(), engine.seek());
+}
+
 // ========================= Hunt wrappers =========================
 
-static bool record_hunt(const char *file, const char *ep, const char *bp,
-                        double et, double bt, int sm, int cm)
+static void set_hunt_config(const char *ep, const char *bp, double et, double bt, int sm, int cm)
 {
     gEnemyTemplatesPath = ep;
     gBattleStartPath = bp;
@@ -1711,26 +7068,34 @@ static bool record_hunt(const char *file, const char *ep, const char *bp,
     gBattleTh = bt;
     gScanMs = sm;
     gCooldownMs = cm;
-    start_auto_hunt(ep, bp, et, bt, sm, cm);
-    return record_to_file(file);
+}
+
+static bool record_hunt(const char *file, const char *ep, const char *bp,
+                        double et, double bt, int sm, int cm)
+{
+    set_hunt_config(ep, bp, et, bt, sm, cm);
+    RecordEngine engine("[RECORD]");
+    engine.addAssistant(cursor_assistant());
+    engine.addAssistant(hunt_assistant(ep, bp, et, bt, sm, cm));
+    return engine.run(file, "Recording + Hunt will begin", "Recording + Hunt... (ESC to stop)");
 }
 
 static bool play_hunt(const char *file, const char *ep, const char *bp,
                       double et, double bt, int sm, int cm)
 {
-    gEnemyTemplatesPath = ep;
-    gBattleStartPath = bp;
-    gEnemyTh = et;
-    gBattleTh = bt;
-    gScanMs = sm;
-    gCooldownMs = cm;
-    start_auto_hunt(ep, bp, et, bt, sm, cm);
-    return play_file(file);
+    set_hunt_config(ep, bp, et, bt, sm, cm);
+    PlaybackEngine engine("[PLAY]");
+    if (!engine.open(file))
+        return false;
+    configure_playback(engine);
+    engine.addAssistant(cursor_assistant());
+    engine.addAssistant(hunt_assistant(ep, bp, et, bt, sm, cm));
+    return engine.run("Playback + Hunt will begin", "Playing + Hunt... (ESC to stop)");
 }
 
 // ========================= Standalone quest walk =========================
 
-static void quest_walk_standalone(const cv::Mat &questTempl, double markerTh, int deadzonePx, int tickMs)
+static void quest_walk_standalone(const std::shared_ptr<const BankTemplate> &questTempl, double markerTh, int deadzonePx, int tickMs)
 {
     bool overlay_ok = create_overlay_window();
     if (overlay_ok)
@@ -1742,16 +7107,17 @@ static void quest_walk_standalone(const cv::Mat &questTempl, double markerTh, in
     start_quest_walk(questTempl, markerTh, deadzonePx, tickMs);
     while (gRunQuestWalk.load())
     {
-        if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
+        if (gInput.escDown())
         {
             stop_quest_walk();
             break;
         }
         pump_messages_nonblocking();
-        Sleep(50);
+        gWake.sleepFor(50, [] { return !gRunQuestWalk || gInput.escDown(); });
     }
     if (gQuestWalkThread.joinable())
         gQuestWalkThread.join();
+    stop_capture_service();
     timeEndPeriod(1);
     if (overlay_ok)
     {
@@ -1771,83 +7137,14 @@ static bool run_full_integrated(const char *macroFile)
     gBattleStartPath = kDefaultBattlePath;
     gAbsCursorTemplatePath = kDefaultCursorPath;
 
-    ZeroMemory(gMouseBtn, sizeof(gMouseBtn));
-    ZeroMemory(gKeyDown, sizeof(gKeyDown));
-    gLastDx = gLastDy = 0;
-    gLastWheel = 0;
-    gCursorPt = POINT{0, 0};
-    gAbsByAlt = false;
-    gAbsByCursor = false;
-
-    gOut = std::fopen(macroFile, "wb");
-    if (!gOut)
-    {
-        std::fprintf(stderr, "[FULL] Cannot open: %s\n", macroFile);
-        return false;
-    }
-
-    static char fileBuf[1 << 20];
-    setvbuf(gOut, fileBuf, _IOFBF, sizeof(fileBuf));
-    FileHeader hdr{};
-    hdr.magic = 0x524D4143;
-    hdr.version = 1;
-    FILETIME ft{};
-    GetSystemTimeAsFileTime(&ft);
-    hdr.start_utc = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
-    fwrite(&hdr, sizeof(hdr), 1, gOut);
-    fflush(gOut);
-
-    if (!create_sink_window())
-    {
-        std::fclose(gOut);
-        gOut = nullptr;
-        return false;
-    }
-    if (!create_overlay_window())
-    {
-        destroy_sink_window();
-        std::fclose(gOut);
-        gOut = nullptr;
-        return false;
-    }
-
-    QueryPerformanceFrequency(&gFreq);
-    QueryPerformanceCounter(&gT0);
-    timeBeginPeriod(1);
-
-    start_abs_poll_thread();
-    start_cursor_detect_thread();
+    RecordEngine engine("[FULL]");
+    engine.addAssistant(cursor_assistant());
     // Hunt runs during recording so enemies are detected while you play manually
-    start_auto_hunt(kDefaultEnemyPath, kDefaultBattlePath, gEnemyTh, gBattleTh, gScanMs, gCooldownMs);
+    engine.addAssistant(hunt_assistant(kDefaultEnemyPath, kDefaultBattlePath, gEnemyTh, gBattleTh, gScanMs, gCooldownMs));
     // Quest walk is NOT started here - use playfull for guided replay
-
-    countdown_3s("[FULL] Recording + Hunt (no quest walk - use playfull to replay)");
-    gRecording = true;
-    overlay_show(true);
-    std::puts("[FULL] Recording. ESC to stop. Use playfull to replay with quest walk.");
-
-    MSG msg;
-    while (GetMessage(&msg, nullptr, 0, 0) > 0)
-    {
-        maybe_restart_hunt_on_shift();
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-    }
-
-    gRecording = false;
-    overlay_show(false);
-    stop_all_threads();
-    flush_events();
-    timeEndPeriod(1);
-    if (gOut)
-    {
-        std::fclose(gOut);
-        gOut = nullptr;
-    }
-    destroy_overlay_window();
-    destroy_sink_window();
-    std::puts("[FULL] Recording stopped.");
-    return true;
+    return engine.run(macroFile,
+                      "[FULL] Recording + Hunt (no quest walk - use playfull to replay)",
+                      "[FULL] Recording. ESC to stop. Use playfull to replay with quest walk.");
 }
 
 // ========================= Play full (replay + hunt + quest walk) =========================
@@ -1861,151 +7158,30 @@ static bool play_full(const char *macroFile,
                       double enemyTh, double battleTh, int scanMs, int cooldownMs)
 {
     // Load quest marker template
-    cv::Mat questTempl = cv::imread(kDefaultQuestPath, cv::IMREAD_COLOR);
-    if (questTempl.empty())
+    auto questTempl = gBank.load(kDefaultQuestPath, BankOptions{});
+    if (!questTempl)
     {
         std::fprintf(stderr, "[PLAYFULL] Failed to load quest marker: %s\n", kDefaultQuestPath);
         return false;
     }
-
-    // Load macro file
-    FILE *in = std::fopen(macroFile, "rb");
-    if (!in)
-    {
-        std::fprintf(stderr, "[PLAYFULL] Cannot open: %s\n", macroFile);
-        return false;
-    }
-
-    FileHeader hdr{};
-    if (read_exact(in, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != 0x524D4143)
-    {
-        std::fprintf(stderr, "[PLAYFULL] Invalid file format.\n");
-        std::fclose(in);
-        return false;
-    }
-
-    std::vector<Event> events;
-    Event ev{};
-    while (read_exact(in, &ev, sizeof(ev)) == sizeof(ev))
-        events.push_back(ev);
-    std::fclose(in);
-    std::printf("[PLAYFULL] Loaded %zu events from %s\n", events.size(), macroFile);
-
-    // Setup hunt config
-    gEnemyTemplatesPath = kDefaultEnemyPath;
-    gBattleStartPath = kDefaultBattlePath;
-    gAbsCursorTemplatePath = kDefaultCursorPath;
-    gEnemyTh = enemyTh;
-    gBattleTh = battleTh;
-    gScanMs = scanMs;
-    gCooldownMs = cooldownMs;
-    gMarkerTh = markerTh;
-    gDeadzonePx = deadzonePx;
-    gQuestTickMs = tickMs;
-
-    countdown_3s("[PLAYFULL] Playback + Hunt + QuestWalk begin");
-    std::puts("[PLAYFULL] Running. ESC to stop.");
-    while (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
-        Sleep(10);
-
-    ZeroMemory(gMouseBtn, sizeof(gMouseBtn));
-    ZeroMemory(gKeyDown, sizeof(gKeyDown));
-    gLastDx = gLastDy = 0;
-    gLastWheel = 0;
-    GetCursorPos(&gCursorPt);
-    gAbsByAlt = false;
-    gAbsByCursor = false;
-
-    bool overlay_ok = create_overlay_window();
-    if (overlay_ok)
-    {
-        overlay_show(true);
-        pump_messages_nonblocking();
-    }
-
-    gPlaying = true;
-    timeBeginPeriod(1);
-
-    // Start all assistance threads
-    start_cursor_detect_thread();
-    start_auto_hunt(kDefaultEnemyPath, kDefaultBattlePath, enemyTh, battleTh, scanMs, cooldownMs);
-    start_quest_walk(questTempl, markerTh, deadzonePx, tickMs);
-
-    // Replay macro events
-    uint64_t prev_t = 0;
-    for (size_t i = 0; i < events.size(); ++i)
-    {
-        maybe_restart_hunt_on_shift();
-        gAbsByAlt = ((GetAsyncKeyState(VK_MENU) & 0x8000) != 0);
-
-        if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
-        {
-            std::puts("[PLAYFULL] Stopped by ESC.");
-            break;
-        }
-
-        const Event &e = events[i];
-        if (e.t_us > prev_t)
-            std::this_thread::sleep_for(std::chrono::microseconds(e.t_us - prev_t));
-        prev_t = e.t_us;
-
-        switch (e.type)
-        {
-        case EV_MOUSE_MOVE:
-            send_mouse_move_rel(e.a, e.b);
-            GetCursorPos(&gCursorPt);
-            gLastDx = e.a;
-            gLastDy = e.b;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_POS:
-            send_mouse_move_abs(e.a, e.b);
-            gCursorPt.x = e.a;
-            gCursorPt.y = e.b;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_WHEEL:
-            send_mouse_wheel(e.a);
-            gLastWheel = (int)e.a;
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_MOUSE_BUTTON:
-            send_mouse_button(e.a, e.b != 0);
-            if (e.a >= 1 && e.a <= 5)
-                gMouseBtn[e.a] = (e.b != 0);
-            overlay_invalidate();
-            pump_messages_nonblocking();
-            break;
-        case EV_KEY_DOWN:
-            send_key(true, (UINT)e.a);
-            update_overlay_state_on_key((UINT)e.a, true);
-            pump_messages_nonblocking();
-            break;
-        case EV_KEY_UP:
-            send_key(false, (UINT)e.a);
-            update_overlay_state_on_key((UINT)e.a, false);
-            pump_messages_nonblocking();
-            break;
-        default:
-            break;
-        }
-    }
-
-    gPlaying = false;
-    stop_all_threads();
-    timeEndPeriod(1);
-
-    if (overlay_ok)
-    {
-        overlay_show(false);
-        destroy_overlay_window();
-        pump_messages_nonblocking();
-    }
-    std::puts("[PLAYFULL] Done.");
-    return true;
+
+    PlaybackEngine engine("[PLAYFULL]");
+    if (!engine.open(macroFile))
+        return false;
+    configure_playback(engine);
+
+    // Setup hunt config
+    gAbsCursorTemplatePath = kDefaultCursorPath;
+    set_hunt_config(kDefaultEnemyPath, kDefaultBattlePath, enemyTh, battleTh, scanMs, cooldownMs);
+    gMarkerTh = markerTh;
+    gDeadzonePx = deadzonePx;
+    gQuestTickMs = tickMs;
+
+    // All assistance threads
+    engine.addAssistant(cursor_assistant());
+    engine.addAssistant(hunt_assistant(kDefaultEnemyPath, kDefaultBattlePath, enemyTh, battleTh, scanMs, cooldownMs));
+    engine.addAssistant(quest_assistant(questTempl, markerTh, deadzonePx, tickMs));
+    return engine.run("[PLAYFULL] Playback + Hunt + QuestWalk begin", "[PLAYFULL] Running. ESC to stop.");
 }
 
 // ========================= Export / Import (text editing) =========================
@@ -2122,17 +7298,79 @@ static const char *vk_name(int vk)
     case VK_RMENU:
         return "RALT";
     default:
-        // Printable ASCII
+        // Printable ASCII (one string per char: export formats on several threads)
         if (vk >= 0x20 && vk <= 0x7E)
         {
-            static char buf[2] = {0, 0};
-            buf[0] = (char)vk;
-            return buf;
+            static const auto chars = []
+            {
+                std::array<std::array<char, 2>, 0x7F> t{};
+                for (int i = 0; i < 0x7F; ++i)
+                    t[i][0] = (char)i;
+                return t;
+            }();
+            return chars[vk].data();
         }
         return "UNKNOWN";
     }
 }
 
+// Names vk_name() produces, looked up case-insensitively through a perfect
+// hash: the seed is searched once so every name owns its slot, and a lookup
+// is one hash, one slot and one compare.
+class VkNameTable
+{
+public:
+    VkNameTable()
+    {
+        for (seed_ = 2166136261u;; ++seed_)
+        {
+            slots_.fill(nullptr);
+            bool ok = true;
+            for (const auto &e : kEntries)
+            {
+                const Entry *&s = slots_[hash(e.n, seed_) % kSlots];
+                if (s)
+                {
+                    ok = false;
+                    break;
+                }
+                s = &e;
+            }
+            if (ok)
+                return;
+        }
+    }
+
+    // VK code, or -1 when name isn't in the table
+    int find(const char *name) const
+    {
+        const Entry *e = slots_[hash(name, seed_) % kSlots];
+        return (e && _stricmp(e->n, name) == 0) ? e->v : -1;
+    }
+
+private:
+    struct Entry
+    {
+        const char *n;
+        int v;
+    };
+    static constexpr Entry kEntries[] = {
+        {"LBUTTON", VK_LBUTTON}, {"RBUTTON", VK_RBUTTON}, {"MBUTTON", VK_MBUTTON}, {"BACKSPACE", VK_BACK}, {"TAB", VK_TAB}, {"ENTER", VK_RETURN}, {"SHIFT", VK_SHIFT}, {"CTRL", VK_CONTROL}, {"ALT", VK_MENU}, {"PAUSE", VK_PAUSE}, {"CAPSLOCK", VK_CAPITAL}, {"ESCAPE", VK_ESCAPE}, {"SPACE", VK_SPACE}, {"PAGEUP", VK_PRIOR}, {"PAGEDOWN", VK_NEXT}, {"END", VK_END}, {"HOME", VK_HOME}, {"LEFT", VK_LEFT}, {"UP", VK_UP}, {"RIGHT", VK_RIGHT}, {"DOWN", VK_DOWN}, {"INSERT", VK_INSERT}, {"DELETE", VK_DELETE}, {"LWIN", VK_LWIN}, {"RWIN", VK_RWIN}, {"NUMPAD0", VK_NUMPAD0}, {"NUMPAD1", VK_NUMPAD1}, {"NUMPAD2", VK_NUMPAD2}, {"NUMPAD3", VK_NUMPAD3}, {"NUMPAD4", VK_NUMPAD4}, {"NUMPAD5", VK_NUMPAD5}, {"NUMPAD6", VK_NUMPAD6}, {"NUMPAD7", VK_NUMPAD7}, {"NUMPAD8", VK_NUMPAD8}, {"NUMPAD9", VK_NUMPAD9}, {"F1", VK_F1}, {"F2", VK_F2}, {"F3", VK_F3}, {"F4", VK_F4}, {"F5", VK_F5}, {"F6", VK_F6}, {"F7", VK_F7}, {"F8", VK_F8}, {"F9", VK_F9}, {"F10", VK_F10}, {"F11", VK_F11}, {"F12", VK_F12}, {"LSHIFT", VK_LSHIFT}, {"RSHIFT", VK_RSHIFT}, {"LCTRL", VK_LCONTROL}, {"RCTRL", VK_RCONTROL}, {"LALT", VK_LMENU}, {"RALT", VK_RMENU}};
+    static constexpr int kSlots = 256;
+
+    // FNV-1a over the upper-cased name
+    static uint32_t hash(const char *s, uint32_t seed)
+    {
+        uint32_t h = seed;
+        for (; *s; ++s)
+            h = (h ^ (uint8_t)std::toupper((unsigned char)*s)) * 16777619u;
+        return h;
+    }
+
+    uint32_t seed_ = 0;
+    std::array<const Entry *, kSlots> slots_{};
+};
+
 // Resolve a name back to VK code - handles names from vk_name() above
 static int vk_from_name(const char *name)
 {
@@ -2140,46 +7378,298 @@ static int vk_from_name(const char *name)
     if (name[0] && !name[1])
         return (int)(unsigned char)name[0];
 
-    struct
-    {
-        const char *n;
-        int v;
-    } table[] = {
-        {"LBUTTON", VK_LBUTTON}, {"RBUTTON", VK_RBUTTON}, {"MBUTTON", VK_MBUTTON}, {"BACKSPACE", VK_BACK}, {"TAB", VK_TAB}, {"ENTER", VK_RETURN}, {"SHIFT", VK_SHIFT}, {"CTRL", VK_CONTROL}, {"ALT", VK_MENU}, {"PAUSE", VK_PAUSE}, {"CAPSLOCK", VK_CAPITAL}, {"ESCAPE", VK_ESCAPE}, {"SPACE", VK_SPACE}, {"PAGEUP", VK_PRIOR}, {"PAGEDOWN", VK_NEXT}, {"END", VK_END}, {"HOME", VK_HOME}, {"LEFT", VK_LEFT}, {"UP", VK_UP}, {"RIGHT", VK_RIGHT}, {"DOWN", VK_DOWN}, {"INSERT", VK_INSERT}, {"DELETE", VK_DELETE}, {"LWIN", VK_LWIN}, {"RWIN", VK_RWIN}, {"NUMPAD0", VK_NUMPAD0}, {"NUMPAD1", VK_NUMPAD1}, {"NUMPAD2", VK_NUMPAD2}, {"NUMPAD3", VK_NUMPAD3}, {"NUMPAD4", VK_NUMPAD4}, {"NUMPAD5", VK_NUMPAD5}, {"NUMPAD6", VK_NUMPAD6}, {"NUMPAD7", VK_NUMPAD7}, {"NUMPAD8", VK_NUMPAD8}, {"NUMPAD9", VK_NUMPAD9}, {"F1", VK_F1}, {"F2", VK_F2}, {"F3", VK_F3}, {"F4", VK_F4}, {"F5", VK_F5}, {"F6", VK_F6}, {"F7", VK_F7}, {"F8", VK_F8}, {"F9", VK_F9}, {"F10", VK_F10}, {"F11", VK_F11}, {"F12", VK_F12}, {"LSHIFT", VK_LSHIFT}, {"RSHIFT", VK_RSHIFT}, {"LCTRL", VK_LCONTROL}, {"RCTRL", VK_RCONTROL}, {"LALT", VK_LMENU}, {"RALT", VK_RMENU}, {nullptr, 0}};
-    for (int i = 0; table[i].n; ++i)
-        if (_stricmp(name, table[i].n) == 0)
-            return table[i].v;
+    static const VkNameTable table;
+    int v = table.find(name);
+    if (v >= 0)
+        return v;
 
     // Fallback: try as decimal number
     return std::atoi(name);
 }
 
+// ---- Chunked text formatting / parsing ----
+// Export and import split the event stream into chunks that a WorkerPool
+// formats or parses in parallel; chunks are written / merged in order, so
+// the output is identical to a single-threaded run.
+
+static const size_t kTextChunkEvents = 16384;     // export: events per formatting task
+static const size_t kTextMaxLine = 256;           // longest formatted event line
+static const size_t kTextReadBlock = 8u << 20;    // import: bytes read per parallel round
+
+static int text_workers()
+{
+    return (int)std::clamp(std::thread::hardware_concurrency(), 1u, 16u);
+}
+
+// printf "%-*d" / "%-*llu" with to_chars: v left-aligned, padded to w
+template <class T>
+static char *put_field(char *p, T v, int w)
+{
+    char *s = p;
+    p = std::to_chars(p, p + 24, v).ptr;
+    while (p - s < w)
+        *p++ = ' ';
+    return p;
+}
+
+static char *put_str(char *p, const char *str, int w = 0)
+{
+    char *s = p;
+    while (*str)
+        *p++ = *str++;
+    while (p - s < w)
+        *p++ = ' ';
+    return p;
+}
+
+// One event as "%-17llu %-14s %-7d %-7d %-7d  %s\n" (comment included)
+static char *format_event_line(char *p, const Event &e)
+{
+    const char *evName = "UNKNOWN";
+    switch (e.type)
+    {
+    case EV_MOUSE_MOVE: evName = "MOUSE_MOVE"; break;
+    case EV_MOUSE_POS: evName = "MOUSE_POS"; break;
+    case EV_MOUSE_WHEEL: evName = "MOUSE_WHEEL"; break;
+    case EV_MOUSE_BUTTON: evName = "MOUSE_BUTTON"; break;
+    case EV_KEY_DOWN: evName = "KEY_DOWN"; break;
+    case EV_KEY_UP: evName = "KEY_UP"; break;
+    }
+    p = put_field(p, (unsigned long long)e.t_us, 17);
+    *p++ = ' ';
+    p = put_str(p, evName, 14);
+    *p++ = ' ';
+    p = put_field(p, e.a, 7);
+    *p++ = ' ';
+    p = put_field(p, e.b, 7);
+    *p++ = ' ';
+    p = put_field(p, e.c, 7);
+    p = put_str(p, "  ");
+
+    switch (e.type)
+    {
+    case EV_MOUSE_MOVE:
+        p = put_field(put_str(p, "# REL dx="), e.a, 0);
+        p = put_field(put_str(p, " dy="), e.b, 0);
+        break;
+    case EV_MOUSE_POS:
+        p = put_field(put_str(p, "# ABS x="), e.a, 0);
+        p = put_field(put_str(p, " y="), e.b, 0);
+        break;
+    case EV_MOUSE_WHEEL:
+        p = put_field(put_str(p, "# delta="), e.a, 0);
+        p = put_str(p, e.a > 0 ? " (up)" : " (down)");
+        break;
+    case EV_MOUSE_BUTTON:
+    {
+        const char *btnName = (e.a == 1 ? "LEFT" : e.a == 2 ? "RIGHT"
+                                               : e.a == 3   ? "MIDDLE"
+                                               : e.a == 4   ? "X1"
+                                               : e.a == 5   ? "X2"
+                                                            : "?");
+        p = put_str(put_str(put_str(p, "# "), btnName), e.b ? " DOWN" : " UP");
+        break;
+    }
+    case EV_KEY_DOWN:
+    case EV_KEY_UP:
+        p = put_str(put_str(p, "# "), vk_name(e.a));
+        break;
+    }
+    *p++ = '\n';
+    return p;
+}
+
+// Streams the reader's events out in rounds of workers x kTextChunkEvents
+static uint64_t export_events(MacroReader &reader, FILE *out)
+{
+    WorkerPool pool;
+    pool.start(text_workers());
+    const int nChunks = pool.size();
+    std::vector<std::vector<Event>> in(nChunks);
+    std::vector<std::vector<char>> text(nChunks);
+    std::vector<size_t> used(nChunks);
+    uint64_t total = 0;
+    for (bool more = true; more;)
+    {
+        int filled = 0;
+        for (; filled < nChunks && more; ++filled)
+        {
+            in[filled].clear();
+            while (in[filled].size() < kTextChunkEvents)
+            {
+                const Event *pe = reader.next();
+                if (!pe)
+                {
+                    more = false;
+                    break;
+                }
+                in[filled].push_back(*pe);
+            }
+        }
+        pool.run(filled, [&](int k, int)
+                 {
+            text[k].resize(in[k].size() * kTextMaxLine);
+            char *p = text[k].data();
+            for (const Event &e : in[k])
+                p = format_event_line(p, e);
+            used[k] = (size_t)(p - text[k].data()); });
+        for (int k = 0; k < filled; ++k)
+        {
+            std::fwrite(text[k].data(), 1, used[k], out);
+            total += in[k].size();
+        }
+    }
+    return total;
+}
+
+// Events parsed from one slice of the text, plus everything the ordered
+// merge needs: SCALE directives by event index and messages by line
+struct ImportChunk
+{
+    const char *begin = nullptr, *end = nullptr;
+    std::vector<Event> events;
+    std::vector<std::pair<size_t, double>> scales; // (events.size() at the directive, scale)
+    std::vector<std::pair<int, std::string>> errors; // (line within chunk, message)
+    int lines = 0;
+    int skipped = 0;
+};
+
+static uint32_t event_type_from_name(const char *n)
+{
+    if (_stricmp(n, "MOUSE_MOVE") == 0)
+        return EV_MOUSE_MOVE;
+    if (_stricmp(n, "MOUSE_POS") == 0)
+        return EV_MOUSE_POS;
+    if (_stricmp(n, "MOUSE_WHEEL") == 0)
+        return EV_MOUSE_WHEEL;
+    if (_stricmp(n, "MOUSE_BUTTON") == 0)
+        return EV_MOUSE_BUTTON;
+    if (_stricmp(n, "KEY_DOWN") == 0)
+        return EV_KEY_DOWN;
+    if (_stricmp(n, "KEY_UP") == 0)
+        return EV_KEY_UP;
+    return 0xFFFFFFFF;
+}
+
+// Like atoi: optional sign and leading digits, 0 when there are none
+static int text_atoi(const char *s, const char *end)
+{
+    if (s < end && *s == '+')
+        ++s;
+    int v = 0;
+    std::from_chars(s, end, v);
+    return v;
+}
+
+// A or B column: a number, or a key name when it doesn't read as one
+static int parse_key_or_number(const char *tok)
+{
+    int v = text_atoi(tok, tok + std::strlen(tok));
+    if (v == 0 && tok[0] != '0')
+        v = vk_from_name(tok);
+    return v;
+}
+
+static void parse_import_chunk(ImportChunk &ck)
+{
+    for (const char *ln = ck.begin; ln < ck.end;)
+    {
+        const char *eol = (const char *)std::memchr(ln, '\n', (size_t)(ck.end - ln));
+        const char *next = eol ? eol + 1 : ck.end;
+        ++ck.lines;
+        const char *lineStart = ln;
+        const char *p = ln;
+        const char *lineEnd = eol ? eol : ck.end;
+        ln = next;
+
+        // Strip leading whitespace; skip empty lines
+        while (p < lineEnd && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p == lineEnd || *p == '\r')
+            continue;
+
+        // Check for SCALE directive in comments ("# SCALE 0.95" anywhere in the line)
+        if (*p == '#')
+        {
+            std::string_view line(p, (size_t)(lineEnd - p));
+            size_t at = line.find("SCALE");
+            if (at != std::string_view::npos)
+            {
+                const char *sc = p + at + 5;
+                while (sc < lineEnd && (*sc == ' ' || *sc == '\t'))
+                    ++sc;
+                double s = 0;
+                std::from_chars(sc, lineEnd, s);
+                if (s > 0.01 && s < 100.0)
+                    ck.scales.emplace_back(ck.events.size(), s);
+            }
+            continue;
+        }
+
+        // Parse: TIME_US  EVENT  A  B  C  [# comment...]
+        char tok[4][32] = {};
+        int nTok = 0;
+        const char *q = p;
+        unsigned long long t_us = 0;
+        auto tr = std::from_chars(q, lineEnd, t_us);
+        bool timeOk = tr.ec == std::errc();
+        q = tr.ptr;
+        for (; timeOk && nTok < 4; ++nTok)
+        {
+            while (q < lineEnd && std::isspace((unsigned char)*q))
+                ++q;
+            if (q == lineEnd)
+                break;
+            size_t n = 0;
+            while (q < lineEnd && !std::isspace((unsigned char)*q))
+            {
+                if (n < sizeof(tok[0]) - 1)
+                    tok[nTok][n++] = *q;
+                ++q;
+            }
+        }
+        // tok: event, A, B, C
+        if (!timeOk || nTok < 2)
+        {
+            ck.errors.emplace_back(ck.lines, "cannot parse, skipping: " + std::string(lineStart, next));
+            ++ck.skipped;
+            continue;
+        }
+        uint32_t type = event_type_from_name(tok[0]);
+        if (type == 0xFFFFFFFF)
+        {
+            ck.errors.emplace_back(ck.lines, std::string("unknown event '") + tok[0] + "', skipping.\n");
+            ++ck.skipped;
+            continue;
+        }
+        Event ev{};
+        ev.type = type;
+        ev.t_us = (uint64_t)t_us;
+        ev.a = parse_key_or_number(tok[1]);
+        ev.b = (nTok >= 3) ? parse_key_or_number(tok[2]) : 0;
+        ev.c = (nTok >= 4) ? text_atoi(tok[3], tok[3] + std::strlen(tok[3])) : 0;
+        ck.events.push_back(ev);
+    }
+}
+
 // Export binary .rmac to human-readable text file
 static bool export_macro(const char *rmacPath, const char *txtPath)
 {
-    FILE *in = std::fopen(rmacPath, "rb");
-    if (!in)
+    MacroReader reader;
+    MacroOpen rc = reader.open(rmacPath);
+    if (rc == MACRO_CANT_OPEN)
     {
         std::fprintf(stderr, "Cannot open: %s\n", rmacPath);
         return false;
     }
-
-    FileHeader hdr{};
-    if (read_exact(in, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != 0x524D4143)
+    if (rc != MACRO_OK)
     {
         std::fprintf(stderr, "Invalid .rmac file: %s\n", rmacPath);
-        std::fclose(in);
         return false;
     }
 
-    std::vector<Event> events;
-    Event ev{};
-    while (read_exact(in, &ev, sizeof(ev)) == sizeof(ev))
-        events.push_back(ev);
-    std::fclose(in);
-
     // Calculate duration
-    double durationS = events.empty() ? 0.0 : events.back().t_us / 1000000.0;
+    double durationS = reader.durationUs() / 1000000.0;
 
     // Get current time string
     SYSTEMTIME st{};
@@ -2200,7 +7690,7 @@ static bool export_macro(const char *rmacPath, const char *txtPath)
                  "# RawIO Macro Export\n"
                  "# Source:    %s\n"
                  "# Exported:  %s\n"
-                 "# Events:    %zu\n"
+                 "# Events:    %llu\n"
                  "# Duration:  %.3fs\n"
                  "#\n"
                  "# ── EVENT TYPES ──────────────────────────────────────────────────────\n"
@@ -2240,213 +7730,765 @@ static bool export_macro(const char *rmacPath, const char *txtPath)
                  "#\n"
                  "# %-16s %-14s %-7s %-7s %-7s  COMMENT\n"
                  "# %-16s %-14s %-7s %-7s %-7s\n",
-                 rmacPath, timeBuf, events.size(), durationS,
+                 rmacPath, timeBuf, (unsigned long long)reader.size(), durationS,
                  "TIME_US", "EVENT", "A", "B", "C",
                  "-------", "-----", "-", "-", "-");
 
     // ---- Events ----
-    for (const auto &e : events)
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t n = export_events(reader, out);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::fclose(out);
+    std::printf("Exported %llu events to: %s  (%.0f events/s)\n", (unsigned long long)n, txtPath,
+                sec > 0 ? n / sec : 0.0);
+    return true;
+}
+
+// Import text file back to binary .rmac
+static bool import_macro(const char *txtPath, const char *rmacPath)
+{
+    FILE *in = std::fopen(txtPath, "r");
+    if (!in)
     {
-        const char *evName = "UNKNOWN";
-        char comment[128] = "";
+        std::fprintf(stderr, "Cannot open: %s\n", txtPath);
+        return false;
+    }
 
-        switch (e.type)
+    // Rounds of kTextReadBlock bytes, cut at line ends into one slice per
+    // worker; the partial last line carries into the next round
+    auto t0 = std::chrono::steady_clock::now();
+    WorkerPool pool;
+    pool.start(text_workers());
+    std::vector<ImportChunk> chunks(pool.size());
+    std::vector<char> buf;
+    size_t carry = 0;
+    double scale = 1.0;
+    std::vector<Event> events;
+    int lineNum = 0;
+    int skipped = 0;
+    for (bool eof = false; !eof;)
+    {
+        buf.resize(carry + kTextReadBlock);
+        size_t got = std::fread(buf.data() + carry, 1, kTextReadBlock, in);
+        eof = got < kTextReadBlock;
+        size_t len = carry + got;
+        size_t cut = len;
+        if (!eof)
         {
-        case EV_MOUSE_MOVE:
-            evName = "MOUSE_MOVE";
-            std::snprintf(comment, sizeof(comment), "# REL dx=%d dy=%d", e.a, e.b);
-            break;
-        case EV_MOUSE_POS:
-            evName = "MOUSE_POS";
-            std::snprintf(comment, sizeof(comment), "# ABS x=%d y=%d", e.a, e.b);
-            break;
-        case EV_MOUSE_WHEEL:
-            evName = "MOUSE_WHEEL";
-            std::snprintf(comment, sizeof(comment), "# delta=%d (%s)",
-                          e.a, e.a > 0 ? "up" : "down");
-            break;
-        case EV_MOUSE_BUTTON:
+            while (cut > 0 && buf[cut - 1] != '\n')
+                --cut;
+            if (cut == 0)
+                cut = len; // one line longer than a whole block
+        }
+
+        const int nChunks = (int)chunks.size();
+        size_t start = 0;
+        for (int k = 0; k < nChunks; ++k)
         {
-            evName = "MOUSE_BUTTON";
-            const char *btnName = (e.a == 1 ? "LEFT" : e.a == 2 ? "RIGHT"
-                                                   : e.a == 3   ? "MIDDLE"
-                                                   : e.a == 4   ? "X1"
-                                                   : e.a == 5   ? "X2"
-                                                                : "?");
-            std::snprintf(comment, sizeof(comment), "# %s %s",
-                          btnName, e.b ? "DOWN" : "UP");
-            break;
+            size_t stop = (k == nChunks - 1) ? cut : std::max(start, cut * (k + 1) / nChunks);
+            while (stop > start && stop < cut && buf[stop - 1] != '\n')
+                ++stop;
+            ImportChunk &ck = chunks[k];
+            ck.begin = buf.data() + start;
+            ck.end = buf.data() + stop;
+            ck.events.clear();
+            ck.scales.clear();
+            ck.errors.clear();
+            ck.lines = ck.skipped = 0;
+            start = stop;
         }
-        case EV_KEY_DOWN:
-            evName = "KEY_DOWN";
-            std::snprintf(comment, sizeof(comment), "# %s", vk_name(e.a));
-            break;
-        case EV_KEY_UP:
-            evName = "KEY_UP";
-            std::snprintf(comment, sizeof(comment), "# %s", vk_name(e.a));
+        pool.run(nChunks, [&](int k, int)
+                 { parse_import_chunk(chunks[k]); });
+
+        // Ordered merge: messages, SCALE (applies to the MOUSE_MOVEs after it)
+        for (ImportChunk &ck : chunks)
+        {
+            size_t nextScale = 0, nextErr = 0;
+            for (size_t e = 0; e <= ck.events.size(); ++e)
+            {
+                for (; nextScale < ck.scales.size() && ck.scales[nextScale].first == e; ++nextScale)
+                {
+                    scale = ck.scales[nextScale].second;
+                    std::printf("[IMPORT] SCALE = %.4f\n", scale);
+                }
+                if (e == ck.events.size())
+                    break;
+                Event ev = ck.events[e];
+                // Apply SCALE to MOUSE_MOVE dx/dy
+                if (ev.type == EV_MOUSE_MOVE && std::fabs(scale - 1.0) > 1e-6)
+                {
+                    ev.a = (int)std::round(ev.a * scale);
+                    ev.b = (int)std::round(ev.b * scale);
+                }
+                events.push_back(ev);
+            }
+            for (; nextErr < ck.errors.size(); ++nextErr)
+                std::fprintf(stderr, "[IMPORT] Line %d: %s", lineNum + ck.errors[nextErr].first,
+                             ck.errors[nextErr].second.c_str());
+            lineNum += ck.lines;
+            skipped += ck.skipped;
+        }
+
+        carry = len - cut;
+        std::memmove(buf.data(), buf.data() + cut, carry);
+    }
+    std::fclose(in);
+
+    if (events.empty())
+    {
+        std::fprintf(stderr, "[IMPORT] No valid events found in: %s\n", txtPath);
+        return false;
+    }
+
+    // Sort by time just in case editing reordered lines
+    std::sort(events.begin(), events.end(),
+              [](const Event &x, const Event &y)
+              { return x.t_us < y.t_us; });
+
+    // Write binary .rmac
+    auto out = std::make_unique<MacroWriter>();
+    if (!out->open(rmacPath, gMacroVersion))
+    {
+        std::fprintf(stderr, "Cannot create: %s\n", rmacPath);
+        return false;
+    }
+    out->append(events.data(), events.size());
+    out->close();
+
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::printf("[IMPORT] Wrote %zu events to: %s  (skipped %d lines, scale=%.4f, %.0f events/s)\n",
+                events.size(), rmacPath, skipped, scale, sec > 0 ? events.size() / sec : 0.0);
+    return true;
+}
+
+// Rewrite a .rmac in another format version (v1 <-> v2)
+static bool convert_macro(const char *inPath, const char *outPath, uint32_t version)
+{
+    MacroReader reader;
+    MacroOpen rc = reader.open(inPath);
+    if (rc == MACRO_CANT_OPEN)
+    {
+        std::fprintf(stderr, "Cannot open: %s\n", inPath);
+        return false;
+    }
+    if (rc != MACRO_OK)
+    {
+        std::fprintf(stderr, "Invalid .rmac file: %s\n", inPath);
+        return false;
+    }
+
+    auto out = std::make_unique<MacroWriter>();
+    if (!out->open(outPath, version))
+    {
+        std::fprintf(stderr, "Cannot create: %s\n", outPath);
+        return false;
+    }
+    while (const Event *e = reader.next())
+        out->append(*e);
+    if (!out->close())
+    {
+        std::fprintf(stderr, "Write failed: %s\n", outPath);
+        return false;
+    }
+
+    std::printf("Converted %llu events: v%u %llu bytes -> v%u %llu bytes (%.1f%%)\n",
+                (unsigned long long)out->written(),
+                reader.version(), (unsigned long long)reader.bytes(),
+                version, (unsigned long long)out->bytes(),
+                reader.bytes() ? 100.0 * out->bytes() / reader.bytes() : 0.0);
+    return true;
+}
+
+// ========================= Macro Editing =========================
+
+// cut / splice / retime / filter-type work on the mapped .rmac directly. A v2
+// block's payload is delta-coded from its header's first_t, so a block that
+// only moves in time is copied as raw bytes with a new first_t, and only the
+// blocks an edit boundary falls inside are decoded and re-encoded. v1 records
+// are copied as whole ranges, all through MacroWriter on a MappedOut.
+
+// Source events with lo <= t_us < hi, written at lo + (t_us - lo) * scale + shift
+struct EditSegment
+{
+    MacroReader *src = nullptr;
+    uint64_t lo = 0, hi = UINT64_MAX;
+    double scale = 1.0;
+    int64_t shift = 0;
+    uint64_t dropMask = 0; // bit per event type removed
+};
+
+static inline bool edit_event(const EditSegment &s, Event &e)
+{
+    if (e.type < 64 && ((s.dropMask >> e.type) & 1))
+        return false;
+    uint64_t rel = e.t_us - s.lo;
+    if (s.scale != 1.0)
+        rel = (uint64_t)std::llround((double)rel * s.scale);
+    e.t_us = (uint64_t)((int64_t)(s.lo + rel) + s.shift);
+    return true;
+}
+
+static bool edit_segment(const EditSegment &s, MacroWriter &out)
+{
+    MacroReader &r = *s.src;
+    bool plainMove = s.scale == 1.0;
+
+    if (r.mapped() && r.version() == 2 && out.version() == 2)
+    {
+        const auto &idx = r.blocks();
+        // Start at the last block that begins before lo: events equal to lo
+        // may end the block before one whose first_t is lo.
+        auto it = std::lower_bound(idx.begin(), idx.end(), s.lo,
+                                   [](const BlockIndexEntry &b, uint64_t v)
+                                   { return b.first_t < v; });
+        std::vector<Event> ev(kBlockEvents);
+        for (size_t b = it == idx.begin() ? 0 : (size_t)(it - idx.begin()) - 1;
+             b < idx.size() && idx[b].first_t < s.hi; ++b)
+        {
+            BlockHeader bh{};
+            uint64_t off = idx[b].offset;
+            if (off + sizeof(bh) <= r.bytes())
+                std::memcpy(&bh, r.data() + off, sizeof(bh));
+            const uint8_t *payload = r.data() + off + sizeof(bh);
+            if (bh.count == 0 || bh.count > kBlockEvents || off + sizeof(bh) + bh.bytes > r.bytes() ||
+                !decode_block(bh, payload, ev.data()))
+            {
+                std::fprintf(stderr, "[RMAC] Corrupt block %zu\n", b);
+                return false;
+            }
+
+            // Events never run past the next block's first_t (time order)
+            uint64_t last = b + 1 < idx.size() ? idx[b + 1].first_t : r.durationUs();
+            bool whole = plainMove && bh.first_t >= s.lo && last < s.hi;
+            for (uint32_t i = 0; whole && s.dropMask && i < bh.count; ++i)
+                whole = ev[i].type >= 64 || !((s.dropMask >> ev[i].type) & 1);
+            if (whole)
+            {
+                out.copy_block(bh, payload, s.shift);
+                continue;
+            }
+            for (uint32_t i = 0; i < bh.count; ++i)
+            {
+                Event e = ev[i];
+                if (e.t_us >= s.lo && e.t_us < s.hi && edit_event(s, e))
+                    out.append(e);
+            }
+        }
+        return true;
+    }
+
+    if (r.mapped() && r.version() == 1 && out.version() == 1 && plainMove && s.shift == 0 && !s.dropMask)
+    {
+        const Event *all = (const Event *)(r.data() + sizeof(FileHeader));
+        const Event *end = all + r.size();
+        auto first = std::lower_bound(all, end, s.lo, [](const Event &e, uint64_t t)
+                                      { return e.t_us < t; });
+        auto last = std::lower_bound(first, end, s.hi, [](const Event &e, uint64_t t)
+                                     { return e.t_us < t; });
+        out.copy_records(first, (size_t)(last - first));
+        return true;
+    }
+
+    // Version change or a streamed (remote) source: event by event
+    r.seek(s.lo);
+    while (const Event *p = r.next())
+    {
+        if (p->t_us >= s.hi)
             break;
+        Event e = *p;
+        if (edit_event(s, e))
+            out.append(e);
+    }
+    return true;
+}
+
+static bool open_macro_input(MacroReader &reader, const char *path)
+{
+    MacroOpen rc = reader.open(path);
+    if (rc == MACRO_CANT_OPEN)
+        std::fprintf(stderr, "Cannot open: %s\n", path);
+    else if (rc != MACRO_OK)
+        std::fprintf(stderr, "Invalid .rmac file: %s\n", path);
+    return rc == MACRO_OK;
+}
+
+// Writes the segments in order to outPath, in the first source's format and
+// with its header (start time kept).
+static bool write_edited_macro(const char *what, const std::vector<EditSegment> &segs, const char *outPath)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    // cut and retime read one source several times; count each file once
+    std::vector<const MacroReader *> sources;
+    uint64_t inBytes = 0;
+    for (const auto &s : segs)
+        if (std::find(sources.begin(), sources.end(), s.src) == sources.end())
+        {
+            sources.push_back(s.src);
+            inBytes += s.src->bytes();
         }
 
-        std::fprintf(out, "%-17llu %-14s %-7d %-7d %-7d  %s\n",
-                     (unsigned long long)e.t_us,
-                     evName, e.a, e.b, e.c, comment);
+    auto mapped = std::make_unique<MappedOut>();
+    if (!mapped->open(outPath, inBytes))
+    {
+        std::fprintf(stderr, "Cannot create: %s\n", outPath);
+        return false;
+    }
+    auto out = std::make_unique<MacroWriter>();
+    out->open(std::move(mapped), segs[0].src->header());
+    bool ok = true;
+    for (const auto &s : segs)
+        if (!(ok = edit_segment(s, *out)))
+            break;
+    if (!out->close() && ok)
+    {
+        std::fprintf(stderr, "Write failed: %s\n", outPath);
+        ok = false;
+    }
+    if (!ok)
+    {
+        // A truncated file would still end in a valid-looking trailer
+        DeleteFileA(outPath);
+        return false;
     }
 
-    std::fclose(out);
-    std::printf("Exported %zu events to: %s\n", events.size(), txtPath);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::printf("[EDIT] %s: %llu events, %llu bytes -> %s  (%llu blocks copied, %llu events re-encoded, "
+                "%.2f s, %.0f MB/s)\n",
+                what, (unsigned long long)out->written(), (unsigned long long)out->bytes(), outPath,
+                (unsigned long long)out->copiedBlocks(), (unsigned long long)out->encoded(), sec,
+                sec > 0 ? inBytes / sec / 1e6 : 0.0);
     return true;
 }
 
-// Import text file back to binary .rmac
-static bool import_macro(const char *txtPath, const char *rmacPath)
+static inline uint64_t seconds_to_us(double s) { return s <= 0 ? 0 : (uint64_t)std::llround(s * 1e6); }
+
+// Removes [fromS, toS); later events move up by the cut length
+static bool cut_macro(const char *inPath, const char *outPath, double fromS, double toS)
 {
-    FILE *in = std::fopen(txtPath, "r");
-    if (!in)
+    MacroReader in;
+    if (!open_macro_input(in, inPath))
+        return false;
+    uint64_t from = seconds_to_us(fromS), to = seconds_to_us(toS);
+    if (to <= from)
     {
-        std::fprintf(stderr, "Cannot open: %s\n", txtPath);
+        std::fprintf(stderr, "cut: end (%.3f s) must be after start (%.3f s)\n", toS, fromS);
         return false;
     }
+    EditSegment head{&in, 0, from};
+    EditSegment tail{&in, to, UINT64_MAX};
+    tail.shift = -(int64_t)(to - from);
+    return write_edited_macro("cut", {head, tail}, outPath);
+}
 
-    double scale = 1.0;
-    std::vector<Event> events;
-    char line[1024];
-    int lineNum = 0;
-    int skipped = 0;
+// Inserts b at atS into a (atS < 0: append). b starts gapMs after the
+// insertion point; a resumes gapMs after b's last event.
+static bool splice_macro(const char *aPath, const char *bPath, const char *outPath, double atS, double gapMs)
+{
+    MacroReader a, b;
+    if (!open_macro_input(a, aPath) || !open_macro_input(b, bPath))
+        return false;
+    int64_t gap = (int64_t)std::llround(std::max(0.0, gapMs) * 1000.0);
+    uint64_t at = atS < 0 ? a.durationUs() : seconds_to_us(atS);
+
+    std::vector<EditSegment> segs;
+    segs.push_back(EditSegment{&a, 0, atS < 0 ? UINT64_MAX : at});
+    EditSegment mid{&b};
+    mid.shift = (int64_t)at + gap;
+    segs.push_back(mid);
+    if (atS >= 0)
+    {
+        EditSegment tail{&a, at, UINT64_MAX};
+        tail.shift = (int64_t)b.durationUs() + 2 * gap;
+        segs.push_back(tail);
+    }
+    return write_edited_macro("splice", segs, outPath);
+}
 
-    while (std::fgets(line, sizeof(line), in))
+// Stretches [fromS, toS) by factor (2 = twice as long); later events shift by
+// the change in length
+static bool retime_macro(const char *inPath, const char *outPath, double factor, double fromS, double toS)
+{
+    MacroReader in;
+    if (!open_macro_input(in, inPath))
+        return false;
+    if (!(factor > 0))
     {
-        ++lineNum;
+        std::fprintf(stderr, "retime: factor must be > 0\n");
+        return false;
+    }
+    uint64_t from = seconds_to_us(fromS);
+    uint64_t to = toS < 0 ? UINT64_MAX : seconds_to_us(toS);
+    if (to <= from)
+    {
+        std::fprintf(stderr, "retime: end (%.3f s) must be after start (%.3f s)\n", toS, fromS);
+        return false;
+    }
 
-        // Strip leading whitespace
-        char *p = line;
-        while (*p == ' ' || *p == '\t')
-            ++p;
+    std::vector<EditSegment> segs;
+    segs.push_back(EditSegment{&in, 0, from});
+    EditSegment mid{&in, from, to};
+    mid.scale = factor;
+    segs.push_back(mid);
+    if (to != UINT64_MAX)
+    {
+        EditSegment tail{&in, to, UINT64_MAX};
+        tail.shift = std::llround((double)(to - from) * (factor - 1.0));
+        segs.push_back(tail);
+    }
+    return write_edited_macro("retime", segs, outPath);
+}
 
-        // Skip empty lines
-        if (*p == '\n' || *p == '\r' || *p == '\0')
+// Drops every event whose type is in the comma-separated list (names as in
+// export, or numbers); timestamps are unchanged
+static bool filter_type_macro(const char *inPath, const char *outPath, const char *types)
+{
+    uint64_t mask = 0;
+    std::string list = types;
+    for (size_t pos = 0; pos <= list.size();)
+    {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos)
+            comma = list.size();
+        std::string name = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (name.empty())
             continue;
+        uint32_t t = event_type_from_name(name.c_str());
+        if (t == 0xFFFFFFFF && !name.empty() && std::isdigit((unsigned char)name[0]))
+            t = (uint32_t)std::atoi(name.c_str());
+        if (t >= 64)
+        {
+            std::fprintf(stderr, "filter-type: unknown event type: %s\n", name.c_str());
+            return false;
+        }
+        mask |= 1ull << t;
+    }
+    if (!mask)
+    {
+        std::fprintf(stderr, "filter-type: no event types given\n");
+        return false;
+    }
 
-        // Check for SCALE directive in comments
-        if (*p == '#')
+    MacroReader in;
+    if (!open_macro_input(in, inPath))
+        return false;
+    EditSegment all{&in};
+    all.dropMask = mask;
+    return write_edited_macro("filter-type", {all}, outPath);
+}
+
+// ========================= Bench =========================
+
+// Instrumented builds only (/DRECORDER_COUNT_ALLOCS): every operator new in
+// the process bumps this and bench reports the delta per stage call. A normal
+// build keeps the CRT allocator, so record/play/hunt threads never share a
+// counter cache line. cv::Mat buffers are counted separately, see below.
+#ifdef RECORDER_COUNT_ALLOCS
+static const bool kCountAllocs = true;
+static std::atomic<uint64_t> gAllocCount{0};
+
+void *operator new(size_t n)
+{
+    gAllocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t n) { return operator new(n); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+#else
+static const bool kCountAllocs = false;
+static std::atomic<uint64_t> gAllocCount{0}; // stays 0
+#endif
+
+// cv::Mat buffers bypass operator new (cv::fastMalloc), so bench_run swaps
+// in this allocator while it runs: it forwards to OpenCV's own and counts
+// every fresh buffer. Mats it hands out are freed by the std allocator.
+static std::atomic<uint64_t> gMatAllocCount{0};
+
+class CountingMatAllocator : public cv::MatAllocator
+{
+public:
+    CountingMatAllocator() : base_(cv::Mat::getStdAllocator()), prev_(cv::Mat::getDefaultAllocator())
+    {
+        cv::Mat::setDefaultAllocator(this);
+    }
+    ~CountingMatAllocator() override { cv::Mat::setDefaultAllocator(prev_); }
+    CountingMatAllocator(const CountingMatAllocator &) = delete;
+    CountingMatAllocator &operator=(const CountingMatAllocator &) = delete;
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage) const override
+    {
+        if (!data)
+            gMatAllocCount.fetch_add(1, std::memory_order_relaxed);
+        return base_->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+    bool allocate(cv::UMatData *u, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override
+    {
+        return base_->allocate(u, flags, usage);
+    }
+    void deallocate(cv::UMatData *u) const override { base_->deallocate(u); }
+
+private:
+    cv::MatAllocator *base_, *prev_;
+};
+
+static uint64_t bench_alloc_count()
+{
+    return gAllocCount.load(std::memory_order_relaxed) +
+           gMatAllocCount.load(std::memory_order_relaxed);
+}
+
+static std::string bench_frame_path(const std::string &dir, int i)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "\\frame_%05d.png", i);
+    return dir + name;
+}
+
+// Dumps n distinct capture-service frames (full virtual screen) to dir
+static bool bench_capture(const std::string &dir, int n, int intervalMs)
+{
+    if (!CreateDirectoryA(dir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        std::fprintf(stderr, "[BENCH] Cannot create folder: %s\n", dir.c_str());
+        return false;
+    }
+    countdown_3s("[BENCH] Capturing");
+    start_capture_service();
+    set_and_wake(gPlaying, true); // the capture thread idles outside a session
+    uint64_t lastGen = 0;
+    int saved = 0;
+    while (saved < n && !gInput.escDown())
+    {
+        CaptureFrameRef frame = gCapture.latest();
+        if (frame && gCapture.generation() != lastGen)
         {
-            // Look for "# SCALE 0.95" anywhere in comment lines
-            const char *sc = std::strstr(p, "SCALE");
-            if (sc)
+            lastGen = gCapture.generation();
+            cv::Mat copy = frame.mat().clone();
+            frame.reset(); // unpin before the slow PNG encode
+            if (!cv::imwrite(bench_frame_path(dir, saved), copy))
             {
-                sc += 5;
-                while (*sc == ' ' || *sc == '\t')
-                    ++sc;
-                double s = std::atof(sc);
-                if (s > 0.01 && s < 100.0)
-                {
-                    scale = s;
-                    std::printf("[IMPORT] SCALE = %.4f\n", scale);
-                }
+                std::fprintf(stderr, "[BENCH] Write failed: %s\n", bench_frame_path(dir, saved).c_str());
+                break;
             }
-            continue;
+            if ((++saved % 25) == 0)
+                std::printf("[BENCH] %d/%d frames\n", saved, n);
         }
+        else
+            frame.reset();
+        gWake.sleepFor(intervalMs, [] { return gInput.escDown(); });
+    }
+    set_and_wake(gPlaying, false);
+    stop_capture_service();
+    std::printf("[BENCH] Saved %d frames to %s\n", saved, dir.c_str());
+    return saved > 0;
+}
 
-        // Parse: TIME_US  EVENT  A  B  C  [# comment...]
-        char evName[32] = {};
-        char aStr[32] = {};
-        char bStr[32] = {};
-        unsigned long long t_us = 0;
-        int b = 0, c = 0;
+struct BenchStage
+{
+    const char *name;
+    std::vector<double> ms;
+    uint64_t allocs = 0;
 
-        int parsed = std::sscanf(p, "%llu %31s %31s %31s %d",
-                                 &t_us, evName, aStr, bStr, &c);
-        if (parsed < 3)
-        {
-            std::fprintf(stderr, "[IMPORT] Line %d: cannot parse, skipping: %s", lineNum, line);
-            ++skipped;
-            continue;
-        }
+    template <class F>
+    auto time(F &&f)
+    {
+        uint64_t a0 = bench_alloc_count();
+        uint64_t t0 = steady_us();
+        auto r = f();
+        ms.push_back((steady_us() - t0) / 1000.0);
+        allocs += bench_alloc_count() - a0;
+        return r;
+    }
 
-        // A and B can be a number or a key name
-        int a = std::atoi(aStr);
-        if (a == 0 && aStr[0] != '0')
-            a = vk_from_name(aStr);
-
-        b = (parsed >= 4) ? std::atoi(bStr) : 0;
-        if (b == 0 && parsed >= 4 && bStr[0] != '0')
-            b = vk_from_name(bStr);
-
-        // Resolve event type
-        uint32_t type = 0xFFFFFFFF;
-        if (_stricmp(evName, "MOUSE_MOVE") == 0)
-            type = EV_MOUSE_MOVE;
-        else if (_stricmp(evName, "MOUSE_POS") == 0)
-            type = EV_MOUSE_POS;
-        else if (_stricmp(evName, "MOUSE_WHEEL") == 0)
-            type = EV_MOUSE_WHEEL;
-        else if (_stricmp(evName, "MOUSE_BUTTON") == 0)
-            type = EV_MOUSE_BUTTON;
-        else if (_stricmp(evName, "KEY_DOWN") == 0)
-            type = EV_KEY_DOWN;
-        else if (_stricmp(evName, "KEY_UP") == 0)
-            type = EV_KEY_UP;
-        else
+    void print() const
+    {
+        if (ms.empty())
         {
-            std::fprintf(stderr, "[IMPORT] Line %d: unknown event '%s', skipping.\n", lineNum, evName);
-            ++skipped;
-            continue;
+            std::printf("  %-8s (not run)\n", name);
+            return;
         }
+        std::vector<double> v = ms;
+        std::sort(v.begin(), v.end());
+        auto pct = [&](double p) { return v[std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))]; };
+        double sum = 0;
+        for (double x : v)
+            sum += x;
+        char allocStr[32];
+        std::snprintf(allocStr, sizeof(allocStr), kCountAllocs ? "%.1f" : "%.1f(Mat)", (double)allocs / v.size());
+        std::printf("  %-8s n=%-5zu p50=%7.2fms p95=%7.2fms p99=%7.2fms max=%7.2fms  %7.1f/s  allocs/call=%s\n",
+                    name, v.size(), pct(0.50), pct(0.95), pct(0.99), v.back(),
+                    sum > 0 ? v.size() * 1000.0 / sum : 0.0, allocStr);
+    }
+};
 
-        // Apply SCALE to MOUSE_MOVE dx/dy
-        if (type == EV_MOUSE_MOVE && std::fabs(scale - 1.0) > 1e-6)
+// Replays dumped frames through the hunt detector, the quest marker picker
+// and the distance readers, timing each stage. Frame decode is not timed.
+static bool bench_run(const std::string &dir, const char *ep, const char *bp, double et, double bt,
+                      const char *qp, double mth, int passes)
+{
+    TemplateDetector det;
+    if (!configure_detector(det, ep, bp, et, bt))
+        return false;
+    auto questTempl = gBank.load(qp, BankOptions{});
+    if (!questTempl)
+        std::fprintf(stderr, "[BENCH] No quest marker template (%s): marker/OCR stages skipped.\n", qp);
+    TesseractOCR ocr;
+    bool ocrOk = ocr.init("tessdata", "eng");
+    DigitRecognizer digits;
+    if (gQuestDigits)
+        digits.load(kDefaultDigitsPath);
+    VisionArena arena;
+    FramePlanes planes;
+    cv::Mat hsv, markerPlane;
+    const unsigned spaces = gFrameSpaces.load();
+    CountingMatAllocator matCounter; // until bench_run returns
+
+    BenchStage battle{"battle"}, enemy{"enemy"}, marker{"marker"}, tess{"ocr"}, glyph{"digits"}, total{"frame"};
+    BenchStage convert{"spaces"}; // the capture thread's per-frame plane derivation
+    int frames = 0, battles = 0, enemies = 0, markers = 0, reads = 0;
+    for (int pass = 0; pass < std::max(1, passes); ++pass)
+    {
+        for (int i = 0;; ++i)
         {
-            a = (int)std::round(a * scale);
-            b = (int)std::round(b * scale);
+            cv::Mat screen = cv::imread(bench_frame_path(dir, i), cv::IMREAD_COLOR);
+            if (screen.empty())
+                break;
+            ++frames;
+            planes[SPACE_BGR] = screen;
+            if (spaces)
+                convert.time([&] { derive_planes(planes, spaces, hsv); return 0; });
+            total.time([&]
+            {
+                double conf = 0;
+                if (battle.time([&] { return det.isBattleStart(planes, &conf); }))
+                    ++battles;
+                int idx = -1;
+                if (enemy.time([&] { return det.findEnemy(planes, &conf, &idx); }).x >= 0)
+                    ++enemies;
+                if (!questTempl)
+                    return 0;
+                cv::Point c;
+                const cv::Mat &plane = plane_for(planes, questTempl->space, markerPlane, hsv);
+                const double th = questTempl->threshold(mth);
+                if (!marker.time([&] { return pick_world_marker(plane, questTempl->img, th, arena, c, conf); }))
+                    return 0;
+                ++markers;
+                cv::Mat &roi = arena.roi;
+                crop_distance_label(screen, c, questTempl->img.rows, roi, 80, 28);
+                int d = -1;
+                if (digits.ready())
+                    d = glyph.time([&] { return digits.read(roi); });
+                if (ocrOk)
+                    d = tess.time([&] { return ocr.readDistance(roi); });
+                reads += d >= 0;
+                return 0;
+            });
         }
-
-        Event ev{};
-        ev.type = type;
-        ev.t_us = (uint64_t)t_us;
-        ev.a = a;
-        ev.b = b;
-        ev.c = c;
-        events.push_back(ev);
     }
-    std::fclose(in);
-
-    if (events.empty())
+    if (!frames)
     {
-        std::fprintf(stderr, "[IMPORT] No valid events found in: %s\n", txtPath);
+        std::fprintf(stderr, "[BENCH] No frames in %s (expected frame_00000.png ...)\n", dir.c_str());
         return false;
     }
+    std::printf("[BENCH] %d frames x %d pass(es): battle=%d enemy=%d marker=%d distance=%d\n",
+                frames / std::max(1, passes), std::max(1, passes), battles, enemies, markers, reads);
+    for (const BenchStage *st : {&convert, &battle, &enemy, &marker, &glyph, &tess, &total})
+        st->print();
+    if (ocrOk)
+        std::printf("  OCR cache hit rate %.0f%%\n", ocr.hitRate() * 100.0);
+    return true;
+}
 
-    // Sort by time just in case editing reordered lines
-    std::sort(events.begin(), events.end(),
-              [](const Event &x, const Event &y)
-              { return x.t_us < y.t_us; });
-
-    // Write binary .rmac
-    FILE *out = std::fopen(rmacPath, "wb");
-    if (!out)
+// Threshold a template needs in another match space. Every dumped frame is
+// scored in BGR and in `space`; frames reaching bgrTh in BGR are positives and
+// the space threshold is the cut that reproduces those verdicts with the
+// fewest disagreements. Written to <template>.match, which the bank reads.
+static bool bench_calibrate(const std::string &templPath, MatchSpace space, const std::string &dir, double bgrTh)
+{
+    cv::Mat templ = cv::imread(templPath, cv::IMREAD_COLOR);
+    if (templ.empty())
     {
-        std::fprintf(stderr, "Cannot create: %s\n", rmacPath);
+        std::fprintf(stderr, "[CALIB] Failed to load %s\n", templPath.c_str());
+        return false;
+    }
+    if (space == SPACE_HUE && hue_wraps(templ))
+    {
+        std::fprintf(stderr, "[CALIB] %s spans the 0/179 hue wrap (red); hue scores would be noise, "
+                             "use sat or gray\n", templPath.c_str());
+        return false;
+    }
+    cv::Mat templSp, plane, hsv, result;
+    convert_to_space(templ, space, templSp, hsv);
+    auto best = [&](const cv::Mat &img, const cv::Mat &t)
+    {
+        if (t.cols > img.cols || t.rows > img.rows)
+            return -1.0;
+        cv::matchTemplate(img, t, result, cv::TM_CCOEFF_NORMED);
+        double mn = 0, mx = 0;
+        cv::Point mnL, mxL;
+        cv::minMaxLoc(result, &mn, &mx, &mnL, &mxL);
+        return mx;
+    };
+
+    std::vector<std::pair<double, bool>> samples; // score in space, BGR verdict
+    int positives = 0;
+    for (int i = 0;; ++i)
+    {
+        cv::Mat screen = cv::imread(bench_frame_path(dir, i), cv::IMREAD_COLOR);
+        if (screen.empty())
+            break;
+        bool hit = best(screen, templ) >= bgrTh;
+        convert_to_space(screen, space, plane, hsv);
+        samples.emplace_back(best(plane, templSp), hit);
+        positives += hit;
+    }
+    if (samples.empty())
+    {
+        std::fprintf(stderr, "[CALIB] No frames in %s (bench capture first)\n", dir.c_str());
+        return false;
+    }
+    if (!positives)
+    {
+        std::fprintf(stderr, "[CALIB] No frame reaches %.2f in BGR; capture frames with %s on screen\n",
+                     bgrTh, templPath.c_str());
         return false;
     }
 
-    static char fileBuf[1 << 20];
-    setvbuf(out, fileBuf, _IOFBF, sizeof(fileBuf));
-
-    FileHeader hdr{};
-    hdr.magic = 0x524D4143;
-    hdr.version = 1;
-    FILETIME ft{};
-    GetSystemTimeAsFileTime(&ft);
-    hdr.start_utc = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
-    fwrite(&hdr, sizeof(hdr), 1, out);
-
-    for (const auto &e : events)
-        fwrite(&e, sizeof(e), 1, out);
-
-    fflush(out);
-    std::fclose(out);
+    // Cut k: scores >= samples[k] are hits. Sweep once with running counts.
+    std::sort(samples.begin(), samples.end());
+    const int n = (int)samples.size(), negatives = n - positives;
+    int bestK = 0, bestErr = n + 1, posBelow = 0, negBelow = 0;
+    for (int k = 0; k < n; ++k)
+    {
+        int err = posBelow + (negatives - negBelow);
+        if (err < bestErr)
+        {
+            bestErr = err;
+            bestK = k;
+        }
+        (samples[k].second ? posBelow : negBelow)++;
+    }
+    double th = bestK > 0 ? (samples[bestK - 1].first + samples[bestK].first) / 2 : samples[0].first;
+    th = std::clamp(th, 0.0, 0.999);
 
-    std::printf("[IMPORT] Wrote %zu events to: %s  (skipped %d lines, scale=%.4f)\n",
-                events.size(), rmacPath, skipped, scale);
+    std::string sidecar = templPath + ".match";
+    FILE *f = std::fopen(sidecar.c_str(), "w");
+    if (!f)
+    {
+        std::fprintf(stderr, "[CALIB] Cannot write %s\n", sidecar.c_str());
+        return false;
+    }
+    std::fprintf(f, "space=%s th=%.3f\n", kSpaceNames[space], th);
+    std::fclose(f);
+    std::printf("[CALIB] %s in %s: %d frames, %d BGR hits at %.2f -> th=%.3f (%d disagree) -> %s\n",
+                templPath.c_str(), kSpaceNames[space], n, positives, bgrTh, th, bestErr, sidecar.c_str());
     return true;
 }
 
@@ -2480,11 +8522,167 @@ static void parse_ignore_rect(int argc, char **argv, int i)
     }
 }
 
+// "L,T,R,B" in screen pixels
+static bool parse_rect_arg(const char *s, cv::Rect &out)
+{
+    int l = 0, t = 0, r = 0, b = 0;
+    if (std::sscanf(s, "%d,%d,%d,%d", &l, &t, &r, &b) != 4 || r <= l || b <= t)
+        return false;
+    out = cv::Rect(l, t, r - l, b - t);
+    return true;
+}
+
+// Strips --name=value options out of argv so the positional parsers are unaffected.
+// Returns the new argc.
+static int parse_cli_options(int argc, char **argv)
+{
+    int out = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *a = argv[i];
+        if (std::strncmp(a, "--", 2) != 0)
+        {
+            argv[out++] = argv[i];
+            continue;
+        }
+        const char *eq = std::strchr(a, '=');
+        std::string key = eq ? std::string(a + 2, eq) : std::string(a + 2);
+        const char *val = eq ? eq + 1 : "";
+        cv::Rect r;
+        if (key == "format")
+        {
+            int v = std::atoi(val);
+            if (v == 1 || v == 2)
+                gMacroVersion = (uint32_t)v;
+            else
+                std::fprintf(stderr, "Bad --format=%s (expected 1 or 2)\n", val);
+        }
+        else if (key == "quantum")
+            gPlayQuantumUs = std::max(0, std::atoi(val));
+        else if (key == "coalesce")
+            gCoalescePx = std::max(0, std::atoi(val));
+        else if (key == "ui-hz")
+            gUiHz = std::clamp(std::atoi(val), 1, 1000);
+        else if (key == "speed")
+            gPlaySpeed = std::clamp(std::atof(val), 0.5, 4.0);
+        else if (key == "loop")
+            gPlayLoops = (*val == '\0') ? 0 : std::max(0, std::atoi(val));
+        else if (key == "seek")
+            gPlaySeekUs = (uint64_t)(std::max(0.0, std::atof(val)) * 1000000.0);
+        else if (key == "ocr")
+        {
+            if (std::strcmp(val, "digits") == 0)
+                gQuestDigits = true;
+            else if (std::strcmp(val, "tesseract") == 0)
+                gQuestDigits = false;
+            else
+                std::fprintf(stderr, "Bad --ocr=%s (expected digits or tesseract)\n", val);
+        }
+        else if (key == "trace")
+        {
+            gTracePath = val;
+            gTraceOn = !gTracePath.empty();
+        }
+        else if (key == "log")
+            gLogPerSec = std::max(0, std::atoi(val));
+        else if (key == "affinity")
+            gWorkerAffinity = (ULONG_PTR)std::strtoull(val, nullptr, 0);
+        else if (key == "raw")
+        {
+            if (std::strcmp(val, "buffer") == 0)
+                gRawBuffered = true;
+            else if (std::strcmp(val, "message") == 0)
+                gRawBuffered = false;
+            else
+                std::fprintf(stderr, "Bad --raw=%s (expected buffer or message)\n", val);
+        }
+        else if (key == "abs")
+        {
+            if (std::strcmp(val, "input") == 0)
+                gAbsFromInput = true;
+            else if (std::strcmp(val, "poll") == 0)
+                gAbsFromInput = false;
+            else
+                std::fprintf(stderr, "Bad --abs=%s (expected input or poll)\n", val);
+        }
+        else if (key == "cursor")
+        {
+            if (std::strcmp(val, "shape") == 0)
+                gCursorShapeMode = true;
+            else if (std::strcmp(val, "scan") == 0)
+                gCursorShapeMode = false;
+            else
+                std::fprintf(stderr, "Bad --cursor=%s (expected shape or scan)\n", val);
+        }
+        else if (key == "track")
+            gQuestTrack = std::atoi(val) != 0;
+        else if (key == "gpu")
+        {
+            if (std::strcmp(val, "opencl") == 0)
+                gGpuMatch = true;
+            else if (std::strcmp(val, "off") == 0)
+                gGpuMatch = false;
+            else
+                std::fprintf(stderr, "Bad --gpu=%s (expected opencl or off)\n", val);
+        }
+        else if (key == "pyramid")
+            gEnemyPyramid = std::atoi(val);
+        else if (key == "threads")
+            gMatchThreads = std::max(0, std::atoi(val));
+        else if (key == "roi")
+        {
+            if (parse_rect_arg(val, r))
+                gEnemyRoi = r;
+            else
+                std::fprintf(stderr, "Bad --roi=%s (expected L,T,R,B)\n", val);
+        }
+        else if (key == "capture")
+        {
+            if (std::strcmp(val, "monitor") == 0)
+                gCaptureScope = CAPTURE_MONITOR;
+            else if (std::strcmp(val, "window") == 0)
+                gCaptureScope = CAPTURE_WINDOW;
+            else if (std::strcmp(val, "virtual") == 0)
+                gCaptureScope = CAPTURE_VIRTUAL;
+            else
+                std::fprintf(stderr, "Bad --capture=%s (expected monitor, window or virtual)\n", val);
+        }
+        else if (key == "battle-roi")
+        {
+            if (parse_rect_arg(val, r))
+                gBattleRoi = r;
+            else
+                std::fprintf(stderr, "Bad --battle-roi=%s (expected L,T,R,B)\n", val);
+        }
+        else if (key == "gate")
+        {
+            if (std::strcmp(val, "tiles") == 0)
+                gFrameGate = true;
+            else if (std::strcmp(val, "off") == 0)
+                gFrameGate = false;
+            else
+                std::fprintf(stderr, "Bad --gate=%s (expected tiles or off)\n", val);
+        }
+        else if (key == "exclude")
+        {
+            if (parse_rect_arg(val, r))
+                gEnemyExclude.push_back(r);
+            else
+                std::fprintf(stderr, "Bad --exclude=%s (expected L,T,R,B)\n", val);
+        }
+        else
+            std::fprintf(stderr, "Unknown option: %s\n", a);
+    }
+    argv[out] = nullptr;
+    return out;
+}
+
 // ========================= main =========================
 
 int main(int argc, char **argv)
 {
     enable_dpi_awareness();
+    argc = parse_cli_options(argc, argv);
 
     if (argc < 2)
     {
@@ -2506,6 +8704,57 @@ int main(int argc, char **argv)
             "                  Converts binary macro to editable text file.\n"
             "  %s import      <file.txt> <file.rmac>\n"
             "                  Converts edited text file back to binary macro.\n"
+            "  %s convert     <in.rmac> <out.rmac> [version=2]\n"
+            "                  Rewrites a macro as v1 (raw) or v2 (compact, indexed).\n"
+            "  %s cut         <in.rmac> <out.rmac> <from_s> <to_s>\n"
+            "                  Removes that span; later events move up.\n"
+            "  %s splice      <a.rmac> <b.rmac> <out.rmac> [at_s=end] [gap_ms=0]\n"
+            "                  Inserts b into a at at_s (default: appends b).\n"
+            "  %s retime      <in.rmac> <out.rmac> <factor> [from_s=0] [to_s=end]\n"
+            "                  Stretches a span in time (2 = twice as long, 0.5 = twice as fast).\n"
+            "  %s filter-type <in.rmac> <out.rmac> <TYPE[,TYPE...]>\n"
+            "                  Drops events of those types (MOUSE_MOVE, MOUSE_POS, KEY_DOWN, ...).\n"
+            "  %s verify      [file=%s]\n"
+            "                  Plays once while capturing the injected input; reports timing error,\n"
+            "                  drift, reordering and lost events.\n"
+            "  %s bench capture [dir=%s] [frames=200] [interval_ms=200]\n"
+            "                  Saves live screen frames for offline benchmarking.\n"
+            "  %s bench calibrate <template.png> <gray|hue|sat|bgr> [dir=%s] [bgr_th=0.80]\n"
+            "                  Match a template in one channel: derives its threshold there from the\n"
+            "                  BGR verdicts on saved frames and writes template.png.match.\n"
+            "                  hue is refused for red templates (OpenCV hue wraps at 0/179).\n"
+            "  %s bench       [dir] [enemies] [battle] [eTh] [bTh] [marker] [mTh] [passes=1]\n"
+            "                  Times hunt/marker/OCR stages on saved frames (p50/p95/p99, fps;\n"
+            "                  allocs/call: cv::Mat buffers, plus operator new in builds with\n"
+            "                  /DRECORDER_COUNT_ALLOCS).\n"
+            "\nOptions (any position, hunt modes):\n"
+            "  --pyramid=N        coarse-to-fine enemy match on a 1/N frame (1=off, 2, 4)\n"
+            "  --roi=L,T,R,B      search enemies only inside this screen rect\n"
+            "  --exclude=L,T,R,B  ignore enemy matches centred here (repeatable: HUD, quest log)\n"
+            "  --battle-roi=L,T,R,B  look for BattleStart only here, on every new frame\n"
+            "  --gate=off         rematch the whole screen every scan (default: changed tiles only)\n"
+            "  --capture=MODE     monitor (game's monitor, default), window (its client area) or virtual\n"
+            "                     (all monitors); ROI/exclude/ignore rects are relative to the capture\n"
+            "  --threads=N        enemy template match workers (0=auto)\n"
+            "  --gpu=opencl       match templates on the GPU via OpenCL (falls back to CPU)\n"
+            "  --format=N         .rmac version written by record/full/import (1 or 2, default 2)\n"
+            "  --quantum=US       playback: inject events due within US of each other together (1000)\n"
+            "  --coalesce=PX      playback: merge back-to-back REL moves up to PX per axis (0=off)\n"
+            "  --ui-hz=N          overlay render rate; playback cursor refresh rate (60)\n"
+            "  --speed=X          playback speed multiplier (0.5 - 4.0)\n"
+            "  --loop[=N]         playback: repeat N times (no value or 0 = until ESC)\n"
+            "  --seek=S           playback: start at S seconds into the recording\n"
+            "  --ocr=digits       questwalk/playfull: glyph digit reader, Tesseract as fallback\n"
+            "  --track=0          questwalk/playfull: search the whole screen for the marker every tick\n"
+            "  --cursor=scan      ABS cursor detection by screen ROI every scan_ms (default: shape,\n"
+            "                     match once per OS cursor image change)\n"
+            "  --abs=poll         ABS positions from a GetCursorPos thread every abs_poll_ms\n"
+            "                     (default: read at each raw input packet)\n"
+            "  --trace=FILE.json  write a Chrome trace (chrome://tracing) of every stage at exit\n"
+            "  --log=N            per-tick console logging, at most N lines/s per site (default off)\n"
+            "  --affinity=MASK    pin capture/detect/OCR threads to these CPUs (e.g. 0xF0)\n"
+            "  --raw=message      record from the sink window one WM_INPUT at a time\n"
+            "                     (default: GetRawInputBuffer batches on an input thread)\n"
             "\nTypical workflow:\n"
             "  1) Recorder.exe full macro.rmac           <- record while hunting\n"
             "  2) Recorder.exe export macro.rmac edit.txt <- export to text\n"
@@ -2520,7 +8769,10 @@ int main(int argc, char **argv)
             argv[0], argv[0],
             argv[0], kDefaultQuestPath,
             argv[0], kDefaultEnemyPath, kDefaultBattlePath,
-            argv[0], argv[0],
+            argv[0], argv[0], argv[0],
+            argv[0], argv[0], argv[0], argv[0],
+            argv[0], kDefaultMacroFile,
+            argv[0], kDefaultBenchDir, argv[0], kDefaultBenchDir, argv[0],
             kArrivalMeters, kResumeMeters);
         return 0;
     }
@@ -2547,6 +8799,74 @@ int main(int argc, char **argv)
         return import_macro(argv[2], argv[3]) ? 0 : 1;
     }
 
+    if (cmd == "convert")
+    {
+        if (argc < 4)
+        {
+            std::fprintf(stderr, "Usage: %s convert <in.rmac> <out.rmac> [version=2]\n", argv[0]);
+            return 1;
+        }
+        int v = (argc >= 5) ? std::atoi(argv[4]) : 2;
+        if (v != 1 && v != 2)
+        {
+            std::fprintf(stderr, "Unknown .rmac version: %d (expected 1 or 2)\n", v);
+            return 1;
+        }
+        return convert_macro(argv[2], argv[3], (uint32_t)v) ? 0 : 1;
+    }
+
+    if (cmd == "cut")
+    {
+        if (argc < 6)
+        {
+            std::fprintf(stderr, "Usage: %s cut <in.rmac> <out.rmac> <from_s> <to_s>\n", argv[0]);
+            return 1;
+        }
+        return cut_macro(argv[2], argv[3], std::atof(argv[4]), std::atof(argv[5])) ? 0 : 1;
+    }
+
+    if (cmd == "splice")
+    {
+        if (argc < 5)
+        {
+            std::fprintf(stderr, "Usage: %s splice <a.rmac> <b.rmac> <out.rmac> [at_s=end] [gap_ms=0]\n", argv[0]);
+            return 1;
+        }
+        double at = (argc >= 6 && std::strcmp(argv[5], "end") != 0) ? std::atof(argv[5]) : -1.0;
+        double gap = (argc >= 7) ? std::atof(argv[6]) : 0.0;
+        return splice_macro(argv[2], argv[3], argv[4], at, gap) ? 0 : 1;
+    }
+
+    if (cmd == "retime")
+    {
+        if (argc < 5)
+        {
+            std::fprintf(stderr, "Usage: %s retime <in.rmac> <out.rmac> <factor> [from_s=0] [to_s=end]\n", argv[0]);
+            return 1;
+        }
+        double from = (argc >= 6) ? std::atof(argv[5]) : 0.0;
+        double to = (argc >= 7 && std::strcmp(argv[6], "end") != 0) ? std::atof(argv[6]) : -1.0;
+        return retime_macro(argv[2], argv[3], std::atof(argv[4]), from, to) ? 0 : 1;
+    }
+
+    if (cmd == "filter-type")
+    {
+        if (argc < 5)
+        {
+            std::fprintf(stderr, "Usage: %s filter-type <in.rmac> <out.rmac> <TYPE[,TYPE...]>\n", argv[0]);
+            return 1;
+        }
+        return filter_type_macro(argv[2], argv[3], argv[4]) ? 0 : 1;
+    }
+
+    // Every remaining command watches ESC/Alt/Shift
+    gInput.start();
+    init_gpu_backend();
+    struct TraceExport
+    {
+        ~TraceExport() { export_trace(); }
+    } traceExport;
+
     if (cmd == "record")
     {
         const char *file = (argc >= 3) ? argv[2] : kDefaultMacroFile;
@@ -2589,8 +8909,8 @@ int main(int argc, char **argv)
         int dz = (argc >= 5) ? std::atoi(argv[4]) : 40;
         int tick = (argc >= 6) ? std::atoi(argv[5]) : 50;
         parse_ignore_rect(argc, argv, 6);
-        cv::Mat qt = cv::imread(qp, cv::IMREAD_COLOR);
-        if (qt.empty())
+        auto qt = gBank.load(qp, BankOptions{});
+        if (!qt)
         {
             std::fprintf(stderr, "Failed to load: %s\n", qp);
             return 1;
@@ -2613,7 +8933,7 @@ int main(int argc, char **argv)
         gBattleTh = bt;
         gScanMs = sm;
         gCooldownMs = cm;
-        gPlaying = true;
+        set_and_wake(gPlaying, true);
         bool overlay_ok = create_overlay_window();
         if (overlay_ok)
         {
@@ -2623,13 +8943,13 @@ int main(int argc, char **argv)
         timeBeginPeriod(1);
         start_auto_hunt(ep, bp, et, bt, sm, cm);
         std::puts("[HUNT] Standalone. ESC to stop.");
-        while (!(GetAsyncKeyState(VK_ESCAPE) & 0x8000))
+        while (!gInput.escDown())
         {
             maybe_restart_hunt_on_shift();
             pump_messages_nonblocking();
-            Sleep(50);
+            gWake.sleepFor(50, [] { return gInput.escDown(); });
         }
-        gPlaying = false;
+        set_and_wake(gPlaying, false);
         stop_all_threads();
         timeEndPeriod(1);
         if (overlay_ok)
@@ -2641,6 +8961,45 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    if (cmd == "verify")
+    {
+        const char *file = (argc >= 3) ? argv[2] : kDefaultMacroFile;
+        return verify_playback(file) ? 0 : 1;
+    }
+
+    if (cmd == "bench")
+    {
+        if (argc >= 3 && std::strcmp(argv[2], "capture") == 0)
+        {
+            const char *dir = (argc >= 4) ? argv[3] : kDefaultBenchDir;
+            int n = (argc >= 5) ? std::atoi(argv[4]) : 200;
+            int interval = (argc >= 6) ? std::atoi(argv[5]) : 200;
+            return bench_capture(dir, std::max(1, n), std::max(0, interval)) ? 0 : 1;
+        }
+        if (argc >= 3 && std::strcmp(argv[2], "calibrate") == 0)
+        {
+            MatchSpace sp;
+            if (argc < 5 || !parse_space(argv[4], sp))
+            {
+                std::fprintf(stderr, "Usage: %s bench calibrate <template.png> <gray|hue|sat|bgr> [dir=%s] [bgr_th=0.80]\n",
+                             argv[0], kDefaultBenchDir);
+                return 1;
+            }
+            const char *dir = (argc >= 6) ? argv[5] : kDefaultBenchDir;
+            double th = (argc >= 7) ? std::atof(argv[6]) : 0.80;
+            return bench_calibrate(argv[3], sp, dir, th) ? 0 : 1;
+        }
+        const char *dir = (argc >= 3) ? argv[2] : kDefaultBenchDir;
+        const char *ep = (argc >= 4) ? argv[3] : kDefaultEnemyPath;
+        const char *bp = (argc >= 5) ? argv[4] : kDefaultBattlePath;
+        double et = (argc >= 6) ? std::atof(argv[5]) : gEnemyTh;
+        double bt = (argc >= 7) ? std::atof(argv[6]) : gBattleTh;
+        const char *qp = (argc >= 8) ? argv[7] : kDefaultQuestPath;
+        double mth = (argc >= 9) ? std::atof(argv[8]) : gMarkerTh;
+        int passes = (argc >= 10) ? std::atoi(argv[9]) : 1;
+        return bench_run(dir, ep, bp, et, bt, qp, mth, passes) ? 0 : 1;
+    }
+
     if (cmd == "playfull")
     {
         const char *file = (argc >= 3) ? argv[2] : kDefaultMacroFile;